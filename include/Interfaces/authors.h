@@ -56,6 +56,7 @@ public:
 
     bool LoadAuthors(QString website, bool forced = false);
     QHash<int, QSet<int>> LoadFullFavouritesHashset();
+    QHash<int, QSet<int>> LoadFavouritesHashsetUpdatedSince(QDateTime date);
 
     //for the future, not strictly necessary atm
 //    bool LoadAdditionalInfo(core::AuthorPtr) = 0;
@@ -97,6 +97,7 @@ class Fanfics : public IDBWebIDIndex {
 
     QVector<core::FicWeightPtr> GetAllFicsWithEnoughFavesForWeights(int faves);
     QHash<int, core::FicWeightPtr> GetHashOfAllFicsWithEnoughFavesForWeights(int faves);
+    QHash<int, core::FicWeightPtr> GetHashOfFicsWithEnoughFavesForWeightsUpdatedSince(int faves, QDateTime date);
 
     bool ProcessSlashFicsBasedOnWords( std::function<SlashPresence (QString, QString, QString)> func);
 
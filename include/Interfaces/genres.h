@@ -131,6 +131,7 @@ public:
     bool WriteDetectedGenres(QVector<genre_stats::FicGenreData> fics);
     bool WriteDetectedGenresIteration2(QVector<genre_stats::FicGenreData> fics);
     QHash<int, QList<genre_stats::GenreBit>> GetFullGenreList(bool useOriginalgenres = false);
+    QHash<int, QList<genre_stats::GenreBit>> GetGenreListUpdatedSince(QDateTime date, bool useOriginalgenres = false);
     static void LogGenreDistribution(std::array<double, 22>& data, QString target= QStringLiteral(""));
     static QString MoodForGenre(QString genre);
     static void WriteMoodValue(QString mood,  float value, genre_stats::ListMoodData& );
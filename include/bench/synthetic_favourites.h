@@ -0,0 +1,96 @@
+/*
+Flipper is a recommendation and search engine for fanfiction.net
+Copyright (C) 2017-2020  Marchenko Nikolai
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+#pragma once
+#include <QHash>
+#include <QSharedPointer>
+#include <QString>
+
+#include <cstdint>
+#include <vector>
+
+#include "include/core/fanfic.h"
+#include "include/core/fic_genre_data.h"
+#include "include/data_code/rec_calc_data.h"
+
+namespace bench{
+
+// shape of the generated data, every value that isn't random comes from here
+struct SyntheticDataOptions{
+    uint64_t seed = 1;
+    int authors = 200000;
+    int fics = 300000;
+    int fandoms = 2000;
+    // favourite list sizes follow a power law between these with the given exponent
+    int minListSize = 3;
+    int maxListSize = 5000;
+    double listSizeExponent = 1.7;
+    // popularity of fandoms and of fics inside a fandom is zipf distributed with this exponent
+    double popularityExponent = 1.1;
+    // every author mostly favourites fics of a few fandoms of their own
+    int fandomsPerAuthor = 3;
+    double ownFandomShare = 0.85;
+};
+
+// everything about a generated user that a list is created from
+struct SyntheticUser{
+    QHash<uint32_t, core::FicWeightPtr> fetchedFics;
+    genre_stats::GenreMoodData moodData;
+};
+
+// deterministic on every platform, std distributions are not guaranteed to be
+class SplitMix{
+public:
+    explicit SplitMix(uint64_t seed): state(seed){}
+    uint64_t Next();
+    // [0, 1)
+    double NextDouble();
+    // [0, bound)
+    uint32_t NextBelow(uint32_t bound);
+
+private:
+    uint64_t state = 0;
+};
+
+class SyntheticFavourites{
+public:
+    explicit SyntheticFavourites(SyntheticDataOptions options);
+
+    // fills fics, favourites and moods and builds everything derived from them
+    // derived files that are stored on disk go into storageFolder
+    void Fill(core::DataHolder& data, QString storageFolder);
+    // a user that is generated like the authors but isn't one of them
+    SyntheticUser CreateUser(const core::DataHolder& data, int listSize, uint64_t userSeed) const;
+
+private:
+    struct Fandom{
+        std::vector<uint32_t> fics;
+        // cumulative zipf weights of fics inside the fandom
+        std::vector<double> weights;
+    };
+    uint32_t PickFandom(SplitMix& random) const;
+    uint32_t PickFic(SplitMix& random, uint32_t fandom) const;
+    int PickListSize(SplitMix& random) const;
+    Roaring CreateList(SplitMix& random, int size) const;
+    static genre_stats::ListMoodData CreateMoods(SplitMix& random);
+
+    SyntheticDataOptions options;
+    std::vector<Fandom> fandoms;
+    std::vector<double> fandomWeights;
+};
+
+}
@@ -0,0 +1,84 @@
+/*
+Flipper is a recommendation and search engine for fanfiction.net
+Copyright (C) 2017-2020  Marchenko Nikolai
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <vector>
+
+namespace core{
+
+// hands out memory by moving a pointer through a few big chunks, deallocation does nothing
+// Reset rewinds to the first chunk but keeps all of them, so once the arena has grown to
+// what a workload needs it serves the same workload again without touching the heap
+// not thread safe, containers allocated from it have to be gone before Reset
+class BumpArena : public std::pmr::memory_resource{
+public:
+    explicit BumpArena(size_t chunkSize = 1 << 20): chunkSize(chunkSize){}
+    BumpArena(const BumpArena&) = delete;
+    BumpArena& operator=(const BumpArena&) = delete;
+
+    void Reset(){
+        current = 0;
+        offset = 0;
+    }
+    size_t Capacity() const{
+        size_t result = 0;
+        for(const auto& chunk : chunks)
+            result += chunk.size;
+        return result;
+    }
+
+private:
+    struct Chunk{
+        std::unique_ptr<std::byte[]> data;
+        size_t size = 0;
+    };
+
+    void* TryAllocate(Chunk& chunk, size_t bytes, size_t alignment){
+        void* position = chunk.data.get() + offset;
+        size_t space = chunk.size - offset;
+        if(!std::align(alignment, bytes, position, space))
+            return nullptr;
+        offset = chunk.size - space + bytes;
+        return position;
+    }
+    void* do_allocate(size_t bytes, size_t alignment) override{
+        for(; current < chunks.size(); current++, offset = 0)
+            if(auto position = TryAllocate(chunks[current], bytes, alignment))
+                return position;
+        Chunk chunk;
+        chunk.size = std::max(chunkSize, bytes + alignment);
+        chunk.data.reset(new std::byte[chunk.size]);
+        chunks.push_back(std::move(chunk));
+        current = chunks.size() - 1;
+        return TryAllocate(chunks.back(), bytes, alignment);
+    }
+    void do_deallocate(void*, size_t, size_t) override {}
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override{
+        return this == &other;
+    }
+
+    size_t chunkSize = 0;
+    size_t current = 0;
+    size_t offset = 0;
+    std::vector<Chunk> chunks;
+};
+
+}
@@ -75,6 +75,8 @@ public:
     bool useDeadFicIgnore= false;
     bool assignLikedToSources = false;
     bool ignoreBreakdowns = false;
+    // candidate authors come from the favourites sketch instead of the exact fic to favourites index
+    bool useApproximateCandidates = false;
 
     int id = -1;
     int ficCount =-1;
@@ -0,0 +1,258 @@
+/*Flipper is a recommendation and search engine for fanfiction.net
+Copyright (C) 2017-2020  Marchenko Nikolai
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>*/
+#pragma once
+#include <QHash>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QReadWriteLock>
+#include <QString>
+#include <QVector>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// spans are recorded into per thread storage without any locking
+// reporting (metrics file, per request chrome traces) lives in stage_tracing_report.h
+namespace tracing{
+
+// log-linear buckets like HdrHistogram does, every bucket is at most 1/subBucketCount wide relative to its values
+struct HistogramData{
+    static constexpr int subBucketBits = 5;
+    static constexpr uint64_t subBucketCount = 1ull << subBucketBits;
+    // 2^40 microseconds are twelve days, anything longer lands in the last bucket
+    static constexpr int maxMagnitude = 40;
+    static constexpr size_t bucketCount = (maxMagnitude - subBucketBits + 1) * subBucketCount;
+
+    static size_t BucketFor(uint64_t value){
+        if(value < subBucketCount)
+            return static_cast<size_t>(value);
+        int magnitude = subBucketBits;
+        while(magnitude < maxMagnitude && (value >> (magnitude + 1)) != 0)
+            magnitude++;
+        if(magnitude >= maxMagnitude)
+            return bucketCount - 1;
+        const int shift = magnitude - subBucketBits;
+        return static_cast<size_t>((shift + 1) * subBucketCount + ((value >> shift) - subBucketCount));
+    }
+    static uint64_t LowerBound(size_t bucket){
+        if(bucket < subBucketCount)
+            return bucket;
+        const auto shift = bucket/subBucketCount - 1;
+        return (bucket%subBucketCount + subBucketCount) << shift;
+    }
+    static uint64_t UpperBound(size_t bucket){
+        return bucket + 1 < bucketCount ? LowerBound(bucket + 1) - 1 : LowerBound(bucket);
+    }
+
+    void Add(const HistogramData& other){
+        for(size_t i = 0; i < bucketCount; i++)
+            counts[i] += other.counts[i];
+        count += other.count;
+        sum += other.sum;
+        max = std::max(max, other.max);
+    }
+    // upper bound of the bucket the value at this percentile falls into, never above the largest recorded value
+    uint64_t ValueAtPercentile(double percentile) const{
+        if(count == 0)
+            return 0;
+        uint64_t target = static_cast<uint64_t>(percentile/100.0 * static_cast<double>(count) + 0.5);
+        target = std::max<uint64_t>(1, std::min(target, count));
+        uint64_t seen = 0;
+        for(size_t i = 0; i < bucketCount; i++)
+        {
+            seen += counts[i];
+            if(seen >= target)
+                return std::min(UpperBound(i), max);
+        }
+        return max;
+    }
+
+    std::array<uint64_t, bucketCount> counts = {};
+    uint64_t count = 0;
+    uint64_t sum = 0;
+    uint64_t max = 0;
+};
+
+// written by its own thread only, other threads just read it while collecting statistics
+struct LiveHistogram{
+    void Record(uint64_t value){
+        auto bump = [](std::atomic<uint64_t>& counter, uint64_t amount){
+            counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+        };
+        bump(counts[HistogramData::BucketFor(value)], 1);
+        bump(count, 1);
+        bump(sum, value);
+        if(value > max.load(std::memory_order_relaxed))
+            max.store(value, std::memory_order_relaxed);
+    }
+    void AddTo(HistogramData& data) const{
+        for(size_t i = 0; i < HistogramData::bucketCount; i++)
+            data.counts[i] += counts[i].load(std::memory_order_relaxed);
+        data.count += count.load(std::memory_order_relaxed);
+        data.sum += sum.load(std::memory_order_relaxed);
+        data.max = std::max(data.max, max.load(std::memory_order_relaxed));
+    }
+
+    std::array<std::atomic<uint64_t>, HistogramData::bucketCount> counts = {};
+    std::atomic<uint64_t> count{0};
+    std::atomic<uint64_t> sum{0};
+    std::atomic<uint64_t> max{0};
+};
+
+// a finished span, kept in the ring buffer of the thread that recorded it
+struct SpanEvent{
+    uint32_t name = 0;
+    // request the span belongs to, 0 if none is being traced on this thread
+    uint32_t trace = 0;
+    int64_t start = 0;
+    int64_t duration = 0;
+};
+
+struct ThreadTraceState;
+
+// everything shared between threads, touched only when a new span name or thread appears and while reporting
+struct TraceRegistry{
+    static constexpr size_t maxSpanNames = 1024;
+
+    QReadWriteLock namesLock;
+    QHash<QString, uint32_t> idForName;
+    QVector<QString> names;
+
+    QMutex threadsLock;
+    std::vector<ThreadTraceState*> threads;
+    // statistics of threads that are gone
+    std::vector<HistogramData> retired;
+    uint32_t nextThreadId = 1;
+
+    std::atomic<uint32_t> nextTrace{1};
+    std::atomic<bool> logSpans{true};
+    const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+};
+
+inline TraceRegistry& Registry(){
+    static TraceRegistry registry;
+    return registry;
+}
+
+struct ThreadTraceState{
+    static constexpr size_t ringSize = 4096;
+
+    ThreadTraceState(){
+        auto& registry = Registry();
+        QMutexLocker locker(&registry.threadsLock);
+        threadId = registry.nextThreadId++;
+        registry.threads.push_back(this);
+    }
+    ~ThreadTraceState(){
+        auto& registry = Registry();
+        QMutexLocker locker(&registry.threadsLock);
+        for(size_t i = 0; i < histograms.size(); i++)
+        {
+            if(!histograms[i])
+                continue;
+            if(registry.retired.size() <= i)
+                registry.retired.resize(i + 1);
+            histograms[i]->AddTo(registry.retired[i]);
+        }
+        registry.threads.erase(std::find(registry.threads.begin(), registry.threads.end(), this));
+    }
+    void Record(uint32_t name, int64_t start, int64_t duration){
+        if(name >= TraceRegistry::maxSpanNames)
+            return;
+        if(!histograms[name])
+        {
+            // histogram is created under the lock so that a collecting thread never sees it half made
+            auto& registry = Registry();
+            QMutexLocker locker(&registry.threadsLock);
+            histograms[name].reset(new LiveHistogram());
+        }
+        histograms[name]->Record(static_cast<uint64_t>(std::max<int64_t>(0, duration)));
+        ring[written%ringSize] = {name, trace, start, duration};
+        written++;
+    }
+
+    uint32_t threadId = 0;
+    uint32_t trace = 0;
+    std::array<std::unique_ptr<LiveHistogram>, TraceRegistry::maxSpanNames> histograms;
+    // only ever read by the thread that owns it
+    std::array<SpanEvent, ringSize> ring;
+    uint64_t written = 0;
+};
+
+// created on first use so that threads that never record anything don't pay for the ring buffer
+inline ThreadTraceState& CurrentThread(){
+    thread_local std::unique_ptr<ThreadTraceState> state;
+    if(!state)
+        state.reset(new ThreadTraceState());
+    return *state;
+}
+
+// ids are handed out once per name, hot paths can keep theirs in a static
+inline uint32_t SpanId(const QString& name){
+    auto& registry = Registry();
+    {
+        QReadLocker locker(&registry.namesLock);
+        auto it = registry.idForName.constFind(name);
+        if(it != registry.idForName.cend())
+            return it.value();
+    }
+    QWriteLocker locker(&registry.namesLock);
+    auto it = registry.idForName.constFind(name);
+    if(it != registry.idForName.cend())
+        return it.value();
+    auto id = static_cast<uint32_t>(registry.names.size());
+    registry.names.push_back(name);
+    registry.idForName.insert(name, id);
+    return id;
+}
+
+inline int64_t Now(){
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - Registry().epoch).count();
+}
+
+inline void RecordSpan(uint32_t name, int64_t start, int64_t duration){
+    CurrentThread().Record(name, start, duration);
+}
+
+// whether TimedAction still writes its line into the log next to recording a span
+inline bool LogSpans(){
+    return Registry().logSpans.load(std::memory_order_relaxed);
+}
+inline void SetLogSpans(bool value){
+    Registry().logSpans = value;
+}
+
+class ScopedSpan{
+public:
+    explicit ScopedSpan(uint32_t name): name(name), start(Now()){}
+    explicit ScopedSpan(const QString& name): ScopedSpan(SpanId(name)){}
+    ScopedSpan(const ScopedSpan&) = delete;
+    ScopedSpan& operator=(const ScopedSpan&) = delete;
+    ~ScopedSpan(){
+        RecordSpan(name, start, Now() - start);
+    }
+
+private:
+    uint32_t name = 0;
+    int64_t start = 0;
+};
+
+}
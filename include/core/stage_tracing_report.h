@@ -0,0 +1,59 @@
+/*Flipper is a recommendation and search engine for fanfiction.net
+Copyright (C) 2017-2020  Marchenko Nikolai
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>*/
+#pragma once
+#include "core/stage_tracing.h"
+
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+namespace tracing{
+
+struct SpanStatistics{
+    QString name;
+    HistogramData histogram;
+};
+
+// latencies of every span name recorded so far by all threads, alive or finished
+QVector<SpanStatistics> CollectStatistics();
+// one line per span name: count, mean, p50, p90, p99, p99.9 and max in microseconds
+QStringList DescribeStatistics(const QVector<SpanStatistics>& statistics);
+// replaces the file as a whole so that readers never see it half written
+bool WriteMetricsFile(QString fileName);
+
+// marks spans recorded on this thread as belonging to a single request
+// the request itself is recorded as a span too, if a folder is given every span of the request
+// ends up in <folder>/<name>_<id>.json that chrome://tracing and perfetto can open
+class RequestTrace{
+public:
+    RequestTrace(QString name, QString folder = {});
+    RequestTrace(const RequestTrace&) = delete;
+    RequestTrace& operator=(const RequestTrace&) = delete;
+    ~RequestTrace();
+
+private:
+    void WriteTrace(int64_t duration);
+
+    QString name;
+    QString folder;
+    uint32_t nameId = 0;
+    uint32_t id = 0;
+    uint32_t previousTrace = 0;
+    uint64_t firstEvent = 0;
+    int64_t start = 0;
+};
+
+}
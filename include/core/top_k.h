@@ -0,0 +1,71 @@
+/*
+Flipper is a recommendation and search engine for fanfiction.net
+Copyright (C) 2017-2020  Marchenko Nikolai
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+#pragma once
+#include <algorithm>
+#include <vector>
+
+namespace core{
+
+struct ScoredId{
+    int score = 0;
+    int id = -1;
+};
+
+// the order all score based rankings use: higher score first, equal scores go by ascending id
+inline bool RanksHigher(const ScoredId& first, const ScoredId& second){
+    if(first.score != second.score)
+        return first.score > second.score;
+    return first.id < second.id;
+}
+
+// keeps the best k of everything pushed into it
+// the worst kept candidate sits on top of the heap so most candidates are rejected with a single comparison
+class TopK{
+public:
+    explicit TopK(size_t limit): limit(limit){
+        heap.reserve(limit);
+    }
+    void Push(int score, int id){
+        if(limit == 0)
+            return;
+        ScoredId candidate{score, id};
+        if(heap.size() < limit)
+        {
+            heap.push_back(candidate);
+            std::push_heap(heap.begin(), heap.end(), RanksHigher);
+            return;
+        }
+        if(!RanksHigher(candidate, heap.front()))
+            return;
+        std::pop_heap(heap.begin(), heap.end(), RanksHigher);
+        heap.back() = candidate;
+        std::push_heap(heap.begin(), heap.end(), RanksHigher);
+    }
+    size_t Size() const {return heap.size();}
+    // best first
+    std::vector<ScoredId> Take(){
+        std::sort_heap(heap.begin(), heap.end(), RanksHigher);
+        return std::move(heap);
+    }
+
+private:
+    size_t limit = 0;
+    std::vector<ScoredId> heap;
+};
+
+}
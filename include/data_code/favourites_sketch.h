@@ -0,0 +1,66 @@
+/*
+Flipper is a recommendation and search engine for fanfiction.net
+Copyright (C) 2017-2020  Marchenko Nikolai
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+#pragma once
+#include <QHash>
+#include <QString>
+
+#include <array>
+#include <vector>
+
+#include "third_party/roaring/roaring.hh"
+
+namespace core{
+
+// MinHash signature of every favourite list plus an LSH banding index over them
+// used to find authors that are likely to share a good part of user's list without intersecting everyone
+class FavouritesSketch{
+public:
+    static constexpr int signatureSize = 64;
+    typedef std::array<uint32_t, signatureSize> Signature;
+
+    // rowsPerBand controls the similarity at which authors start to come up as candidates
+    // fewer rows catch lists that only share a small part of user's favourites
+    void Build(const QHash<int, Roaring>& faves, int rowsPerBand = 2);
+    bool Save(QString storageFolder) const;
+    // fails when there's no stored sketch or it was built for different favourites or a different rowsPerBand
+    bool Load(QString storageFolder, const QHash<int, Roaring>& faves, int rowsPerBand = 2);
+    void Clear();
+    bool IsReady() const {return authorCount > 0;}
+
+    static Signature SignatureFor(const Roaring& favourites);
+    // identity of every list's contents, files derived from the favourites store it to detect that they are stale
+    static uint64_t Fingerprint(const QHash<int, Roaring>& faves);
+    // authors that collide with the list in at least one band
+    Roaring Candidates(const Roaring& favourites) const;
+
+private:
+    // keys are truncated to 32 bits, rare collisions only add candidates that exact scoring drops anyway
+    struct BandEntry{
+        uint32_t key = 0;
+        uint32_t author = 0;
+    };
+    uint32_t BandKey(const Signature& signature, int band) const;
+
+    int rowsPerBand = 2;
+    uint64_t fingerprint = 0;
+    uint32_t authorCount = 0;
+    // entries of every band sorted by key
+    std::vector<std::vector<BandEntry>> bands;
+};
+
+}
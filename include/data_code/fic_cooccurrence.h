@@ -0,0 +1,120 @@
+/*
+Flipper is a recommendation and search engine for fanfiction.net
+Copyright (C) 2017-2020  Marchenko Nikolai
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+#pragma once
+#include "include/core/experimental/fic_relations.h"
+#include "third_party/roaring/roaring.hh"
+
+#include <QHash>
+#include <QMutex>
+#include <QString>
+#include <QStringList>
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace core{
+
+struct FicCooccurrence{
+    uint32_t fic1 = 0;
+    uint32_t fic2 = 0;
+    // amount of lists that have both fics
+    uint32_t meetingCount = 0;
+    // meetings relative to how often both fics are favourited at all, 1 when they are never seen apart
+    float attraction = 0;
+    // share of the lists with either fic that don't have the other one
+    float repulsion = 0;
+};
+
+// counts how many favourite lists every pair of fics meets in without holding all of the pairs in memory
+// every thread collects pairs until its buffer is full and writes them out sorted and delta encoded as a run,
+// runs are then merged per range of fic1 into a sparse matrix with one file per range
+class FicCooccurrenceBuilder{
+public:
+    struct Options{
+        // runs and the finished matrix go here, whatever an earlier build left in it is removed
+        QString folder;
+        // <= 0 means QThread::idealThreadCount()
+        int threads = 0;
+        // pairs a single thread keeps before writing a run, 8 bytes each
+        int pairsPerRun = 8*1024*1024;
+        // fic1 ranges, each of them is merged by a single thread
+        int partitions = 64;
+        // runs read at the same time by a single merge, more of them are merged in several passes
+        // every thread keeps this many files open while merging
+        int maxRunsPerMerge = 32;
+        // longer lists are skipped, their pairs are mostly noise and their amount grows quadratically
+        int maxListSize = 1200;
+        // pairs that met fewer times are not written into the matrix
+        int minMeetings = 2;
+    };
+
+    explicit FicCooccurrenceBuilder(Options options);
+    // lists are intersected with includedFics first, other fics never make it into a pair
+    bool Build(const QHash<int, Roaring>& favourites, const Roaring& includedFics);
+
+    qint64 ListCount() const {return listCount;}
+    qint64 PairCount() const {return pairCount;}
+
+private:
+    bool WriteRun(std::vector<uint64_t>& pairs);
+    bool MergeRuns();
+    bool WriteMatrix();
+    QString NextRunName();
+    void RemoveFiles() const;
+
+    Options options;
+    Roaring fics;
+    // indexed by the rank of a fic in fics
+    std::vector<uint32_t> listCounts;
+    // first fic of every partition
+    std::vector<uint32_t> partitionStarts;
+    QMutex runLock;
+    QStringList runs;
+    int runCounter = 0;
+    qint64 listCount = 0;
+    qint64 pairCount = 0;
+};
+
+// the matrix written by FicCooccurrenceBuilder
+class FicCooccurrenceMatrix{
+public:
+    static QString ManifestName(QString folder);
+    static QString PartitionName(QString folder, int partition);
+    static QString ListCountsName(QString folder);
+
+    bool Open(QString folder);
+    int Partitions() const {return partitions;}
+    qint64 ListCount() const {return listCount;}
+    qint64 PairCount() const {return pairCount;}
+    // amount of lists the fic was counted in
+    uint32_t ListCountForFic(uint32_t fic) const;
+    // pairs come ordered by fic1 and then fic2, fic1 is always the smaller one
+    bool ForEachInPartition(int partition, std::function<void(const FicCooccurrence&)> callback) const;
+    FicWeightResult ToWeightResult(const FicCooccurrence& pair) const;
+
+private:
+    QString folder;
+    int partitions = 0;
+    qint64 listCount = 0;
+    qint64 pairCount = 0;
+    std::vector<uint32_t> ficIds;
+    std::vector<uint32_t> listCounts;
+};
+
+}
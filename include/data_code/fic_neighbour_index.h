@@ -0,0 +1,66 @@
+/*
+Flipper is a recommendation and search engine for fanfiction.net
+Copyright (C) 2017-2020  Marchenko Nikolai
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+#pragma once
+#include <QFile>
+#include <QString>
+
+#include <cstdint>
+#include <utility>
+
+namespace core{
+struct DataHolder;
+
+// for every fic the fics that are favourited together with it most often
+// built offline from the favourites and served straight from a memory mapped file
+// it's an approximation of a single fic list: authors are picked by list size alone,
+// maxUnmatchedPerMatch, the ratio cutoff and ignored fandoms of a request don't change who is counted
+class FicNeighbourIndex{
+public:
+    struct Neighbour{
+        uint32_t fic = 0;
+        // amount of authors that have both fics in their favourites
+        uint32_t score = 0;
+    };
+    struct BuildOptions{
+        int neighbours = 120;
+        // only authors with list sizes in this range are counted, it stands in for the ratio filter of a single fic list
+        int minListSize = 10;
+        int maxListSize = 5000;
+    };
+    typedef std::pair<const Neighbour*, const Neighbour*> Range;
+
+    static bool Build(const DataHolder& data, QString fileName, BuildOptions options);
+    // fails when the file is missing or was built for different favourites
+    bool Open(QString fileName, uint64_t favouritesFingerprint);
+    void Close();
+    bool IsReady() const {return entries != nullptr;}
+    // fics that have exactly this many neighbours might have had more that didn't fit
+    int NeighbourLimit() const {return neighbourLimit;}
+    // best first, empty when the fic isn't in the index
+    Range NeighboursOf(uint32_t fic) const;
+
+private:
+    QFile file;
+    int neighbourLimit = 0;
+    uint32_t ficCount = 0;
+    const uint32_t* fics = nullptr;
+    const uint32_t* offsets = nullptr;
+    const Neighbour* entries = nullptr;
+};
+
+}
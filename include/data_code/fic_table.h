@@ -0,0 +1,157 @@
+/*
+Flipper is a recommendation and search engine for fanfiction.net
+Copyright (C) 2017-2020  Marchenko Nikolai
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+#pragma once
+#include <QDate>
+#include <QHash>
+#include <QSharedPointer>
+#include <QStringList>
+
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "include/core/fanfic.h"
+
+namespace core{
+class ServerSnapshotFile;
+
+// a column either owns its values or points into a mapped snapshot that the table keeps alive
+template <typename T>
+class FicColumn{
+public:
+    FicColumn() = default;
+    FicColumn(const FicColumn& other){*this = other;}
+    FicColumn(FicColumn&&) = default;
+    FicColumn& operator=(const FicColumn& other){
+        storage = other.storage;
+        values = other.storage.empty() ? other.values : storage.data();
+        count = other.count;
+        return *this;
+    }
+    FicColumn& operator=(FicColumn&&) = default;
+
+    void Assign(std::vector<T>&& owned){
+        storage = std::move(owned);
+        values = storage.data();
+        count = storage.size();
+    }
+    void View(const T* mapped, size_t size){
+        storage = std::vector<T>();
+        values = mapped;
+        count = size;
+    }
+    const T& operator[](size_t i) const {return values[i];}
+    const T* data() const {return values;}
+    size_t size() const {return count;}
+
+private:
+    std::vector<T> storage;
+    const T* values = nullptr;
+    size_t count = 0;
+};
+
+// fics the server works with laid out column by column
+// ordinals are dense and follow the order of fic ids, so scans over all fics touch contiguous memory
+// and a range of ordinals is a natural unit of parallel work
+class FicTable{
+public:
+    static constexpr uint32_t invalid = std::numeric_limits<uint32_t>::max();
+    enum EFlag : uint8_t{
+        ff_complete     = 1,
+        ff_slash        = 2,
+        ff_dead         = 4,
+        ff_sameLanguage = 8,
+        ff_adult        = 16,
+    };
+    struct FandomRange{
+        const int32_t* first = nullptr;
+        const int32_t* last = nullptr;
+        const int32_t* begin() const {return first;}
+        const int32_t* end() const {return last;}
+        size_t size() const {return static_cast<size_t>(last - first);}
+    };
+    // genres beyond this many distinct names are dropped from the mask
+    static constexpr int maxGenres = 32;
+
+    void Build(const QHash<int, FicWeightPtr>& fics);
+    // this table with rows of the changed fics replacing or joining its own, the result owns its columns
+    FicTable Updated(const QHash<int, FicWeightPtr>& changed) const;
+    void Clear();
+
+    size_t Size() const {return ids.size();}
+    uint32_t OrdinalForFic(int fic) const{
+        return fic >= 0 && static_cast<size_t>(fic) < ordinalForFic.size() ? ordinalForFic[static_cast<size_t>(fic)] : invalid;
+    }
+    bool Contains(int fic) const {return OrdinalForFic(fic) != invalid;}
+
+    int Id(uint32_t ordinal) const {return ids[ordinal];}
+    bool HasFlag(uint32_t ordinal, EFlag flag) const {return flags[ordinal] & flag;}
+    int AuthorId(uint32_t ordinal) const {return authorIds[ordinal];}
+    int FavCount(uint32_t ordinal) const {return favCounts[ordinal];}
+    int SumAuthorFaves(uint32_t ordinal) const {return sumAuthorFaves[ordinal];}
+    int ReviewCount(uint32_t ordinal) const {return reviewCounts[ordinal];}
+    int WordCount(uint32_t ordinal) const {return wordCounts[ordinal];}
+    int ChapterCount(uint32_t ordinal) const {return chapterCounts[ordinal];}
+    QDate Published(uint32_t ordinal) const {return DateFromDay(published[ordinal]);}
+    QDate Updated(uint32_t ordinal) const {return DateFromDay(updated[ordinal]);}
+    FandomRange Fandoms(uint32_t ordinal) const{
+        return {fandoms.data() + fandomOffsets[ordinal], fandoms.data() + fandomOffsets[ordinal + 1]};
+    }
+    // bit i is set when the fic has GenreNames()[i]
+    uint32_t GenreMask(uint32_t ordinal) const {return genreMasks[ordinal];}
+    const QStringList& GenreNames() const {return genreNames;}
+    QStringList Genres(uint32_t ordinal) const;
+
+    // the fic as it was loaded, for code that still works with separate fic objects
+    // allocates, not meant for loops over many fics
+    FicWeightPtr Fic(int fic) const;
+
+private:
+    friend class ServerSnapshot;
+    struct Columns;
+    static constexpr int32_t noDate = std::numeric_limits<int32_t>::min();
+    static int32_t DayFromDate(const QDate& date){
+        return date.isValid() ? static_cast<int32_t>(date.toJulianDay()) : noDate;
+    }
+    static QDate DateFromDay(int32_t day){
+        return day == noDate ? QDate() : QDate::fromJulianDay(day);
+    }
+    uint32_t MaskForGenres(const QStringList& genres);
+
+    FicColumn<uint32_t> ordinalForFic;
+    FicColumn<int32_t> ids;
+    FicColumn<uint8_t> flags;
+    FicColumn<int32_t> authorIds;
+    FicColumn<int32_t> favCounts;
+    FicColumn<int32_t> sumAuthorFaves;
+    FicColumn<int32_t> reviewCounts;
+    FicColumn<int32_t> wordCounts;
+    FicColumn<int32_t> chapterCounts;
+    // julian days
+    FicColumn<int32_t> published;
+    FicColumn<int32_t> updated;
+    // fandoms of ordinal i are fandoms[fandomOffsets[i]] to fandoms[fandomOffsets[i + 1]]
+    FicColumn<uint32_t> fandomOffsets;
+    FicColumn<int32_t> fandoms;
+    FicColumn<uint32_t> genreMasks;
+    QStringList genreNames;
+    // set when the columns point into a mapped snapshot
+    QSharedPointer<const ServerSnapshotFile> mapping;
+};
+
+}
@@ -1,14 +1,74 @@
 #pragma once
 #include "include/data_code/data_holders.h"
+#include "include/data_code/favourites_sketch.h"
+#include "include/data_code/fic_neighbour_index.h"
+#include "include/data_code/fic_table.h"
+#include <array>
+#include <limits>
+#include <vector>
 namespace core{
     
+// dense renumbering of every fic that is present in someone's favourites
+// ordinals follow the order of fic ids
+struct FicOrdinals{
+    static constexpr uint32_t invalid = std::numeric_limits<uint32_t>::max();
+    void Build(const QHash<int, Roaring>& favouritesByFic);
+    uint32_t OrdinalForFic(uint32_t fic) const{
+        return fic < ordinalForFic.size() ? ordinalForFic[fic] : invalid;
+    }
+    size_t Size() const {return ficForOrdinal.size();}
+
+    std::vector<uint32_t> ordinalForFic;
+    std::vector<uint32_t> ficForOrdinal;
+};
+
+// the same for authors that have favourites, lets per list author data live in flat arrays
+struct AuthorOrdinals{
+    static constexpr uint32_t invalid = std::numeric_limits<uint32_t>::max();
+    void Build(const QHash<int, Roaring>& faves);
+    uint32_t OrdinalForAuthor(uint32_t author) const{
+        return author < ordinalForAuthor.size() ? ordinalForAuthor[author] : invalid;
+    }
+    size_t Size() const {return authorForOrdinal.size();}
+
+    std::vector<uint32_t> ordinalForAuthor;
+    std::vector<uint32_t> authorForOrdinal;
+};
     
-    
+// author mood distributions packed column by column so that distances to every author are computed in one pass
+// columns are padded with zeroes to whole blocks, every block is aligned for vector loads
+struct AuthorMoodMatrix{
+    static constexpr int moodCount = 7;
+    static constexpr int blockSize = 8;
+    static constexpr uint32_t invalid = std::numeric_limits<uint32_t>::max();
+    struct alignas(32) Block{
+        std::array<float, blockSize> values;
+    };
+    typedef std::array<float, moodCount> MoodVector;
+
+    // Neutral, Funny, then the moods that count towards touchy difference
+    static MoodVector ReadMoods(const genre_stats::ListMoodData& data);
+    void Build(const AuthorMoodDistributions& moods);
+    uint32_t RowForAuthor(uint32_t author) const{
+        return author < rowForAuthor.size() ? rowForAuthor[author] : invalid;
+    }
+    size_t Size() const {return authorForRow.size();}
+    size_t BlockCount() const {return columns[0].size();}
+    // L1 distance from user to every author, both outputs need BlockCount() * blockSize elements
+    void Distances(const MoodVector& user, float* neutral, float* touchy) const;
+
+    std::vector<uint32_t> rowForAuthor;
+    std::vector<uint32_t> authorForRow;
+    std::array<std::vector<Block>, moodCount> columns;
+};
+
 struct DataHolder
 {
     typedef DataHolderInfo<rdt_favourites>::type FavType;
     typedef DataHolderInfo<rdt_fics>::type FicType;
     typedef DataHolderInfo<rdt_author_genre_distribution>::type GenreType;
+    typedef QHash<int, Roaring> InvertedFavType;
+    typedef QHash<int, Roaring> InvertedFandomType;
     DataHolder(QString settingsFile,
                QSharedPointer<interfaces::Authors> authorsInterface,
                QSharedPointer<interfaces::Fanfics> fanficsInterface)
@@ -41,6 +101,11 @@ struct DataHolder
         QString fileBase = QString::fromStdString(DataHolderInfo<T>::fileBase());
         thread_boost::SaveData(storageFolder, fileBase, data);
     }
+    // rebuilds the structures that are derived from the loaded data
+    // and are never stored on disk themselves
+    template <ERecDataType T>
+    void BuildDerivedData(QString){}
+
     void CreateTempDataDir(QString storageFolder)
     {
         QDir dir(QDir::currentPath());
@@ -48,16 +113,38 @@ struct DataHolder
     }
 
     QString settingsFile;
+    // assigned when the holder is published as a snapshot, tells apart data from different loads
+    uint32_t generation = 0;
     QSharedPointer<interfaces::Authors> authorsInterface;
     QSharedPointer<interfaces::Fanfics> fanficsInterface;
     QSharedPointer<interfaces::Genres>  genresInterface;
 
     FavType faves;
+    // fic id -> authors that have this fic in their favourites
+    InvertedFavType favouritesByFic;
+    FicOrdinals ficOrdinals;
+    AuthorOrdinals authorOrdinals;
+    // approximate lookup of authors with similar favourites, stored next to the favourites themselves
+    FavouritesSketch favouritesSketch;
+    // shared because the mapped file can't be copied along with the holder
+    QSharedPointer<const FicNeighbourIndex> ficNeighbours;
     GenreType genres;
     FicGenreCompositeType genreComposites;
     AuthorMoodDistributions authorMoodDistributions;
+    AuthorMoodMatrix authorMoods;
+    // only holds fics between loading and building the fic table, empty afterwards
     FicType fics;
+    FicTable ficTable;
+    // fandom id -> fics of the table that belong to it
+    InvertedFandomType ficsByFandom;
 };
+
+template <>
+void DataHolder::BuildDerivedData<rdt_favourites>(QString storageFolder);
+template <>
+void DataHolder::BuildDerivedData<rdt_fics>(QString);
+template <>
+void DataHolder::BuildDerivedData<rdt_author_mood_distribution>(QString);
     
 }
 
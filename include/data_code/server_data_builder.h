@@ -0,0 +1,68 @@
+/*
+Flipper is a recommendation and search engine for fanfiction.net
+Copyright (C) 2017-2020  Marchenko Nikolai
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+#pragma once
+#include <QDateTime>
+#include <QString>
+#include <QStringList>
+
+#include <cstdint>
+
+namespace core{
+struct DataHolder;
+
+// describes a finished snapshot in a storage folder, it's written last
+// so a folder without it (or with one that doesn't match the files) holds nothing a server should load
+struct SnapshotManifest{
+    static QString FileName(QString storageFolder);
+    bool Read(QString storageFolder);
+    bool Write(QString storageFolder) const;
+    // the snapshot file is still the one the manifest was written for and all of its deltas are there
+    bool Matches(QString storageFolder) const;
+
+    // unique for every build, servers reload when it changes
+    QString buildId;
+    // lastDBUpdate of the database the snapshot was built from
+    QString databaseUpdate;
+    QString snapshotFile;
+    QString neighboursFile;
+    // applied on top of the snapshot in this order, servers apply the ones they haven't seen yet without a reload
+    QStringList deltas;
+    // favourites and fics that changed after this moment are in neither the snapshot nor its deltas
+    QDateTime dataTimestamp;
+    uint64_t snapshotSize = 0;
+    int fics = 0;
+    int authors = 0;
+    int moods = 0;
+};
+
+// loads everything from the database through the data holder's interfaces (or from sharded files when
+// the holder's settings allow it), calculates moods, builds derived indices and writes snapshot and manifest
+// the holder keeps the built data, so the in-process fallback can serve it right away
+bool BuildServerData(DataHolder& data, QString storageFolder, QString databaseUpdate);
+// reads a finished snapshot, applies its deltas and builds the derived data that isn't stored in them
+bool LoadServerData(DataHolder& data, QString storageFolder, const SnapshotManifest& manifest);
+// applies deltas starting from firstDelta to data that already holds the snapshot with the ones before it
+bool ApplyServerDeltas(DataHolder& data, QString storageFolder, const SnapshotManifest& manifest, int firstDelta);
+// collects what changed in the database since the manifest's data timestamp into a new delta and adds it to the manifest
+// the holder is left with the snapshot and every delta applied, but without derived data
+bool BuildServerDelta(DataHolder& data, QString storageFolder, SnapshotManifest& manifest, QString databaseUpdate);
+// writes data that holds the snapshot with all of the manifest's deltas applied as a new snapshot without any,
+// nothing is read from the database so it only takes as long as writing the snapshot
+bool CompactServerData(DataHolder& data, QString storageFolder, const SnapshotManifest& manifest);
+
+}
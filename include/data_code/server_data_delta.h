@@ -0,0 +1,61 @@
+/*
+Flipper is a recommendation and search engine for fanfiction.net
+Copyright (C) 2017-2020  Marchenko Nikolai
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+#pragma once
+#include "include/data_code/data_holders.h"
+
+#include <QDateTime>
+#include <QHash>
+#include <QString>
+#include <QVector>
+
+namespace core{
+struct DataHolder;
+
+// what changed in the database between two builds, written next to the snapshot it was collected for
+// deltas are never rewritten, every one is applied on top of the snapshot and the deltas before it
+// everything in a delta replaces what was there, so applying one twice doesn't change the result
+struct ServerDataDelta{
+    static QString FileName(QString baseBuildId, int sequence);
+
+    // reads favourites, fics and fic genres that changed after since through the holder's interfaces
+    // moods of the changed authors are recalculated against the holder's genres, so it has to contain
+    // the snapshot with every earlier delta applied
+    void Collect(const DataHolder& data, QDateTime since);
+    bool IsEmpty() const;
+    bool Save(QString fileName) const;
+    bool Load(QString fileName);
+    // derived data is left for the caller to rebuild
+    void Apply(DataHolder& data) const;
+
+    // snapshot the delta was collected for, it can't be applied to anything else
+    QString baseBuildId;
+    // 1 for the first delta on top of the snapshot
+    int sequence = 0;
+    QDateTime since;
+    QDateTime until;
+    // complete favourites of every author that has changed them
+    DataHolderInfo<rdt_favourites>::type favourites;
+    // authors that don't have favourites anymore
+    QVector<int> removedAuthors;
+    DataHolderInfo<rdt_fics>::type fics;
+    FicGenreCompositeType genreComposites;
+    // recalculated for changed authors and for everyone who favourites a fic with changed genres
+    AuthorMoodDistributions moods;
+};
+
+}
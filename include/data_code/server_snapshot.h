@@ -0,0 +1,52 @@
+/*
+Flipper is a recommendation and search engine for fanfiction.net
+Copyright (C) 2017-2020  Marchenko Nikolai
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+#pragma once
+#include <QFile>
+#include <QString>
+
+#include <cstdint>
+
+namespace core{
+struct DataHolder;
+
+// a snapshot file mapped into memory, fic table columns point straight into it
+// so every server process that maps the same file shares its pages
+class ServerSnapshotFile{
+public:
+    ~ServerSnapshotFile(){file.close();}
+    bool Open(QString fileName);
+    const uchar* Data() const {return data;}
+    uint64_t Size() const {return size;}
+
+private:
+    QFile file;
+    const uchar* data = nullptr;
+    uint64_t size = 0;
+};
+
+// everything the feed server loads from ServerData in a single versioned file:
+// fic table columns, favourites as portable roaring bitmaps, fic genres and author moods
+// every section is aligned and carries its own checksum
+class ServerSnapshot{
+public:
+    static bool Save(const DataHolder& data, QString fileName);
+    // fills favourites, fic table, genre composites and moods; derived data is left for the caller to build
+    static bool Load(DataHolder& data, QString fileName, bool verifyChecksums);
+};
+
+}
@@ -22,6 +22,8 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #include <QVector>
 #include <QDir>
 #include <QSettings>
+#include <QMutex>
+#include <optional>
 #include <utility>
 #include "GlobalHeaders/SingletonHolder.h"
 #include "third_party/roaring/roaring.hh"
@@ -35,6 +37,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #include "include/data_code/data_holders.h"
 #include "include/data_code/rec_calc_data.h"
 #include "include/rec_calc/rec_calculator_base.h"
+#include "include/rec_calc/reclist_diagnostics.h"
 
 
 namespace core{
@@ -42,27 +45,75 @@ namespace core{
 
 
 class RecommendationList;
+
+// everything a single list in a batch is created from
+struct ReclistCreationInput{
+    QHash<uint32_t, FicWeightPtr> fetchedFics;
+    QSharedPointer<core::RecommendationList> params;
+    genre_stats::GenreMoodData moodData;
+};
+
+// data every request works with, it is never modified once published
+// so requests can keep using the snapshot they started with while a fresh one is being loaded
+typedef QSharedPointer<const DataHolder> DataSnapshot;
+
 class RecCalculator
 {
 public:
     RecCalculator(QString settingsFile = "", QSharedPointer<interfaces::Authors> authors = {}, QSharedPointer<interfaces::Fanfics> fanfics = {})
-        : holder(settingsFile, authors, fanfics){}
+        : snapshot(new DataHolder(settingsFile, authors, fanfics)){}
     void CreateTempDataDir();
     void LoadFavourites(QSharedPointer<interfaces::Authors> authorInterface);
     void LoadFics(QSharedPointer<interfaces::Fanfics> fanficsInterface);
     void LoadFavouritesDataFromDatabase(QSharedPointer<interfaces::Authors> authorInterface);
     void LoadStoredFavouritesData();
     void SaveFavouritesData();
-    FavouritesMatchResult GetMatchedFics(UserMatchesInput user1, int user2);
 
-    RecommendationListResult GetMatchedFicsForFavList(QHash<uint32_t, FicWeightPtr> fetchedFics,
+    DataSnapshot Snapshot() const;
+    // publishes fully loaded data, the previous snapshot is freed once the last request using it is done
+    void SetSnapshot(QSharedPointer<DataHolder> data);
+
+    FavouritesMatchResult GetMatchedFics(const DataSnapshot& data, UserMatchesInput user1, int user2);
+
+    RecommendationListResult GetMatchedFicsForFavList(const DataSnapshot& data,
+                                                      QHash<uint32_t, FicWeightPtr> fetchedFics,
                                                       QSharedPointer<core::RecommendationList> params,
                                                       genre_stats::GenreMoodData moodData = {});
 
-    DiagnosticRecommendationListResult GetDiagnosticRecommendationList(QHash<uint32_t, FicWeightPtr> fetchedFics,
-                                                      QSharedPointer<core::RecommendationList> params,
-                                                      genre_stats::GenreMoodData moodData);
-    DataHolder holder;
+    // a list with a single source fic straight from the neighbour index
+    // its authors are chosen when the index is built, so it can differ from a created list in who voted
+    // nothing is returned when the index can't answer it the way a created list would
+    std::optional<RecommendationListResult> GetSimilarFicsFromIndex(const DataSnapshot& data, uint32_t fic,
+                                                                    QSharedPointer<core::RecommendationList> params);
+
+    // creates several lists at once, favourites are scanned for all of them together
+    QVector<RecommendationListResult> GetMatchedFicsForFavLists(const DataSnapshot& data, const QVector<ReclistCreationInput>& inputs);
+
+    // diagnostics are only produced for the fics in scope and only while they are read
+    DiagnosticRecommendationListResult GetDiagnosticRecommendationList(const DataSnapshot& data,
+                                                                       QHash<uint32_t, FicWeightPtr> fetchedFics,
+                                                                       QSharedPointer<core::RecommendationList> params,
+                                                                       genre_stats::GenreMoodData moodData,
+                                                                       const DiagnosticScope& scope);
+    // creates the list both ways and reports how much approximate candidate selection has lost
+    ApproximateCandidatesReport CompareApproximateCandidates(const DataSnapshot& data,
+                                                             QHash<uint32_t, FicWeightPtr> fetchedFics,
+                                                             const core::RecommendationList& params,
+                                                             genre_stats::GenreMoodData moodData = {});
+    QSharedPointer<RecCalculatorImplBase> CreateCalculator(const DataSnapshot& data,
+                                                           QHash<uint32_t, FicWeightPtr> fetchedFics,
+                                                           QSharedPointer<core::RecommendationList> params,
+                                                           genre_stats::GenreMoodData moodData = {});
+    // amount of threads every single list creation is allowed to use, <= 0 picks it from core count
+    int threadBudget = 0;
+    // lists of a batch created over a single favourites scan, each of them holds its author data until it's done
+    // <= 0 scans once for the whole batch
+    int batchListsPerScan = 256;
+
+private:
+    mutable QMutex snapshotLock;
+    DataSnapshot snapshot;
+    uint32_t lastGeneration = 0;
 };
 
 
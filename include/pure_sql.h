@@ -195,6 +195,7 @@ DiagnosticSQLResult<bool> WriteDetectedGenres(QVector<genre_stats::FicGenreData>
 DiagnosticSQLResult<bool> WriteDetectedGenresIteration2(QVector<genre_stats::FicGenreData>, sql::Database db);
 
 DiagnosticSQLResult<QHash<int, QList<genre_stats::GenreBit>>> GetFullGenreList(sql::Database db, bool useOriginalOnly = false);
+DiagnosticSQLResult<QHash<int, QList<genre_stats::GenreBit>>> GetGenreListUpdatedSince(QDateTime date, sql::Database db, bool useOriginalOnly = false);
 DiagnosticSQLResult<bool> SetUserProfile(int id,  sql::Database db);
 DiagnosticSQLResult<int> GetUserProfile(sql::Database db);
 DiagnosticSQLResult<int> GetRecommenderIDByFFNId(int id, sql::Database db);
@@ -222,6 +223,8 @@ DiagnosticSQLResult<core::AuthorPtr> GetAuthorByNameAndWebsite(QString name, QSt
 DiagnosticSQLResult<core::AuthorPtr> GetAuthorByIDAndWebsite(int id, QString website,  sql::Database db);
 DiagnosticSQLResult<bool> LoadAuthorStatistics(core::AuthorPtr, sql::Database db);
 DiagnosticSQLResult<QHash<int, QSet<int>>> LoadFullFavouritesHashset(sql::Database db);
+// favourites of authors whose favourites were updated after date
+DiagnosticSQLResult<QHash<int, QSet<int>>> LoadFavouritesHashsetUpdatedSince(QDateTime date, sql::Database db);
 
 DiagnosticSQLResult<core::AuthorPtr> GetAuthorByUrl(QString url,  sql::Database db);
 DiagnosticSQLResult<core::AuthorPtr> GetAuthorById(int id,  sql::Database db);
@@ -239,6 +242,8 @@ DiagnosticSQLResult<QSet<int>>  GetAllKnownFicIds(QString, sql::Database db);
 DiagnosticSQLResult<QSet<int>>  GetFicIDsWithUnsetAuthors(sql::Database db);
 
 DiagnosticSQLResult<QVector<core::FicWeightPtr>>  GetAllFicsWithEnoughFavesForWeights(int faves, sql::Database db);
+// lastupdate only has a day precision, fics updated on the day of date are included
+DiagnosticSQLResult<QVector<core::FicWeightPtr>>  GetFicsWithEnoughFavesForWeightsUpdatedSince(int faves, QDateTime date, sql::Database db);
 DiagnosticSQLResult<QHash<int, core::AuthorFavFandomStatsPtr>> GetAuthorListFandomStatistics(QList<int> authors, sql::Database db);
 
 DiagnosticSQLResult<QSet<int>>  GetSingularFicsInLargeButSlashyLists(sql::Database db);
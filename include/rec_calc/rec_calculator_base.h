@@ -18,39 +18,67 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #pragma once
 
 #include <QList>
+#include <QSharedPointer>
+#include <algorithm>
+#include <array>
 #include <limits>
+#include <map>
+#include <vector>
 
 #include "include/data_code/data_holders.h"
 #include "include/data_code/rec_calc_data.h"
+#include "include/rec_calc/rec_calculator_workspace.h"
+#include "include/threaded_data/parallel_for.h"
 
 
 
 namespace core{
 
+// per fic vote data accumulated by the calculator
+// all vectors are parallel: entry i describes the fic ficIds[i], fic ids are ascending
+struct FicVoteData{
+    static constexpr int authorTypeCount = 4;
+    void Resize(size_t size);
+    size_t Size() const {return ficIds.size();}
+
+    std::vector<uint32_t> ficIds;
+    std::vector<int> recommendations;
+    std::vector<int> pureMatches;
+    std::vector<uint8_t> decentMatches;
+    std::vector<int> sumNegativeMatches;
+    std::vector<int> sumNegativeVotes;
+    // indexed by AuthorWeightingResult::EAuthorType
+    std::vector<std::array<int, authorTypeCount>> breakdownCounts;
+    std::vector<std::array<double, authorTypeCount>> breakdownVotes;
+};
+
 struct RecommendationListResult{
-    void AddToBreakdown(uint32_t fic, AuthorWeightingResult::EAuthorType type, double value){
-        if(!breakdowns.contains(fic))
-            breakdowns[fic].ficId = fic;
-        breakdowns[fic].AddAuthor(type, value);
-    }
     bool success = false;
-    QHash<int, int> recommendations;
+    FicVoteData votes;
     QHash<int, int> matchReport;
-    QHash<uint32_t, MatchBreakdown> breakdowns;
-    QHash<int, int> pureMatches;
-    QHash<int, int> decentMatches;
-    QHash<int, int> sumNegativeMatchesForFic;
-    QHash<int, int> sumNegativeVotesForFic;
-    QHash<int, double> noTrashScore;
     QSet<int> authors;
     QSet<int> limitedResults;
 };
 
+// how far a list created from approximate candidates drifts from the exact one
+struct ApproximateCandidatesReport{
+    uint64_t exactCandidates = 0;
+    uint64_t approximateCandidates = 0;
+    // share of authors that exact list was built from that approximate list has also picked
+    double authorRecall = 0;
+    // share of exact list's top fics that made it into approximate top of the same size
+    double ficRecall = 0;
+    int comparedFics = 0;
+    qint64 exactMs = 0;
+    qint64 approximateMs = 0;
+};
+
+class ReclistDiagnostics;
 struct DiagnosticRecommendationListResult{
     bool isValid = false;
     RecommendationListResult recs;
-    QHash<uint32_t, QVector<uint32_t>> authorsForFics;
-    QVector<AuthorResult> authorData;
+    // read while the response is filled, the calculator it holds is freed along with it
+    QSharedPointer<ReclistDiagnostics> diagnostics;
 
     double ratioMedian = 0;
     double quad = 0;
@@ -78,8 +106,14 @@ struct FicBaseScoreCalculator{
 
 struct RecInputVectors{
     const DataHolder::FavType& faves;
-    const DataHolder::FicType& fics;
+    const FicTable& fics;
+    const DataHolder::InvertedFandomType& ficsByFandom;
     const core::AuthorMoodDistributions& moods;
+    const AuthorMoodMatrix& moodMatrix;
+    const DataHolder::InvertedFavType& favouritesByFic;
+    const FicOrdinals& ficOrdinals;
+    const AuthorOrdinals& authorOrdinals;
+    const FavouritesSketch& favouritesSketch;
 };
 
 struct AutoAdjustmentAndFilteringResult{
@@ -89,6 +123,36 @@ struct AutoAdjustmentAndFilteringResult{
     std::vector<int> sizes = {0,0,0};
 };
 
+// authors that passed every filter except the match count
+// grouped by match count and by the smallest maxUnmatchedPerMatch that still lets them through
+// so that authors for any match and ratio cutoff are picked without filtering everyone again
+struct AuthorMatchHistogram{
+    struct Entry{
+        uint32_t ratioBucket = 0;
+        int authorId = -1;
+    };
+    typedef std::vector<Entry>::const_iterator EntryIterator;
+
+    void Clear(){rows.clear();}
+    void Add(uint32_t matches, uint32_t ratioBucket, int authorId){
+        rows[matches].push_back({ratioBucket, authorId});
+    }
+    void Finalize();
+    // calls func(matches, begin, end) for every match count that has authors passing maxUnmatchedPerMatch
+    template <typename Func>
+    void ForEachRow(int maxUnmatchedPerMatch, Func&& func) const{
+        for(const auto& [matches, row] : rows){
+            auto end = std::upper_bound(row.cbegin(), row.cend(), static_cast<int64_t>(maxUnmatchedPerMatch), [](int64_t value, const Entry& entry){
+                return value < static_cast<int64_t>(entry.ratioBucket);
+            });
+            if(end != row.cbegin())
+                func(matches, row.cbegin(), end);
+        }
+    }
+
+    std::map<uint32_t, std::vector<Entry>> rows;
+};
+
 struct RatioInfo{
     uint16_t authors = 0;
     uint16_t ratio = 0;
@@ -128,37 +192,68 @@ struct RatioSumInfo{
 };
 
 
+struct AuthorRelationsResult;
+
+// everything CollectVotes needs to know about a filtered author
+// computed once per author instead of once for every fic in their favourites
+struct AuthorVote{
+    int id = -1;
+    const Roaring* favourites = nullptr;
+    int negativeMatches = 0;
+    int vote = 0;
+    double breakdownVote = 0;
+    int authorType = 0;
+    bool decentMatch = false;
+    bool belowNegativeCutoff = false;
+};
+
+// filters, actions and weighting of a specific flavour are supplied by RecCalculatorPipeline
+// only its instantiations are meant to be created
 class RecCalculatorImplBase
 {
 public:
-    typedef QList<std::function<bool(AuthorResult&,QSharedPointer<RecommendationList>)>> FilterListType;
-    typedef QList<std::function<void(RecCalculatorImplBase*,AuthorResult &)>> ActionListType;
-
-    RecCalculatorImplBase(const RecInputVectors& input):inputs(input){}
+    RecCalculatorImplBase(const RecInputVectors& input):
+        inputs(input),
+        workspace(RecCalculatorWorkspace::Acquire(input.authorOrdinals)),
+        allAuthors(workspace->authors),
+        filteredAuthors(workspace->filteredAuthors){}
 
     virtual ~RecCalculatorImplBase(){}
 
     virtual void ResetAccumulatedData();
     bool Calc();
-    void RunMatchingAndWeighting(QSharedPointer<RecommendationList> params, const FilterListType &filters, const ActionListType &actions);
+    // everything Calc does after author relations are known
+    bool CalcFromRelations();
+    void RunMatchingAndWeighting(QSharedPointer<RecommendationList> params);
     Roaring BuildIgnoreList();
+    Roaring FetchCandidateAuthors() const;
     void FetchAuthorRelations();
+    Roaring PrepareAuthorRelations();
+    // expects allAuthors to be filled already
+    void FinishAuthorRelations(AuthorRelationsResult& funcResult);
+    // fetches relations for several lists with a single pass over the favourites
+    static void FetchAuthorRelationsBatch(const std::vector<RecCalculatorImplBase*>& calculators);
     void CollectFicMatchQuality();
-    void Filter(QSharedPointer<RecommendationList> params,
-                const QList<std::function<bool(AuthorResult&,QSharedPointer<RecommendationList>)>>& filters,
-                const QList<std::function<void(RecCalculatorImplBase*,AuthorResult &)>>& actions);
+    virtual void BuildMatchHistogram(const RecommendationList& params) = 0;
+    virtual void SelectMatchingAuthors(const RecommendationList& params) = 0;
+    // fills vote related fields of every author vote
+    virtual void WeighAuthors(std::pmr::vector<AuthorVote>& authorVotes, int authorSize, int maximumMatches) = 0;
+    // computes the values that filters look at, false if the author can't be picked at all
+    bool PrepareAuthorForFiltering(AuthorResult& author);
+    static void InvalidateAuthor(AuthorResult& author);
+    void AssignAuthorVote(AuthorVote& authorVote, const AuthorResult& author,
+                          const AuthorWeightingResult& weighting, std::optional<double> touchyDifference) const;
+    virtual uint32_t RatioBucketForAuthor(const AuthorResult& author) const;
 
     void CalculateNegativeToPositiveRatio();
     void ReportNegativeResults();
-    void FillFilteredAuthorsForFics();
+    QSet<int> FilteredAuthorSet() const;
+    thread_boost::ParallelForOptions ParallelOptions(size_t grain) const;
 
     virtual bool CollectVotes();
     virtual bool WeightingIsValid() const = 0;
 
     virtual void CalcWeightingParams() = 0;
-    virtual FilterListType GetFilterList() = 0;
-    virtual ActionListType  GetActionList() = 0;
-    virtual std::function<AuthorWeightingResult(AuthorResult&, int, int)> GetWeightingFunc() = 0;
 
     virtual std::optional<double> GetNeutralDiffForLists(uint32_t){return {};}
     virtual std::optional<double> GetTouchyDiffForLists(uint32_t){return {};}
@@ -173,60 +268,35 @@ public:
     uint32_t matchSum = 0;
     uint32_t negativeAverage = 0;
     RecInputVectors inputs;
+    // keeps the snapshot that inputs point into alive for as long as the calculator exists
+    QSharedPointer<const DataHolder> snapshot;
     QSharedPointer<RecommendationList> params;
     //QList<int> matchedAuthors;
     QHash<uint32_t, core::FicWeightPtr> fetchedFics;
-    std::unordered_map<int, AuthorResult> allAuthors;
+    // per list data lives in a pooled workspace, allAuthors and filteredAuthors point into it
+    QSharedPointer<RecCalculatorWorkspace> workspace;
+    AuthorTable& allAuthors;
     uint32_t maximumMatches = 0;
     uint32_t prevMaximumMatches = 0;
     double averageNegativeToPositiveMatches = 0;
     uint32_t startOfTrashCounting = 200;
     bool doTrashCounting = true;
-    QSet<int> filteredAuthors;
+    // every author is added at most once per adjustment step
+    std::vector<int>& filteredAuthors;
     Roaring ownFavourites;
     Roaring ownMajorNegatives;
     RecommendationListResult result;
-    QHash<uint32_t, QVector<uint32_t>> authorsForFics;
     QHash<uint16_t, RatioInfo> ratioInfo;
-    bool needsDiagnosticData = false;
+    AuthorMatchHistogram matchHistogram;
+    // maximum amount of threads a single list creation may occupy, <= 0 picks it from core count
+    int threadBudget = 0;
 
     int votesBase = 1;
 };
-static auto matchesFilter = [](AuthorResult& author, QSharedPointer<RecommendationList> params){
-    return static_cast<int>(author.matches) >= params->minimumMatch || static_cast<int>(author.matches) >= params->alwaysPickAt;
-};
-static auto ratioFilter = [](AuthorResult& author, QSharedPointer<RecommendationList> params)
-{
-    return author.ratio <= params->maxUnmatchedPerMatch && author.matches > 0;
-};
-
-static auto negativeFilter = [](AuthorResult& author, QSharedPointer<RecommendationList> list )
-{
-    if(!list->useDislikes)
-        return true;
-    bool filterResult = (static_cast<double>(author.negativeMatches)/author.matches >= 2 || static_cast<double>(author.sizeAfterIgnore)/author.negativeMatches < 15)
-            && static_cast<double>(author.negativeMatches)/author.matches >= 1.5 ;
-    return !filterResult;
-};
-
-static auto authorAccumulator = [](RecCalculatorImplBase* ptr,AuthorResult & author)
-{
-    ptr->filteredAuthors.insert(author.id);
-};
-
 
 class RecCalculatorImplDefault: public RecCalculatorImplBase{
 public:
     RecCalculatorImplDefault(RecInputVectors input): RecCalculatorImplBase(input){}
-    virtual FilterListType GetFilterList() override{
-        return {matchesFilter, ratioFilter, negativeFilter};
-    }
-    virtual ActionListType GetActionList() override{
-        return {authorAccumulator};
-    }
-    virtual std::function<AuthorWeightingResult(AuthorResult&, int, int)> GetWeightingFunc() override{
-        return [](AuthorResult&, int, int){return AuthorWeightingResult();};
-    }
     void CalcWeightingParams() override{
         // does nothing
     }
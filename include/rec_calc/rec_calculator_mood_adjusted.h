@@ -20,6 +20,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #include "data_code/data_holders.h"
 #include "data_code/rec_calc_data.h"
 #include <array>
+#include <vector>
 
 namespace core {
 
@@ -28,9 +29,11 @@ public:
     RecCalculatorImplMoodAdjusted(const RecInputVectors& input, const genre_stats::GenreMoodData& moodData);
     std::optional<double> GetNeutralDiffForLists(uint32_t) override;
     std::optional<double> GetTouchyDiffForLists(uint32_t) override;
-    virtual FilterListType GetFilterList();
+    uint32_t RatioBucketForAuthor(const AuthorResult& author) const override;
 
-    QHash<uint32_t, ListMoodDifference> moodDiffs;
+    // indexed by the author's row in inputs.moodMatrix
+    std::vector<float> neutralDiffs;
+    std::vector<float> touchyDiffs;
     genre_stats::GenreMoodData moodData;
 
 
@@ -0,0 +1,182 @@
+/*
+Flipper is a recommendation and search engine for fanfiction.net
+Copyright (C) 2017-2020  Marchenko Nikolai
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+#pragma once
+#include "rec_calc/rec_calculator_base.h"
+#include "rec_calc/rec_calculator_weighted.h"
+#include "rec_calc/rec_calculator_mood_adjusted.h"
+
+#include <limits>
+#include <vector>
+
+namespace core {
+
+// filters decide whether an author's list is close enough to user's to vote
+// they are plain structs so that a whole chain gets inlined into the histogram loop
+struct MatchesFilter{
+    bool operator()(const AuthorResult& author, const RecommendationList& params) const{
+        return static_cast<int>(author.matches) >= params.minimumMatch || static_cast<int>(author.matches) >= params.alwaysPickAt;
+    }
+};
+
+struct RatioFilter{
+    bool operator()(const AuthorResult& author, const RecommendationList& params) const{
+        return author.ratio <= params.maxUnmatchedPerMatch && author.matches > 0;
+    }
+};
+
+// additionally drops lists that are far away mood-wise once their unignored ratio goes over the limit
+struct MoodAdjustedRatioFilter{
+    bool operator()(const AuthorResult& author, const RecommendationList& params) const{
+        if(author.ratio > params.ratioCutoff)
+            return false;
+        if(!RatioFilter{}(author, params))
+            return false;
+        if(author.listDiff.touchyDifference.has_value() && author.listDiff.touchyDifference.value() >= 0.4)
+        {
+            auto cleanRatio = static_cast<double>(author.fullListSize)/static_cast<double>(author.matches);
+            if(cleanRatio > params.maxUnmatchedPerMatch)
+                return false;
+        }
+        return true;
+    }
+};
+
+struct NegativeFilter{
+    bool operator()(const AuthorResult& author, const RecommendationList& params) const{
+        if(!params.useDislikes)
+            return true;
+        bool filterResult = (static_cast<double>(author.negativeMatches)/author.matches >= 2 || static_cast<double>(author.sizeAfterIgnore)/author.negativeMatches < 15)
+                && static_cast<double>(author.negativeMatches)/author.matches >= 1.5 ;
+        return !filterResult;
+    }
+};
+
+template <typename... Filters>
+struct FilterChain{
+    static bool Passes(const AuthorResult& author, const RecommendationList& params){
+        return (Filters{}(author, params) && ...);
+    }
+};
+
+// actions are applied to every author that made it into the current adjustment step
+struct CollectAuthor{
+    template <typename Calculator>
+    void operator()(Calculator& calc, const AuthorResult& author) const{
+        calc.filteredAuthors.push_back(static_cast<int>(author.id));
+    }
+};
+
+struct SumRatios{
+    void operator()(RecCalculatorImplWeighted& calc, const AuthorResult& author) const{
+        if(calc.ownProfileId == static_cast<int>(author.id))
+            return;
+        calc.ratioSum += author.ratio;
+        calc.ratioSquareSum += author.ratio*author.ratio;
+        calc.ratioCount++;
+    }
+};
+
+// lets weighting find ratio medians and ranges without sorting the authors
+struct RankRatios{
+    template <typename Calculator>
+    void operator()(Calculator& calc, const AuthorResult& author) const{
+        calc.workspace->ratioRanks.Add(static_cast<int>(author.id), author.ratio);
+    }
+};
+
+template <typename... Actions>
+struct ActionChain{
+    template <typename Calculator>
+    static void Apply(Calculator& calc, const AuthorResult& author){
+        (Actions{}(calc, author), ...);
+    }
+};
+
+// weighting turns an author's place among the filtered ones into an additional vote
+struct NoWeighting{
+    template <typename Calculator>
+    AuthorWeightingResult operator()(Calculator&, AuthorResult&, int, int) const{
+        return AuthorWeightingResult();
+    }
+};
+
+struct RatioRangeWeighting{
+    AuthorWeightingResult operator()(RecCalculatorImplWeighted& calc, AuthorResult& author, int authorSize, int maximumMatches) const{
+        return calc.CalcWeightingForAuthor(author, authorSize, maximumMatches);
+    }
+};
+
+// puts a calculator flavour together with its filters, actions and weighting
+// the flavour is picked once per list, per author steps are resolved at compile time
+template <typename Calculator, typename Filters, typename Actions, typename Weighting>
+class RecCalculatorPipeline final : public Calculator{
+public:
+    using Calculator::Calculator;
+
+    void BuildMatchHistogram(const RecommendationList& params) override{
+        // match count is checked per histogram row so filters see every author as matching enough
+        RecommendationList looseParams(params);
+        looseParams.minimumMatch = 0;
+
+        this->matchHistogram.Clear();
+        for(auto& author : this->allAuthors){
+            if(!this->PrepareAuthorForFiltering(author))
+                continue;
+            if(!Filters::Passes(author, looseParams) || author.ratio == 1){
+                RecCalculatorImplBase::InvalidateAuthor(author);
+                continue;
+            }
+            this->matchHistogram.Add(author.matches, this->RatioBucketForAuthor(author), static_cast<int>(author.id));
+        }
+        this->matchHistogram.Finalize();
+    }
+
+    void SelectMatchingAuthors(const RecommendationList& params) override{
+        this->matchHistogram.ForEachRow(params.maxUnmatchedPerMatch, [&](uint32_t matches, auto begin, auto end){
+            // same condition as MatchesFilter
+            if(static_cast<int>(matches) < params.minimumMatch && static_cast<int>(matches) < params.alwaysPickAt)
+                return;
+            for(auto it = begin; it != end; it++)
+                Actions::Apply(*this, this->allAuthors[it->authorId]);
+        });
+    }
+
+    void WeighAuthors(std::pmr::vector<AuthorVote>& authorVotes, int authorSize, int maximumMatches) override{
+        for(auto& authorVote : authorVotes)
+        {
+            auto& author = this->allAuthors[authorVote.id];
+            auto weighting = Weighting{}(*this, author, authorSize, maximumMatches);
+            this->AssignAuthorVote(authorVote, author, weighting, this->GetTouchyDiffForLists(static_cast<uint32_t>(authorVote.id)));
+        }
+    }
+};
+
+typedef RecCalculatorPipeline<RecCalculatorImplDefault,
+                              FilterChain<MatchesFilter, RatioFilter, NegativeFilter>,
+                              ActionChain<CollectAuthor>,
+                              NoWeighting> DefaultCalculator;
+typedef RecCalculatorPipeline<RecCalculatorImplWeighted,
+                              FilterChain<MatchesFilter, RatioFilter, NegativeFilter>,
+                              ActionChain<CollectAuthor, SumRatios, RankRatios>,
+                              RatioRangeWeighting> WeightedCalculator;
+typedef RecCalculatorPipeline<RecCalculatorImplMoodAdjusted,
+                              FilterChain<MatchesFilter, MoodAdjustedRatioFilter, NegativeFilter>,
+                              ActionChain<CollectAuthor, SumRatios, RankRatios>,
+                              RatioRangeWeighting> MoodAdjustedCalculator;
+
+}
@@ -42,13 +42,13 @@ double sqrt_coef(double ratio, double median, double sigma, int base, int scaler
 class RecCalculatorImplWeighted : public RecCalculatorImplBase{
 public:
     RecCalculatorImplWeighted(const RecInputVectors& input): RecCalculatorImplBase(input){}
-    virtual FilterListType GetFilterList() override;
-    virtual ActionListType GetActionList() override;
-    virtual std::function<AuthorWeightingResult(AuthorResult&, int, int)> GetWeightingFunc() override;
     void CalcWeightingParams() override;
     AuthorWeightingResult CalcWeightingForAuthor(AuthorResult& author, int authorSize, int maximumMatches);
 
+    // sums over filtered authors except user's own profile, kept up to date while authors are selected
     double ratioSum = 0;
+    double ratioSquareSum = 0;
+    int ratioCount = 0;
     double ratioMedian = 0;
     double quadraticDeviation = 0;
 
@@ -0,0 +1,116 @@
+/*
+Flipper is a recommendation and search engine for fanfiction.net
+Copyright (C) 2017-2020  Marchenko Nikolai
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+#pragma once
+#include <QSharedPointer>
+
+#include <vector>
+
+#include "include/core/bump_arena.h"
+#include "include/data_code/rec_calc_data.h"
+#include "include/reclist_author_result.h"
+
+namespace core{
+
+// authors a list is created from, kept in a flat vector and found through their ordinal
+// clearing only touches the slots that were used so the table can be reused for every list
+class AuthorTable{
+public:
+    typedef std::vector<AuthorResult>::iterator iterator;
+    typedef std::vector<AuthorResult>::const_iterator const_iterator;
+
+    void Bind(const AuthorOrdinals& ordinals);
+    void Clear();
+    // entries can be appended or filled in place, Index() makes them reachable by id
+    std::vector<AuthorResult>& Entries() {return entries;}
+    void Index();
+
+    AuthorResult* Find(uint32_t author);
+    // authors are expected to be in the table already, missing ones are added like std::unordered_map does
+    AuthorResult& operator[](uint32_t author);
+
+    iterator begin() {return entries.begin();}
+    iterator end() {return entries.end();}
+    const_iterator begin() const {return entries.cbegin();}
+    const_iterator end() const {return entries.cend();}
+    size_t size() const {return entries.size();}
+
+private:
+    static constexpr uint32_t invalid = AuthorOrdinals::invalid;
+    const AuthorOrdinals* ordinals = nullptr;
+    std::vector<AuthorResult> entries;
+    // position in entries for every author ordinal
+    std::vector<uint32_t> slotForOrdinal;
+    std::vector<uint32_t> usedOrdinals;
+};
+
+// filtered authors bucketed by the whole part of their ratio
+// order statistics only need to look into the single bucket they fall into instead of sorting everyone
+class RatioRanks{
+public:
+    // ratios past the last bucket share it, it is scanned like any other boundary bucket
+    static constexpr uint32_t bucketLimit = 4096;
+
+    void Clear();
+    void Add(int author, double ratio);
+    size_t Size() const {return count;}
+    // ratio the author at this position would have if all of them were sorted by ratio
+    double RatioAtRank(size_t rank);
+    // amount of authors with ratio strictly below value
+    size_t CountBelow(double value);
+    // calls func(author, ratio) for every author, in no particular order
+    template <typename Func>
+    void ForEach(Func&& func) const{
+        for(auto bucket : usedBuckets)
+            for(const auto& entry : buckets[bucket])
+                func(entry.author, entry.ratio);
+    }
+
+private:
+    struct Entry{
+        double ratio = 0;
+        int author = -1;
+    };
+    void SortUsedBuckets();
+
+    std::vector<std::vector<Entry>> buckets;
+    std::vector<uint32_t> usedBuckets;
+    bool usedBucketsSorted = true;
+    size_t count = 0;
+};
+
+// everything a calculator needs to create a list that is worth keeping between lists
+// workspaces are pooled, a calculator holds one for its lifetime and it is reset once returned
+class RecCalculatorWorkspace{
+public:
+    static QSharedPointer<RecCalculatorWorkspace> Acquire(const AuthorOrdinals& ordinals);
+    // workspaces returned while this many are already idle are freed instead of pooled
+    static void SetIdleLimit(int limit);
+
+    AuthorTable authors;
+    std::vector<int> filteredAuthors;
+    RatioRanks ratioRanks;
+    // fic ordinal -> position among the fics a list votes for, all invalid between uses
+    std::vector<uint32_t> localOrdinals;
+    // short lived containers of a single list
+    BumpArena arena;
+
+private:
+    void Reset();
+};
+
+}
@@ -0,0 +1,74 @@
+/*
+Flipper is a recommendation and search engine for fanfiction.net
+Copyright (C) 2017-2020  Marchenko Nikolai
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+#pragma once
+#include <QSet>
+#include <QSharedPointer>
+
+#include <vector>
+
+#include "include/rec_calc/rec_calculator_base.h"
+
+namespace core {
+
+// which part of a list diagnostics are produced for, nothing outside of it is ever looked at
+struct DiagnosticScope{
+    // explicitly requested fics, topFics is ignored when there are any
+    QSet<uint32_t> fics;
+    // best fics of the list by recommendations
+    int topFics = 0;
+};
+
+// explains a created list: which authors voted for a fic and what they looked like to the calculator
+// it keeps the calculator and the workspace its authors live in until it is destroyed,
+// data is produced while it's read instead of being copied out for the whole list
+class ReclistDiagnostics{
+public:
+    ReclistDiagnostics(QSharedPointer<RecCalculatorImplBase> calculator, const DiagnosticScope& scope);
+
+    // fics in scope, best first for top fics, ascending when requested explicitly
+    const std::vector<uint32_t>& Fics() const {return fics;}
+    // calls func(fic, authors) for every fic in scope that filtered authors have in their favourites
+    // authors are ascending, the vector is reused between calls
+    template <typename Func>
+    void ForEachFic(Func&& func) const{
+        std::vector<uint32_t> authors;
+        for(auto fic : fics)
+        {
+            VotersForFic(fic, authors);
+            if(!authors.empty())
+                func(fic, authors);
+        }
+    }
+    // calls func(author) once for every filtered author that has any fic in scope in favourites
+    template <typename Func>
+    void ForEachAuthor(Func&& func) const{
+        for(auto author : voters)
+            if(auto result = calculator->allAuthors.Find(author))
+                func(static_cast<const AuthorResult&>(*result));
+    }
+
+private:
+    void VotersForFic(uint32_t fic, std::vector<uint32_t>& authors) const;
+
+    QSharedPointer<RecCalculatorImplBase> calculator;
+    std::vector<uint32_t> fics;
+    Roaring filteredAuthors;
+    Roaring voters;
+};
+
+}
@@ -46,7 +46,7 @@ struct AuthorWeightingResult
     }
     bool ownProfile = false;;
     double value = 0;
-    EAuthorType authorType;
+    EAuthorType authorType = EAuthorType::common;
 };
 
 struct AuthorResult{
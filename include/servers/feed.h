@@ -24,13 +24,17 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #include <QSet>
 #include <QTimer>
 #include <QObject>
+#include <QFuture>
 #include <atomic>
+#include <memory>
 
 #include "proto/feeder_service.grpc.pb.h"
 #include "proto/feeder_service.pb.h"
 #include "include/tokenkeeper.h"
 #include "include/storyfilter.h"
 #include "servers/database_context.h"
+#include "servers/reclist_cache.h"
+#include "core/stage_tracing_report.h"
 #include "rng.h"
 
 
@@ -75,6 +79,8 @@ struct RequestContext{
     FeederService* server;
     DatabaseContext dbContext;
     RecommendationsData* recsData;
+    // the whole request is a span, stages timed on this thread are attributed to it
+    std::unique_ptr<tracing::RequestTrace> trace;
 };
 
 class FeederService final : public QObject, public ProtoSpace::Feeder::Service  {
@@ -142,7 +148,30 @@ public:
     QDateTime startedAt;
     QReadWriteLock lock;
     QSharedPointer<QTimer> logTimer;
+    QSharedPointer<QTimer> reloadTimer;
+    // build id from the manifest of the snapshot that is currently served
+    // both are only changed by the reload once its snapshot is published
+    QString loadedSnapshotBuild;
+    // deltas of that snapshot that are already applied
+    int loadedSnapshotDeltas = 0;
+    // false when there was no snapshot to serve at startup, the server doesn't start then
+    bool hasData = false;
+    std::atomic<bool> dataReloadInProgress{false};
+    QFuture<void> dataReload;
     QSharedPointer<core::RNGData> rngData;
+    ReclistCache reclistCache;
+    // lists with a result limit only show the best fics so they can live with approximate candidates
+    bool approximateCandidatesForLimitedLists = false;
+    // every n-th approximate list is also created exactly to log recall, 0 disables this
+    int approximateRecallSampling = 0;
+    std::atomic<int> approximateListsCreated{0};
+    QSharedPointer<QTimer> metricsTimer;
+    // span latency percentiles are rewritten here periodically, empty disables it
+    QString stageMetricsFile;
+    // every request leaves a chrome trace here, empty disables it
+    QString traceFolder;
+    // diagnostic lists without a result limit explain this many of their best fics
+    int diagnosticTopFics = 500;
 private:
     void AddToStatistics(QString uuid, const core::StoryFilter& filter);
     void AddToStatistics(QString uuid);
@@ -165,4 +194,6 @@ private:
                                RequestContext& reqContext);
 public slots:
     void OnPrintStatistics();
+    void OnCheckForDataUpdate();
+    void OnWriteStageMetrics();
 };
@@ -0,0 +1,78 @@
+/*
+Flipper is a recommendation and search engine for fanfiction.net
+Copyright (C) 2017-2020  Marchenko Nikolai
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+#pragma once
+#include <QByteArray>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QSharedPointer>
+#include <QWaitCondition>
+
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <list>
+
+namespace core{
+class RecommendationList;
+}
+
+// the key covers everything that influences the created list, including the data snapshot it is created from
+// sets are sorted before hashing so the order they arrived in doesn't matter
+QByteArray ReclistCacheKey(const core::RecommendationList& params, QList<uint32_t> sourceFics, bool ignoreBreakdowns, uint32_t dataGeneration);
+
+// keeps serialized reclist responses, least recently used ones are evicted once byteLimit is reached
+// identical requests that arrive while the list is still being created wait for it instead of creating it again
+class ReclistCache{
+public:
+    explicit ReclistCache(size_t byteLimit = 0): byteLimit(byteLimit){}
+
+    // creator is only called when neither the cache nor another thread can provide the data
+    // and always runs on the calling thread, an empty result is passed through but never cached
+    // if it throws, the exception is rethrown to the caller and to every request that was waiting for it
+    QByteArray GetOrCreate(const QByteArray& key, const std::function<QByteArray()>& creator);
+    void SetByteLimit(size_t limit);
+    void Clear();
+
+    std::atomic<int> hits{0};
+    std::atomic<int> misses{0};
+    std::atomic<int> joined{0};
+
+private:
+    struct Flight{
+        bool finished = false;
+        QByteArray data;
+        std::exception_ptr error;
+    };
+    struct Entry{
+        QByteArray data;
+        std::list<QByteArray>::iterator position;
+    };
+    void Finish(const QByteArray& key, QSharedPointer<Flight> flight);
+    void Insert(const QByteArray& key, const QByteArray& data);
+    void Evict();
+
+    size_t byteLimit = 0;
+    size_t usedBytes = 0;
+    QMutex lock;
+    QWaitCondition flightFinished;
+    QHash<QByteArray, QSharedPointer<Flight>> flights;
+    QHash<QByteArray, Entry> entries;
+    // most recently used keys are at the front
+    std::list<QByteArray> usage;
+};
@@ -27,8 +27,9 @@ class AuthorGenreIterationProcessor{
 public:
     AuthorGenreIterationProcessor();
 
-    void ReprocessGenreStats(QHash<int, QList<genre_stats::GenreBit>> inputFicData,
-                             QHash<int, Roaring> inputAuthorData);
+    // genre and mood distributions of every author in inputAuthorData, added to the resulting hashes
+    void ReprocessGenreStats(const QHash<int, QList<genre_stats::GenreBit>>& inputFicData,
+                             const QHash<int, Roaring>& inputAuthorData);
 
 
     QHash<uint32_t, genre_stats::ListMoodData> CreateMoodDataFromGenres(QHash<int, std::array<double, 22>>&);
@@ -0,0 +1,154 @@
+/*
+Flipper is a recommendation and search engine for fanfiction.net
+Copyright (C) 2017-2020  Marchenko Nikolai
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+#pragma once
+#include <QFuture>
+#include <QThread>
+#include <QVector>
+#include <QtConcurrent>
+
+#include <algorithm>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace thread_boost{
+
+struct ParallelForOptions{
+    // amount of workers to use for a single call, <= 0 means QThread::idealThreadCount()
+    int threads = 0;
+    // smallest amount of indices that a worker takes for itself at once
+    size_t grain = 256;
+};
+
+namespace Impl{
+// a range of indices that belongs to a single worker
+// the owner eats it from the front while idle workers steal halves from the back
+class alignas(64) StealableRange{
+public:
+    void Assign(size_t begin, size_t end){
+        std::lock_guard<std::mutex> locker(lock);
+        this->begin = begin;
+        this->end = end;
+    }
+    bool TakeFront(size_t grain, size_t& begin, size_t& end){
+        std::lock_guard<std::mutex> locker(lock);
+        if(this->begin >= this->end)
+            return false;
+        begin = this->begin;
+        end = std::min(this->end, this->begin + grain);
+        this->begin = end;
+        return true;
+    }
+    bool StealBack(size_t grain, size_t& begin, size_t& end){
+        std::lock_guard<std::mutex> locker(lock);
+        if(this->begin >= this->end)
+            return false;
+        const size_t remaining = this->end - this->begin;
+        const size_t stolen = remaining > grain ? remaining/2 : remaining;
+        end = this->end;
+        begin = this->end - stolen;
+        this->end = begin;
+        return true;
+    }
+private:
+    std::mutex lock;
+    size_t begin = 0;
+    size_t end = 0;
+};
+
+template <typename T>
+struct alignas(64) WorkerSlot{
+    T value;
+};
+
+inline int WorkerCount(size_t size, const ParallelForOptions& options){
+    int threads = options.threads > 0 ? options.threads : QThread::idealThreadCount();
+    const size_t grain = std::max<size_t>(1, options.grain);
+    const size_t chunks = (size + grain - 1)/grain;
+    threads = static_cast<int>(std::min<size_t>(static_cast<size_t>(std::max(1, threads)), chunks));
+    return std::max(1, threads);
+}
+}
+
+// Calls worker(Reducer&, begin, end) over [0, size) in parallel and returns one reducer per worker, in worker order.
+// Every reducer starts as a copy of initial.
+// The calling thread participates as worker 0 so a busy thread pool only slows the call down instead of stalling it,
+// workers that run out of indices steal half of what remains in someone else's range.
+template <typename Reducer, typename Worker>
+std::vector<Reducer> ParallelReduce(size_t size, const ParallelForOptions& options, const Reducer& initial, Worker&& worker){
+    const int workerCount = Impl::WorkerCount(size, options);
+    const size_t grain = std::max<size_t>(1, options.grain);
+    std::vector<Impl::WorkerSlot<Reducer>> slots(workerCount, Impl::WorkerSlot<Reducer>{initial});
+    std::vector<Impl::StealableRange> ranges(workerCount);
+
+    const size_t share = size/workerCount;
+    for(int i = 0; i < workerCount; i++)
+        ranges[i].Assign(i*share, i == workerCount - 1 ? size : (i+1)*share);
+
+    auto run = [&](int index){
+        auto& reducer = slots[index].value;
+        size_t begin = 0, end = 0;
+        while(true)
+        {
+            while(ranges[index].TakeFront(grain, begin, end))
+                worker(reducer, begin, end);
+
+            bool stolen = false;
+            for(int offset = 1; offset < workerCount && !stolen; offset++)
+            {
+                if(ranges[(index + offset)%workerCount].StealBack(grain, begin, end))
+                {
+                    ranges[index].Assign(begin, end);
+                    stolen = true;
+                }
+            }
+            if(!stolen)
+                break;
+        }
+    };
+
+    QVector<QFuture<void>> futures;
+    futures.reserve(workerCount - 1);
+    for(int i = 1; i < workerCount; i++)
+        futures.push_back(QtConcurrent::run([&run, i](){run(i);}));
+    run(0);
+    for(auto& future: futures)
+        future.waitForFinished();
+
+    std::vector<Reducer> result;
+    result.reserve(workerCount);
+    for(auto& slot : slots)
+        result.push_back(std::move(slot.value));
+    return result;
+}
+
+template <typename Reducer, typename Worker>
+std::vector<Reducer> ParallelReduce(size_t size, const ParallelForOptions& options, Worker&& worker){
+    return ParallelReduce(size, options, Reducer{}, std::forward<Worker>(worker));
+}
+
+// Calls worker(begin, end) over [0, size) in parallel, same scheduling as ParallelReduce.
+template <typename Worker>
+void ParallelFor(size_t size, const ParallelForOptions& options, Worker&& worker){
+    struct NoReduction{};
+    ParallelReduce(size, options, NoReduction{}, [&worker](NoReduction&, size_t begin, size_t end){
+        worker(begin, end);
+    });
+}
+
+}
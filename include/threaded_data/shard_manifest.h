@@ -0,0 +1,55 @@
+/*
+Flipper is a recommendation and search engine for fanfiction.net
+Copyright (C) 2017-2020  Marchenko Nikolai
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+#pragma once
+#include <QString>
+#include <QVector>
+
+namespace thread_boost{
+
+// nameBase_0.txt ... nameBase_N.txt are shards of a single container
+// their amount depends only on the size of the container, not on the machine that wrote them,
+// so any amount of threads can read them and every shard is read exactly once
+struct ShardManifest{
+    static constexpr int version = 1;
+    // shards are kept small enough for idle threads to pick up the remaining ones while large ones are read
+    static constexpr int entriesPerShard = 16384;
+    static constexpr int maxShards = 512;
+
+    static int ShardCountFor(int size);
+    static QString FileName(QString nameBase);
+    static QString ShardFileName(QString nameBase, int shard);
+    // shards are written here first and only take their real names once all of them are written
+    static QString PartialShardFileName(QString nameBase, int shard);
+
+    bool Read(QString nameBase);
+    // files written before manifests existed are counted until the first missing one
+    // sizes are unknown then and left at 0, nothing is found while a write is being published
+    void Discover(QString nameBase);
+    // moves the partial shards in place, removes shards left from an earlier write that had more of them
+    // and writes the manifest, readers never see old and new shards mixed
+    bool Publish(QString nameBase) const;
+    // drops partial shards of a write that failed, the earlier shards are left as they were
+    void RemovePartialShards(QString nameBase) const;
+
+    int Count() const {return sizes.size();}
+    qint64 Total() const;
+
+    QVector<int> sizes;
+};
+
+}
@@ -20,6 +20,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>*/
 #include <QString>
 #include <QDebug>
 #include "logger/QsLog.h"
+#include "core/stage_tracing.h"
 
 
 struct TimedAction{
@@ -27,15 +28,17 @@ struct TimedAction{
     {
         this->actionName = name;this->action = action;
     }
+    // every timed action is a span, its latency goes into the histogram of its name
     void run(bool log = true)
     {
         if(log)
         {
-            auto start = std::chrono::high_resolution_clock::now();
+            auto start = tracing::Now();
             action();
-            auto elapsed = std::chrono::high_resolution_clock::now() - start;
-            ms = std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
-            QLOG_INFO() << "Action: " << actionName << " Performed in: " << ms;
+            ms = tracing::Now() - start;
+            tracing::RecordSpan(tracing::SpanId(actionName), start, ms);
+            if(tracing::LogSpans())
+                QLOG_INFO() << "Action: " << actionName << " Performed in: " << ms;
         }
         else
             action();
@@ -374,6 +374,11 @@ QHash<int, QSet<int> > Authors::LoadFullFavouritesHashset()
     return result;
 }
 
+QHash<int, QSet<int> > Authors::LoadFavouritesHashsetUpdatedSince(QDateTime date)
+{
+    return sql::LoadFavouritesHashsetUpdatedSince(date, db).data;
+}
+
 void LoadIDForAuthor(const core::AuthorPtr& author, sql::Database db)
 {
     const auto websites = author->GetWebsites();
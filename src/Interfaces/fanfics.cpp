@@ -339,6 +339,15 @@ QHash<int, core::FicWeightPtr> Fanfics::GetHashOfAllFicsWithEnoughFavesForWeight
     return result;
 }
 
+QHash<int, core::FicWeightPtr> Fanfics::GetHashOfFicsWithEnoughFavesForWeightsUpdatedSince(int faves, QDateTime date)
+{
+    QHash<int, core::FicWeightPtr> result;
+    auto temp = sql::GetFicsWithEnoughFavesForWeightsUpdatedSince(faves, date, db).data;
+    for(const auto& fic : temp)
+        result[fic->id] = fic;
+    return result;
+}
+
 bool Fanfics::ProcessSlashFicsBasedOnWords( std::function<SlashPresence (QString, QString, QString)> func)
 {
      auto result = sql::ProcessSlashFicsBasedOnWords(func, db);
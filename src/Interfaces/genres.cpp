@@ -138,6 +138,11 @@ QHash<int, QList<genre_stats::GenreBit> > Genres::GetFullGenreList(bool useOrigi
         return sql::GetFullGenreList(db, useOriginalgenres).data;
 }
 
+QHash<int, QList<genre_stats::GenreBit> > Genres::GetGenreListUpdatedSince(QDateTime date, bool useOriginalgenres)
+{
+    return sql::GetGenreListUpdatedSince(date, db, loadOriginalGenresOnly || useOriginalgenres).data;
+}
+
 void Genres::LogGenreDistribution(std::array<double, 22> &data, QString target)
 {
     An<interfaces::GenreIndex> genreIndex;
@@ -0,0 +1,231 @@
+/*
+Flipper is a recommendation and search engine for fanfiction.net
+Copyright (C) 2017-2020  Marchenko Nikolai
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+#include "include/bench/synthetic_favourites.h"
+#include "include/timeutils.h"
+#include "logger/QsLog.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace bench{
+
+uint64_t SplitMix::Next()
+{
+    uint64_t result = (state += 0x9E3779B97F4A7C15ull);
+    result = (result ^ (result >> 30)) * 0xBF58476D1CE4E5B9ull;
+    result = (result ^ (result >> 27)) * 0x94D049BB133111EBull;
+    return result ^ (result >> 31);
+}
+
+double SplitMix::NextDouble()
+{
+    // top 53 bits fill the mantissa exactly
+    return static_cast<double>(Next() >> 11) * (1.0/9007199254740992.0);
+}
+
+uint32_t SplitMix::NextBelow(uint32_t bound)
+{
+    return bound == 0 ? 0 : static_cast<uint32_t>((Next() >> 32) * bound >> 32);
+}
+
+// picks an index from cumulative weights
+static uint32_t PickWeighted(SplitMix& random, const std::vector<double>& cumulative)
+{
+    const double point = random.NextDouble() * cumulative.back();
+    auto it = std::upper_bound(cumulative.cbegin(), cumulative.cend(), point);
+    if(it == cumulative.cend())
+        it--;
+    return static_cast<uint32_t>(it - cumulative.cbegin());
+}
+
+static std::vector<double> ZipfWeights(size_t size, double exponent)
+{
+    std::vector<double> result(size);
+    double sum = 0;
+    for(size_t i = 0; i < size; i++)
+    {
+        sum += 1.0/std::pow(static_cast<double>(i + 1), exponent);
+        result[i] = sum;
+    }
+    return result;
+}
+
+// per author generators are independent so that the data doesn't depend on the order authors are generated in
+static uint64_t SeedFor(uint64_t seed, uint64_t salt, uint64_t id)
+{
+    SplitMix mixer(seed ^ (salt * 0xD1B54A32D192ED03ull));
+    mixer.Next();
+    return mixer.Next() ^ (id * 0x9E3779B97F4A7C15ull);
+}
+
+SyntheticFavourites::SyntheticFavourites(SyntheticDataOptions options): options(options)
+{
+    this->options.fandoms = std::max(1, std::min(options.fandoms, options.fics));
+    this->options.minListSize = std::max(1, options.minListSize);
+    this->options.maxListSize = std::max(this->options.minListSize, std::min(options.maxListSize, options.fics));
+
+    fandomWeights = ZipfWeights(static_cast<size_t>(this->options.fandoms), options.popularityExponent);
+    fandoms.resize(static_cast<size_t>(this->options.fandoms));
+
+    // every fandom gets a fic of its own, the rest goes to popular fandoms more often
+    SplitMix random(SeedFor(options.seed, 1, 0));
+    for(int fic = 1; fic <= options.fics; fic++)
+    {
+        uint32_t fandom = fic <= this->options.fandoms ? static_cast<uint32_t>(fic - 1) : PickWeighted(random, fandomWeights);
+        fandoms[fandom].fics.push_back(static_cast<uint32_t>(fic));
+    }
+    for(auto& fandom : fandoms)
+        fandom.weights = ZipfWeights(fandom.fics.size(), options.popularityExponent);
+}
+
+uint32_t SyntheticFavourites::PickFandom(SplitMix& random) const
+{
+    return PickWeighted(random, fandomWeights);
+}
+
+uint32_t SyntheticFavourites::PickFic(SplitMix& random, uint32_t fandom) const
+{
+    const auto& data = fandoms[fandom];
+    return data.fics[PickWeighted(random, data.weights)];
+}
+
+int SyntheticFavourites::PickListSize(SplitMix& random) const
+{
+    // inverse of bounded pareto distribution
+    const double low = options.minListSize;
+    const double high = options.maxListSize;
+    const double exponent = options.listSizeExponent;
+    const double u = random.NextDouble();
+    const double size = low / std::pow(1.0 - u * (1.0 - std::pow(low/high, exponent)), 1.0/exponent);
+    return std::clamp(static_cast<int>(size), options.minListSize, options.maxListSize);
+}
+
+Roaring SyntheticFavourites::CreateList(SplitMix& random, int size) const
+{
+    std::vector<uint32_t> ownFandoms;
+    for(int i = 0; i < options.fandomsPerAuthor; i++)
+        ownFandoms.push_back(PickFandom(random));
+
+    Roaring result;
+    // small fandoms run out of fics, lists that can't be filled stay shorter
+    const int attempts = size * 20;
+    for(int i = 0; i < attempts && result.cardinality() < static_cast<uint64_t>(size); i++)
+    {
+        uint32_t fandom = 0;
+        if(!ownFandoms.empty() && random.NextDouble() < options.ownFandomShare)
+            fandom = ownFandoms[random.NextBelow(static_cast<uint32_t>(ownFandoms.size()))];
+        else
+            fandom = PickFandom(random);
+        result.add(PickFic(random, fandom));
+    }
+    return result;
+}
+
+genre_stats::ListMoodData SyntheticFavourites::CreateMoods(SplitMix& random)
+{
+    // most lists lean towards a single mood with some of everything else
+    std::array<float, 7> values;
+    for(auto& value : values)
+        value = static_cast<float>(random.NextDouble());
+    values[random.NextBelow(7)] += 3.0f;
+    float sum = 0;
+    for(auto value : values)
+        sum += value;
+    for(auto& value : values)
+        value /= sum;
+
+    genre_stats::ListMoodData result;
+    result.strengthNeutral = values[0];
+    result.strengthFunny = values[1];
+    result.strengthShocky = values[2];
+    result.strengthFlirty = values[3];
+    result.strengthDramatic = values[4];
+    result.strengthHurty = values[5];
+    result.strengthBondy = values[6];
+    result.strengthNonNeutral = 1.0f - result.strengthNeutral;
+    result.strengthNonFunny = 1.0f - result.strengthFunny;
+    result.strengthNonShocky = 1.0f - result.strengthShocky;
+    result.strengthNonFlirty = 1.0f - result.strengthFlirty;
+    result.strengthNonDramatic = 1.0f - result.strengthDramatic;
+    result.strengthNonHurty = 1.0f - result.strengthHurty;
+    result.strengthNonBondy = 1.0f - result.strengthBondy;
+    return result;
+}
+
+void SyntheticFavourites::Fill(core::DataHolder& data, QString storageFolder)
+{
+    TimedAction action("Generating synthetic data",[&](){
+        data.fics.clear();
+        data.faves.clear();
+        data.authorMoodDistributions.clear();
+
+        SplitMix ficRandom(SeedFor(options.seed, 2, 0));
+        for(uint32_t fandom = 0; fandom < fandoms.size(); fandom++)
+        {
+            for(auto id : fandoms[fandom].fics)
+            {
+                core::FicWeightPtr fic(new core::FanficDataForRecommendationCreation());
+                fic->id = static_cast<int>(id);
+                fic->fandoms.push_back(static_cast<int>(fandom));
+                fic->authorId = static_cast<int>(ficRandom.NextBelow(static_cast<uint32_t>(options.authors))) + 1;
+                fic->chapterCount = static_cast<int>(ficRandom.NextBelow(40)) + 1;
+                fic->wordCount = fic->chapterCount * (static_cast<int>(ficRandom.NextBelow(5000)) + 500);
+                fic->complete = ficRandom.NextDouble() < 0.6;
+                fic->favCount = 0;
+                data.fics.insert(fic->id, fic);
+            }
+        }
+
+        data.faves.reserve(options.authors);
+        data.authorMoodDistributions.reserve(options.authors);
+        for(int author = 1; author <= options.authors; author++)
+        {
+            SplitMix random(SeedFor(options.seed, 3, static_cast<uint64_t>(author)));
+            auto list = CreateList(random, PickListSize(random));
+            list.runOptimize();
+            data.faves.insert(author, std::move(list));
+            auto moods = CreateMoods(random);
+            moods.listId = author;
+            data.authorMoodDistributions.insert(static_cast<uint32_t>(author), moods);
+        }
+    });
+    action.run();
+
+    data.BuildDerivedData<core::rdt_favourites>(storageFolder);
+    for(auto i = data.favouritesByFic.cbegin(); i != data.favouritesByFic.cend(); i++)
+        if(auto fic = data.fics.value(i.key()))
+            fic->favCount = static_cast<int>(i.value().cardinality());
+    data.BuildDerivedData<core::rdt_fics>(storageFolder);
+    data.BuildDerivedData<core::rdt_author_mood_distribution>(storageFolder);
+    QLOG_INFO() << "generated authors:" << data.faves.size() << "fics:" << data.ficTable.Size() << "fandoms:" << fandoms.size();
+}
+
+SyntheticUser SyntheticFavourites::CreateUser(const core::DataHolder& data, int listSize, uint64_t userSeed) const
+{
+    SplitMix random(SeedFor(options.seed, 4, userSeed));
+    SyntheticUser result;
+    for(auto fic : CreateList(random, listSize))
+        if(auto ficData = data.ficTable.Fic(static_cast<int>(fic)))
+            result.fetchedFics.insert(fic, ficData);
+    result.moodData.isValid = true;
+    result.moodData.listGenreData.fill(0);
+    result.moodData.listMoodData = CreateMoods(random);
+    return result;
+}
+
+}
@@ -0,0 +1,155 @@
+/*Flipper is a recommendation and search engine for fanfiction.net
+Copyright (C) 2017-2020  Marchenko Nikolai
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>*/
+#include "core/stage_tracing_report.h"
+#include "logger/QsLog.h"
+
+#include <QDir>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSaveFile>
+#include <QTextStream>
+
+namespace tracing{
+
+QVector<SpanStatistics> CollectStatistics()
+{
+    auto& registry = Registry();
+    QVector<QString> names;
+    {
+        QReadLocker locker(&registry.namesLock);
+        names = registry.names;
+    }
+    QVector<SpanStatistics> result(std::min(names.size(), static_cast<int>(TraceRegistry::maxSpanNames)));
+    for(int i = 0; i < result.size(); i++)
+        result[i].name = names[i];
+
+    QMutexLocker locker(&registry.threadsLock);
+    for(size_t i = 0; i < registry.retired.size() && i < static_cast<size_t>(result.size()); i++)
+        result[static_cast<int>(i)].histogram.Add(registry.retired[i]);
+    for(auto thread : registry.threads)
+        for(int i = 0; i < result.size(); i++)
+            if(thread->histograms[static_cast<size_t>(i)])
+                thread->histograms[static_cast<size_t>(i)]->AddTo(result[i].histogram);
+    return result;
+}
+
+QStringList DescribeStatistics(const QVector<SpanStatistics>& statistics)
+{
+    QStringList result;
+    result.push_back(QString("%1 %2 %3 %4 %5 %6 %7 %8").arg("span", -40).arg("count", 10).arg("mean", 10)
+                     .arg("p50", 10).arg("p90", 10).arg("p99", 10).arg("p99.9", 10).arg("max", 10));
+    for(const auto& span : statistics)
+    {
+        const auto& histogram = span.histogram;
+        if(histogram.count == 0)
+            continue;
+        result.push_back(QString("%1 %2 %3 %4 %5 %6 %7 %8").arg(span.name, -40).arg(histogram.count, 10)
+                         .arg(histogram.sum/histogram.count, 10)
+                         .arg(histogram.ValueAtPercentile(50), 10).arg(histogram.ValueAtPercentile(90), 10)
+                         .arg(histogram.ValueAtPercentile(99), 10).arg(histogram.ValueAtPercentile(99.9), 10)
+                         .arg(histogram.max, 10));
+    }
+    return result;
+}
+
+bool WriteMetricsFile(QString fileName)
+{
+    QSaveFile file(fileName);
+    if(!file.open(QIODevice::WriteOnly | QIODevice::Text))
+        return false;
+    QTextStream out(&file);
+    out << "# span latencies in microseconds since server start\n";
+    for(const auto& line : DescribeStatistics(CollectStatistics()))
+        out << line << "\n";
+    out.flush();
+    return file.commit();
+}
+
+RequestTrace::RequestTrace(QString name, QString folder): name(name), folder(folder)
+{
+    auto& state = CurrentThread();
+    nameId = SpanId(name);
+    id = Registry().nextTrace++;
+    previousTrace = state.trace;
+    state.trace = id;
+    firstEvent = state.written;
+    start = Now();
+}
+
+RequestTrace::~RequestTrace()
+{
+    const auto duration = Now() - start;
+    auto& state = CurrentThread();
+    state.trace = previousTrace;
+    RecordSpan(nameId, start, duration);
+    if(!folder.isEmpty())
+        WriteTrace(duration);
+}
+
+void RequestTrace::WriteTrace(int64_t duration)
+{
+    auto& state = CurrentThread();
+    QVector<QString> names;
+    {
+        auto& registry = Registry();
+        QReadLocker locker(&registry.namesLock);
+        names = registry.names;
+    }
+    auto eventObject = [&](uint32_t span, int64_t spanStart, int64_t spanDuration){
+        QJsonObject event;
+        event["name"] = span < static_cast<uint32_t>(names.size()) ? names[static_cast<int>(span)] : QString::number(span);
+        event["ph"] = "X";
+        event["ts"] = static_cast<qint64>(spanStart);
+        event["dur"] = static_cast<qint64>(spanDuration);
+        event["pid"] = 1;
+        event["tid"] = static_cast<int>(state.threadId);
+        return event;
+    };
+
+    QJsonArray events;
+    // spans that were overwritten by the time the request finished are lost
+    uint64_t first = firstEvent;
+    if(state.written - first > ThreadTraceState::ringSize)
+    {
+        QLOG_WARN() << "trace of" << name << id << "lost" << state.written - first - ThreadTraceState::ringSize << "spans";
+        first = state.written - ThreadTraceState::ringSize;
+    }
+    for(auto i = first; i < state.written; i++)
+    {
+        const auto& event = state.ring[i%ThreadTraceState::ringSize];
+        if(event.trace == id)
+            events.push_back(eventObject(event.name, event.start, event.duration));
+    }
+    events.push_back(eventObject(nameId, start, duration));
+
+    QDir().mkpath(folder);
+    QString fileName = QString("%1/%2_%3.json").arg(folder, QString(name).replace(' ', '_')).arg(id);
+    QSaveFile file(fileName);
+    if(!file.open(QIODevice::WriteOnly))
+    {
+        QLOG_WARN() << "couldn't write trace into" << fileName;
+        return;
+    }
+    QJsonObject trace;
+    trace["traceEvents"] = events;
+    trace["displayTimeUnit"] = "ms";
+    file.write(QJsonDocument(trace).toJson(QJsonDocument::Compact));
+    file.commit();
+}
+
+}
@@ -0,0 +1,223 @@
+/*
+Flipper is a recommendation and search engine for fanfiction.net
+Copyright (C) 2017-2020  Marchenko Nikolai
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+#include "include/data_code/favourites_sketch.h"
+#include "include/threaded_data/parallel_for.h"
+#include "logger/QsLog.h"
+
+#include <QDataStream>
+#include <QFile>
+#include <algorithm>
+#include <limits>
+
+namespace core{
+
+static constexpr quint32 sketchMagic = 0x464b5354;
+static constexpr quint32 sketchVersion = 1;
+
+static inline uint64_t Mix(uint64_t value){
+    // splitmix64 finalizer
+    value += 0x9e3779b97f4a7c15ULL;
+    value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    value = (value ^ (value >> 27)) * 0x94d049bb133111ebULL;
+    return value ^ (value >> 31);
+}
+
+// multiply-shift hash family, multipliers need to be odd
+static const std::array<uint64_t, FavouritesSketch::signatureSize>& HashSeeds(){
+    static const auto seeds = [](){
+        std::array<uint64_t, FavouritesSketch::signatureSize> result;
+        for(int i = 0; i < FavouritesSketch::signatureSize; i++)
+            result[i] = Mix(static_cast<uint64_t>(i)) | 1;
+        return result;
+    }();
+    return seeds;
+}
+
+FavouritesSketch::Signature FavouritesSketch::SignatureFor(const Roaring& favourites)
+{
+    Signature signature;
+    signature.fill(std::numeric_limits<uint32_t>::max());
+    const auto& seeds = HashSeeds();
+    for(auto fic : favourites)
+    {
+        const uint64_t mixed = Mix(fic);
+        for(int i = 0; i < signatureSize; i++)
+            signature[i] = std::min(signature[i], static_cast<uint32_t>((mixed * seeds[i]) >> 32));
+    }
+    return signature;
+}
+
+uint32_t FavouritesSketch::BandKey(const Signature& signature, int band) const
+{
+    uint64_t key = static_cast<uint64_t>(band);
+    for(int row = 0; row < rowsPerBand; row++)
+        key = Mix(key ^ signature[band*rowsPerBand + row]);
+    return static_cast<uint32_t>(key);
+}
+
+uint64_t FavouritesSketch::Fingerprint(const QHash<int, Roaring>& faves)
+{
+    std::vector<std::pair<int, const Roaring*>> lists;
+    lists.reserve(faves.size());
+    for(auto i = faves.cbegin(); i != faves.cend(); i++)
+        lists.push_back({i.key(), &i.value()});
+
+    // every fic of a list is mixed in, a replaced favourite has to change it even though the list size stays the same
+    // lists are summed up so that it doesn't depend on hash layout
+    auto worker = [&](uint64_t& sum, size_t begin, size_t end){
+        for(auto i = begin; i < end; i++)
+        {
+            uint64_t list = Mix(static_cast<uint64_t>(lists[i].first));
+            for(auto fic : *lists[i].second)
+                list = Mix(list ^ fic);
+            sum += list;
+        }
+    };
+    uint64_t result = Mix(static_cast<uint64_t>(faves.size()));
+    for(auto sum : thread_boost::ParallelReduce<uint64_t>(lists.size(), {0, 1024}, worker))
+        result += sum;
+    return result;
+}
+
+void FavouritesSketch::Build(const QHash<int, Roaring>& faves, int rowsPerBand)
+{
+    Clear();
+    this->rowsPerBand = std::clamp(rowsPerBand, 1, signatureSize);
+    fingerprint = Fingerprint(faves);
+
+    std::vector<uint32_t> authorIds;
+    std::vector<const Roaring*> lists;
+    authorIds.reserve(faves.size());
+    lists.reserve(faves.size());
+    for(auto i = faves.cbegin(); i != faves.cend(); i++)
+    {
+        authorIds.push_back(static_cast<uint32_t>(i.key()));
+        lists.push_back(&i.value());
+    }
+
+    std::vector<Signature> signatures(authorIds.size());
+    thread_boost::ParallelFor(authorIds.size(), {0, 1024}, [&](size_t begin, size_t end){
+        for(auto i = begin; i < end; i++)
+            signatures[i] = SignatureFor(*lists[i]);
+    });
+
+    const int bandCount = signatureSize/this->rowsPerBand;
+    bands.resize(bandCount);
+    thread_boost::ParallelFor(static_cast<size_t>(bandCount), {0, 1}, [&](size_t begin, size_t end){
+        for(auto band = begin; band < end; band++)
+        {
+            auto& entries = bands[band];
+            entries.reserve(authorIds.size());
+            for(size_t i = 0; i < authorIds.size(); i++)
+                entries.push_back({BandKey(signatures[i], static_cast<int>(band)), authorIds[i]});
+            std::sort(entries.begin(), entries.end(), [](const BandEntry& first, const BandEntry& second){
+                return first.key < second.key;
+            });
+        }
+    });
+    authorCount = static_cast<uint32_t>(authorIds.size());
+    QLOG_INFO() << "favourites sketch built for authors: " << authorCount << " bands: " << bandCount;
+}
+
+Roaring FavouritesSketch::Candidates(const Roaring& favourites) const
+{
+    Roaring result;
+    if(!IsReady() || favourites.isEmpty())
+        return result;
+    auto signature = SignatureFor(favourites);
+    std::vector<uint32_t> found;
+    for(int band = 0; band < static_cast<int>(bands.size()); band++)
+    {
+        const auto& entries = bands[band];
+        const auto key = BandKey(signature, band);
+        auto range = std::equal_range(entries.cbegin(), entries.cend(), BandEntry{key, 0}, [](const BandEntry& first, const BandEntry& second){
+            return first.key < second.key;
+        });
+        for(auto it = range.first; it != range.second; it++)
+            found.push_back(it->author);
+    }
+    std::sort(found.begin(), found.end());
+    found.erase(std::unique(found.begin(), found.end()), found.end());
+    result.addMany(found.size(), found.data());
+    return result;
+}
+
+void FavouritesSketch::Clear()
+{
+    bands.clear();
+    authorCount = 0;
+    fingerprint = 0;
+}
+
+bool FavouritesSketch::Save(QString storageFolder) const
+{
+    QFile file(storageFolder + "/roafav_sketch.bin");
+    if(!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        return false;
+    QDataStream out(&file);
+    out << sketchMagic << sketchVersion << static_cast<qint32>(rowsPerBand) << static_cast<quint64>(fingerprint);
+    out << static_cast<quint32>(authorCount) << static_cast<quint32>(bands.size());
+    for(const auto& entries : bands)
+    {
+        out << static_cast<quint32>(entries.size());
+        out.writeRawData(reinterpret_cast<const char*>(entries.data()), static_cast<int>(entries.size()*sizeof(BandEntry)));
+    }
+    return out.status() == QDataStream::Ok;
+}
+
+bool FavouritesSketch::Load(QString storageFolder, const QHash<int, Roaring>& faves, int rowsPerBand)
+{
+    Clear();
+    QFile file(storageFolder + "/roafav_sketch.bin");
+    if(!file.open(QIODevice::ReadOnly))
+        return false;
+    QDataStream in(&file);
+    quint32 magic = 0, version = 0, storedAuthors = 0, bandCount = 0;
+    qint32 storedRows = 0;
+    quint64 storedFingerprint = 0;
+    in >> magic >> version >> storedRows >> storedFingerprint >> storedAuthors >> bandCount;
+    if(magic != sketchMagic || version != sketchVersion || storedFingerprint != Fingerprint(faves))
+        return false;
+    if(storedRows < 1 || storedRows > signatureSize || bandCount != static_cast<quint32>(signatureSize/storedRows))
+        return false;
+    if(storedRows != std::clamp(rowsPerBand, 1, signatureSize))
+    {
+        QLOG_INFO() << "favourites sketch was built with rows per band: " << storedRows << " instead of: " << rowsPerBand << " it will be rebuilt";
+        return false;
+    }
+
+    std::vector<std::vector<BandEntry>> loadedBands(bandCount);
+    for(auto& entries : loadedBands)
+    {
+        quint32 size = 0;
+        in >> size;
+        if(size != storedAuthors)
+            return false;
+        entries.resize(size);
+        const int bytes = static_cast<int>(size*sizeof(BandEntry));
+        if(in.readRawData(reinterpret_cast<char*>(entries.data()), bytes) != bytes)
+            return false;
+    }
+    rowsPerBand = storedRows;
+    fingerprint = storedFingerprint;
+    authorCount = storedAuthors;
+    bands = std::move(loadedBands);
+    return true;
+}
+
+}
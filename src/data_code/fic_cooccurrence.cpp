@@ -0,0 +1,737 @@
+/*
+Flipper is a recommendation and search engine for fanfiction.net
+Copyright (C) 2017-2020  Marchenko Nikolai
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+#include "include/data_code/fic_cooccurrence.h"
+#include "include/threaded_data/parallel_for.h"
+#include "include/timeutils.h"
+#include "logger/QsLog.h"
+
+#include <QDir>
+#include <QFile>
+#include <QMutexLocker>
+#include <QSettings>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <memory>
+#include <queue>
+
+namespace core{
+
+static constexpr uint32_t cooccurrenceRunMagic = 0x46435252;
+static constexpr uint32_t cooccurrenceMatrixMagic = 0x4643524d;
+static constexpr uint32_t cooccurrenceCountsMagic = 0x46435243;
+static constexpr uint32_t cooccurrenceVersion = 1;
+
+// run layout: header, every partition's (pair delta, count) varints one after another, partitions + 1 section offsets
+struct CooccurrenceRunHeader{
+    uint32_t magic = cooccurrenceRunMagic;
+    uint32_t version = cooccurrenceVersion;
+    uint32_t partitions = 0;
+    uint32_t reserved = 0;
+};
+
+// matrix layout: header, then rows of (fic1 delta, entry count) varints, each followed by its entries
+// entries are (fic2 delta, meetings) varints and two floats, a row with no entries ends the file
+struct CooccurrenceMatrixHeader{
+    uint32_t magic = cooccurrenceMatrixMagic;
+    uint32_t version = cooccurrenceVersion;
+    uint32_t partition = 0;
+    uint32_t reserved = 0;
+};
+
+// list counts layout: header, sorted fic ids, list count of every fic
+struct CooccurrenceCountsHeader{
+    uint32_t magic = cooccurrenceCountsMagic;
+    uint32_t version = cooccurrenceVersion;
+    uint32_t ficCount = 0;
+    uint32_t reserved = 0;
+};
+
+static void AppendVarint(QByteArray& buffer, uint64_t value)
+{
+    while(value >= 0x80)
+    {
+        buffer.append(static_cast<char>((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    buffer.append(static_cast<char>(value));
+}
+
+static void AppendFloat(QByteArray& buffer, float value)
+{
+    buffer.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+static void CalculateWeights(FicCooccurrence& pair, uint32_t listCount1, uint32_t listCount2)
+{
+    const double meetings = pair.meetingCount;
+    const double either = static_cast<double>(listCount1) + listCount2 - meetings;
+    pair.attraction = static_cast<float>(meetings/std::sqrt(static_cast<double>(listCount1)*listCount2));
+    pair.repulsion = static_cast<float>((either - meetings)/either);
+}
+
+namespace{
+// reads a part of a file through a small buffer, merges keep a lot of these open at once
+class ByteSource{
+public:
+    bool Open(QString fileName, qint64 begin, qint64 end){
+        file.setFileName(fileName);
+        if(!file.open(QIODevice::ReadOnly) || !file.seek(begin))
+            return false;
+        remaining = end - begin;
+        buffer.resize(0);
+        position = 0;
+        return true;
+    }
+    bool AtEnd() const {return position >= buffer.size() && remaining <= 0;}
+    bool ReadVarint(uint64_t& value){
+        value = 0;
+        char byte = 0;
+        for(int shift = 0; shift < 64; shift += 7)
+        {
+            if(!ReadBytes(&byte, 1))
+                return false;
+            value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            if(!(byte & 0x80))
+                return true;
+        }
+        return false;
+    }
+    bool ReadFloat(float& value){
+        return ReadBytes(reinterpret_cast<char*>(&value), sizeof(value));
+    }
+private:
+    bool ReadBytes(char* target, int size){
+        for(int i = 0; i < size; i++)
+        {
+            if(position >= buffer.size() && !Refill())
+                return false;
+            target[i] = buffer.at(position++);
+        }
+        return true;
+    }
+    bool Refill(){
+        if(remaining <= 0)
+            return false;
+        buffer = file.read(std::min(remaining, bufferSize));
+        position = 0;
+        remaining = buffer.isEmpty() ? 0 : remaining - buffer.size();
+        return !buffer.isEmpty();
+    }
+
+    static constexpr qint64 bufferSize = 64*1024;
+    QFile file;
+    QByteArray buffer;
+    int position = 0;
+    qint64 remaining = 0;
+};
+
+// partitions have to be started in order, the ones that were skipped stay empty
+class RunWriter{
+public:
+    bool Open(QString fileName, int partitions){
+        this->partitions = partitions;
+        offsets.clear();
+        buffer.resize(0);
+        file.setFileName(fileName);
+        if(!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+            return false;
+        CooccurrenceRunHeader header;
+        header.partitions = static_cast<uint32_t>(partitions);
+        written = file.write(reinterpret_cast<const char*>(&header), sizeof(header)) == sizeof(header);
+        position = sizeof(header);
+        return written;
+    }
+    void StartPartition(int partition){
+        while(static_cast<int>(offsets.size()) <= partition)
+            offsets.push_back(position + buffer.size());
+        previous = 0;
+    }
+    void Append(uint64_t pair, uint64_t count){
+        AppendVarint(buffer, pair - previous);
+        AppendVarint(buffer, count);
+        previous = pair;
+        if(buffer.size() >= flushSize)
+            Flush();
+    }
+    bool Finish(){
+        // the last offset is where the last partition ends
+        StartPartition(partitions);
+        Flush();
+        const qint64 indexSize = static_cast<qint64>(offsets.size()*sizeof(qint64));
+        written = written && file.write(reinterpret_cast<const char*>(offsets.data()), indexSize) == indexSize;
+        file.close();
+        return written;
+    }
+private:
+    void Flush(){
+        written = written && file.write(buffer) == buffer.size();
+        position += buffer.size();
+        buffer.resize(0);
+    }
+
+    static constexpr int flushSize = 1024*1024;
+    QFile file;
+    QByteArray buffer;
+    std::vector<qint64> offsets;
+    qint64 position = 0;
+    uint64_t previous = 0;
+    int partitions = 0;
+    bool written = false;
+};
+
+class RunReader{
+public:
+    bool Open(QString fileName, int partition, int partitions){
+        QFile file(fileName);
+        CooccurrenceRunHeader header;
+        std::vector<qint64> offsets(static_cast<size_t>(partitions) + 1);
+        const qint64 indexSize = static_cast<qint64>(offsets.size()*sizeof(qint64));
+        if(!file.open(QIODevice::ReadOnly) || file.size() < static_cast<qint64>(sizeof(header)) + indexSize)
+            return false;
+        if(file.read(reinterpret_cast<char*>(&header), sizeof(header)) != sizeof(header)
+                || header.magic != cooccurrenceRunMagic || header.version != cooccurrenceVersion
+                || header.partitions != static_cast<uint32_t>(partitions))
+            return false;
+        if(!file.seek(file.size() - indexSize) || file.read(reinterpret_cast<char*>(offsets.data()), indexSize) != indexSize)
+            return false;
+        file.close();
+        pair = 0;
+        return source.Open(fileName, offsets[partition], offsets[partition + 1]);
+    }
+    // false at the end of the partition, broken tells if it ended early
+    bool Next(){
+        if(source.AtEnd())
+            return false;
+        uint64_t delta = 0;
+        if(!source.ReadVarint(delta) || !source.ReadVarint(count))
+        {
+            broken = true;
+            return false;
+        }
+        pair += delta;
+        return true;
+    }
+
+    uint64_t pair = 0;
+    uint64_t count = 0;
+    bool broken = false;
+private:
+    ByteSource source;
+};
+
+class MatrixWriter{
+public:
+    bool Open(QString fileName, int partition){
+        file.setFileName(fileName);
+        if(!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+            return false;
+        CooccurrenceMatrixHeader header;
+        header.partition = static_cast<uint32_t>(partition);
+        written = file.write(reinterpret_cast<const char*>(&header), sizeof(header)) == sizeof(header);
+        return written;
+    }
+    void Append(const FicCooccurrence& pair){
+        if(pair.fic1 != rowFic)
+        {
+            FinishRow();
+            rowFic = pair.fic1;
+            previousFic2 = pair.fic1;
+        }
+        AppendVarint(row, pair.fic2 - previousFic2);
+        AppendVarint(row, pair.meetingCount);
+        AppendFloat(row, pair.attraction);
+        AppendFloat(row, pair.repulsion);
+        previousFic2 = pair.fic2;
+        rowSize++;
+    }
+    bool Finish(){
+        FinishRow();
+        AppendVarint(buffer, 0);
+        AppendVarint(buffer, 0);
+        Flush();
+        file.close();
+        return written;
+    }
+private:
+    void FinishRow(){
+        if(rowSize == 0)
+            return;
+        AppendVarint(buffer, rowFic - previousRowFic);
+        AppendVarint(buffer, rowSize);
+        buffer.append(row);
+        previousRowFic = rowFic;
+        row.resize(0);
+        rowSize = 0;
+        if(buffer.size() >= flushSize)
+            Flush();
+    }
+    void Flush(){
+        written = written && file.write(buffer) == buffer.size();
+        buffer.resize(0);
+    }
+
+    static constexpr int flushSize = 1024*1024;
+    QFile file;
+    QByteArray buffer;
+    QByteArray row;
+    uint32_t rowSize = 0;
+    uint32_t rowFic = 0;
+    uint32_t previousRowFic = 0;
+    uint32_t previousFic2 = 0;
+    bool written = false;
+};
+
+// sums up the counts of equal pairs in a single partition of every run, sink(pair, count) gets them in order
+template <typename Sink>
+bool MergePartition(const QStringList& runs, int partition, int partitions, Sink&& sink)
+{
+    std::vector<std::unique_ptr<RunReader>> readers;
+    typedef std::pair<uint64_t, size_t> Head;
+    std::priority_queue<Head, std::vector<Head>, std::greater<Head>> heads;
+    for(const auto& run : runs)
+    {
+        readers.emplace_back(new RunReader());
+        auto& reader = *readers.back();
+        if(!reader.Open(run, partition, partitions))
+            return false;
+        if(reader.Next())
+            heads.push({reader.pair, readers.size() - 1});
+        else if(reader.broken)
+            return false;
+    }
+    while(!heads.empty())
+    {
+        const auto pair = heads.top().first;
+        uint64_t count = 0;
+        while(!heads.empty() && heads.top().first == pair)
+        {
+            const auto index = heads.top().second;
+            heads.pop();
+            auto& reader = *readers[index];
+            count += reader.count;
+            if(reader.Next())
+                heads.push({reader.pair, index});
+            else if(reader.broken)
+                return false;
+        }
+        sink(pair, count);
+    }
+    return true;
+}
+}
+
+FicCooccurrenceBuilder::FicCooccurrenceBuilder(Options options) : options(options)
+{
+    this->options.pairsPerRun = std::max(1024, options.pairsPerRun);
+    this->options.partitions = std::max(1, options.partitions);
+    this->options.maxRunsPerMerge = std::max(2, options.maxRunsPerMerge);
+}
+
+bool FicCooccurrenceBuilder::Build(const QHash<int, Roaring>& favourites, const Roaring& includedFics)
+{
+    fics = includedFics;
+    runs.clear();
+    runCounter = 0;
+    listCount = 0;
+    pairCount = 0;
+    RemoveFiles();
+    if(!QDir().mkpath(options.folder))
+        return false;
+
+    std::vector<const Roaring*> lists;
+    lists.reserve(static_cast<size_t>(favourites.size()));
+    for(auto i = favourites.cbegin(); i != favourites.cend(); i++)
+        lists.push_back(&i.value());
+    const size_t ficTotal = fics.cardinality();
+
+    // lists with a single fic still count towards how often it's favourited, they just don't have pairs
+    std::vector<char> usedForPairs(lists.size(), 0);
+    std::vector<std::atomic<uint32_t>> counts(ficTotal);
+    std::vector<std::atomic<uint64_t>> pairsAsFirst(ficTotal);
+    std::atomic<qint64> countedLists = 0;
+    auto countWorker = [&](size_t begin, size_t end){
+        std::vector<uint32_t> values;
+        for(auto i = begin; i < end; i++)
+        {
+            const auto list = *lists[i] & fics;
+            const auto size = list.cardinality();
+            if(size == 0 || size > static_cast<uint64_t>(options.maxListSize))
+                continue;
+            countedLists++;
+            usedForPairs[i] = size > 1;
+            values.resize(size);
+            list.toUint32Array(values.data());
+            for(size_t position = 0; position < values.size(); position++)
+            {
+                const auto rank = fics.rank(values[position]) - 1;
+                counts[rank].fetch_add(1, std::memory_order_relaxed);
+                pairsAsFirst[rank].fetch_add(size - 1 - position, std::memory_order_relaxed);
+            }
+        }
+    };
+    TimedAction countAction("Counting fics in favourite lists",[&](){
+        thread_boost::ParallelFor(lists.size(), {options.threads, 64}, countWorker);
+    });
+    countAction.run();
+    listCount = countedLists;
+
+    // pairs belong to the partition of their smaller fic, ranges are split so that every one gets a similar amount of them
+    uint64_t totalPairs = 0;
+    for(const auto& pairs : pairsAsFirst)
+        totalPairs += pairs;
+    partitionStarts.assign(1, 0);
+    uint64_t accumulated = 0;
+    const auto partitions = static_cast<uint64_t>(options.partitions);
+    for(size_t rank = 0; totalPairs > 0 && rank + 1 < ficTotal && partitionStarts.size() < partitions; rank++)
+    {
+        accumulated += pairsAsFirst[rank];
+        uint32_t next = 0;
+        if(accumulated*partitions >= totalPairs*partitionStarts.size() && fics.select(static_cast<uint32_t>(rank + 1), &next))
+            partitionStarts.push_back(next);
+    }
+    listCounts.resize(ficTotal);
+    for(size_t rank = 0; rank < ficTotal; rank++)
+        listCounts[rank] = counts[rank];
+    QLOG_INFO() << "co-occurrence of fics: " << ficTotal << " in lists: " << listCount << " will emit pairs: " << totalPairs
+                << " in partitions: " << partitionStarts.size();
+
+    const size_t runSize = static_cast<size_t>(options.pairsPerRun);
+    std::atomic<bool> failed = false;
+    struct PairBuffer{
+        std::vector<uint64_t> pairs;
+    };
+    auto pairWorker = [&](PairBuffer& buffer, size_t begin, size_t end){
+        std::vector<uint32_t> values;
+        buffer.pairs.reserve(runSize);
+        for(auto i = begin; i < end && !failed; i++)
+        {
+            if(!usedForPairs[i])
+                continue;
+            const auto list = *lists[i] & fics;
+            values.resize(list.cardinality());
+            list.toUint32Array(values.data());
+            // values are sorted, so the first fic of every pair is the smaller one
+            for(size_t first = 0; first < values.size(); first++)
+            {
+                const uint64_t high = static_cast<uint64_t>(values[first]) << 32;
+                for(size_t second = first + 1; second < values.size(); second++)
+                {
+                    buffer.pairs.push_back(high | values[second]);
+                    if(buffer.pairs.size() == runSize && !WriteRun(buffer.pairs))
+                    {
+                        failed = true;
+                        return;
+                    }
+                }
+            }
+        }
+    };
+    TimedAction pairsAction("Writing fic pair runs",[&](){
+        auto buffers = thread_boost::ParallelReduce<PairBuffer>(lists.size(), {options.threads, 16}, pairWorker);
+        thread_boost::ParallelFor(buffers.size(), {options.threads, 1}, [&](size_t begin, size_t end){
+            for(auto i = begin; i < end; i++)
+                if(!buffers[i].pairs.empty() && !WriteRun(buffers[i].pairs))
+                    failed = true;
+        });
+    });
+    pairsAction.run();
+    if(failed)
+    {
+        QLOG_ERROR() << "couldn't write fic pair runs into: " << options.folder;
+        RemoveFiles();
+        return false;
+    }
+
+    bool built = false;
+    TimedAction mergeAction("Merging fic pair runs",[&](){
+        built = MergeRuns() && WriteMatrix();
+    });
+    mergeAction.run();
+    for(const auto& run : std::as_const(runs))
+        QFile::remove(run);
+    if(!built)
+    {
+        QLOG_ERROR() << "couldn't merge fic pair runs in: " << options.folder;
+        RemoveFiles();
+        return false;
+    }
+    QLOG_INFO() << "co-occurrence matrix contains pairs: " << pairCount;
+    return true;
+}
+
+bool FicCooccurrenceBuilder::WriteRun(std::vector<uint64_t>& pairs)
+{
+    std::sort(pairs.begin(), pairs.end());
+    RunWriter writer;
+    const auto fileName = NextRunName();
+    bool written = writer.Open(fileName, static_cast<int>(partitionStarts.size()));
+    size_t partition = 0;
+    writer.StartPartition(0);
+    for(size_t i = 0; written && i < pairs.size();)
+    {
+        const auto pair = pairs[i];
+        size_t next = i + 1;
+        while(next < pairs.size() && pairs[next] == pair)
+            next++;
+        const auto fic1 = static_cast<uint32_t>(pair >> 32);
+        if(partition + 1 < partitionStarts.size() && fic1 >= partitionStarts[partition + 1])
+        {
+            while(partition + 1 < partitionStarts.size() && fic1 >= partitionStarts[partition + 1])
+                partition++;
+            writer.StartPartition(static_cast<int>(partition));
+        }
+        writer.Append(pair, next - i);
+        i = next;
+    }
+    written = writer.Finish() && written;
+    // keeps the capacity, the buffer is filled again right away
+    pairs.clear();
+    QMutexLocker locker(&runLock);
+    runs.push_back(fileName);
+    return written;
+}
+
+bool FicCooccurrenceBuilder::MergeRuns()
+{
+    // every merge keeps a file open per run, so too many of them are merged into fewer runs first
+    const int partitions = static_cast<int>(partitionStarts.size());
+    while(runs.size() > options.maxRunsPerMerge)
+    {
+        QVector<QStringList> groups;
+        for(int i = 0; i < runs.size(); i += options.maxRunsPerMerge)
+            groups.push_back(runs.mid(i, options.maxRunsPerMerge));
+        QStringList merged;
+        for(int i = 0; i < groups.size(); i++)
+            merged.push_back(NextRunName());
+        std::atomic<bool> failed = false;
+        thread_boost::ParallelFor(static_cast<size_t>(groups.size()), {options.threads, 1}, [&](size_t begin, size_t end){
+            for(auto group = begin; group < end && !failed; group++)
+            {
+                RunWriter writer;
+                bool written = writer.Open(merged[static_cast<int>(group)], partitions);
+                for(int partition = 0; written && partition < partitions; partition++)
+                {
+                    writer.StartPartition(partition);
+                    written = MergePartition(groups[static_cast<int>(group)], partition, partitions, [&](uint64_t pair, uint64_t count){
+                        writer.Append(pair, count);
+                    });
+                }
+                if(!writer.Finish() || !written)
+                    failed = true;
+            }
+        });
+        for(const auto& run : std::as_const(runs))
+            QFile::remove(run);
+        runs = merged;
+        if(failed)
+            return false;
+    }
+    return true;
+}
+
+bool FicCooccurrenceBuilder::WriteMatrix()
+{
+    const int partitions = static_cast<int>(partitionStarts.size());
+    const uint32_t minMeetings = static_cast<uint32_t>(std::max(1, options.minMeetings));
+    std::atomic<bool> failed = false;
+    std::atomic<qint64> writtenPairs = 0;
+    auto listCountForFic = [&](uint32_t fic){
+        return listCounts[fics.rank(fic) - 1];
+    };
+    thread_boost::ParallelFor(static_cast<size_t>(partitions), {options.threads, 1}, [&](size_t begin, size_t end){
+        for(auto partition = begin; partition < end && !failed; partition++)
+        {
+            MatrixWriter writer;
+            bool written = writer.Open(FicCooccurrenceMatrix::PartitionName(options.folder, static_cast<int>(partition)), static_cast<int>(partition));
+            qint64 partitionPairs = 0;
+            written = written && MergePartition(runs, static_cast<int>(partition), partitions, [&](uint64_t pair, uint64_t count){
+                if(count < minMeetings)
+                    return;
+                FicCooccurrence entry;
+                entry.fic1 = static_cast<uint32_t>(pair >> 32);
+                entry.fic2 = static_cast<uint32_t>(pair);
+                entry.meetingCount = static_cast<uint32_t>(count);
+                CalculateWeights(entry, listCountForFic(entry.fic1), listCountForFic(entry.fic2));
+                writer.Append(entry);
+                partitionPairs++;
+            });
+            if(!writer.Finish() || !written)
+                failed = true;
+            writtenPairs += partitionPairs;
+        }
+    });
+    if(failed)
+        return false;
+    pairCount = writtenPairs;
+
+    QFile countsFile(FicCooccurrenceMatrix::ListCountsName(options.folder));
+    if(!countsFile.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        return false;
+    std::vector<uint32_t> ficIds(listCounts.size());
+    fics.toUint32Array(ficIds.data());
+    CooccurrenceCountsHeader header;
+    header.ficCount = static_cast<uint32_t>(ficIds.size());
+    const qint64 arraySize = static_cast<qint64>(ficIds.size()*sizeof(uint32_t));
+    bool written = countsFile.write(reinterpret_cast<const char*>(&header), sizeof(header)) == sizeof(header);
+    written = written && countsFile.write(reinterpret_cast<const char*>(ficIds.data()), arraySize) == arraySize;
+    written = written && countsFile.write(reinterpret_cast<const char*>(listCounts.data()), arraySize) == arraySize;
+    countsFile.close();
+    if(!written)
+        return false;
+
+    // the matrix is only read once the manifest is there
+    QSettings manifest(FicCooccurrenceMatrix::ManifestName(options.folder), QSettings::IniFormat);
+    manifest.setValue("Cooccurrence/version", cooccurrenceVersion);
+    manifest.setValue("Cooccurrence/partitions", partitions);
+    manifest.setValue("Cooccurrence/lists", listCount);
+    manifest.setValue("Cooccurrence/pairs", pairCount);
+    manifest.setValue("Cooccurrence/minMeetings", minMeetings);
+    manifest.setValue("Cooccurrence/maxListSize", options.maxListSize);
+    manifest.sync();
+    return manifest.status() == QSettings::NoError;
+}
+
+QString FicCooccurrenceBuilder::NextRunName()
+{
+    QMutexLocker locker(&runLock);
+    return QString("%1/fic_cooccurrence_run_%2.bin").arg(options.folder, QString::number(runCounter++));
+}
+
+void FicCooccurrenceBuilder::RemoveFiles() const
+{
+    // manifest goes first so that nothing reads a matrix that's half removed
+    QFile::remove(FicCooccurrenceMatrix::ManifestName(options.folder));
+    QDir folder(options.folder);
+    for(const auto& file : folder.entryList({"fic_cooccurrence_*.bin"}, QDir::Files))
+        folder.remove(file);
+}
+
+QString FicCooccurrenceMatrix::ManifestName(QString folder)
+{
+    return folder + "/fic_cooccurrence.ini";
+}
+
+QString FicCooccurrenceMatrix::PartitionName(QString folder, int partition)
+{
+    return QString("%1/fic_cooccurrence_%2.bin").arg(folder, QString::number(partition));
+}
+
+QString FicCooccurrenceMatrix::ListCountsName(QString folder)
+{
+    return folder + "/fic_cooccurrence_fics.bin";
+}
+
+bool FicCooccurrenceMatrix::Open(QString folder)
+{
+    this->folder = folder;
+    partitions = 0;
+    ficIds.clear();
+    listCounts.clear();
+    if(!QFile::exists(ManifestName(folder)))
+        return false;
+    QSettings manifest(ManifestName(folder), QSettings::IniFormat);
+    if(manifest.value("Cooccurrence/version", 0).toUInt() != cooccurrenceVersion)
+        return false;
+    listCount = manifest.value("Cooccurrence/lists", 0).toLongLong();
+    pairCount = manifest.value("Cooccurrence/pairs", 0).toLongLong();
+
+    QFile countsFile(ListCountsName(folder));
+    CooccurrenceCountsHeader header;
+    if(!countsFile.open(QIODevice::ReadOnly)
+            || countsFile.read(reinterpret_cast<char*>(&header), sizeof(header)) != sizeof(header)
+            || header.magic != cooccurrenceCountsMagic || header.version != cooccurrenceVersion)
+        return false;
+    ficIds.resize(header.ficCount);
+    listCounts.resize(header.ficCount);
+    const qint64 arraySize = static_cast<qint64>(header.ficCount*sizeof(uint32_t));
+    if(countsFile.read(reinterpret_cast<char*>(ficIds.data()), arraySize) != arraySize
+            || countsFile.read(reinterpret_cast<char*>(listCounts.data()), arraySize) != arraySize)
+    {
+        ficIds.clear();
+        listCounts.clear();
+        return false;
+    }
+    partitions = manifest.value("Cooccurrence/partitions", 0).toInt();
+    return true;
+}
+
+uint32_t FicCooccurrenceMatrix::ListCountForFic(uint32_t fic) const
+{
+    auto it = std::lower_bound(ficIds.cbegin(), ficIds.cend(), fic);
+    if(it == ficIds.cend() || *it != fic)
+        return 0;
+    return listCounts[static_cast<size_t>(it - ficIds.cbegin())];
+}
+
+bool FicCooccurrenceMatrix::ForEachInPartition(int partition, std::function<void(const FicCooccurrence&)> callback) const
+{
+    const auto fileName = PartitionName(folder, partition);
+    QFile file(fileName);
+    CooccurrenceMatrixHeader header;
+    if(partition < 0 || partition >= partitions || !file.open(QIODevice::ReadOnly)
+            || file.read(reinterpret_cast<char*>(&header), sizeof(header)) != sizeof(header)
+            || header.magic != cooccurrenceMatrixMagic || header.version != cooccurrenceVersion
+            || header.partition != static_cast<uint32_t>(partition))
+        return false;
+    ByteSource source;
+    if(!source.Open(fileName, sizeof(header), file.size()))
+        return false;
+    file.close();
+
+    FicCooccurrence pair;
+    uint64_t rowDelta = 0, rowSize = 0, fic2Delta = 0, meetings = 0;
+    while(source.ReadVarint(rowDelta) && source.ReadVarint(rowSize))
+    {
+        if(rowSize == 0)
+            return true;
+        pair.fic1 += static_cast<uint32_t>(rowDelta);
+        pair.fic2 = pair.fic1;
+        for(uint64_t i = 0; i < rowSize; i++)
+        {
+            if(!source.ReadVarint(fic2Delta) || !source.ReadVarint(meetings)
+                    || !source.ReadFloat(pair.attraction) || !source.ReadFloat(pair.repulsion))
+                return false;
+            pair.fic2 += static_cast<uint32_t>(fic2Delta);
+            pair.meetingCount = static_cast<uint32_t>(meetings);
+            callback(pair);
+        }
+    }
+    // the file ended before the closing row
+    return false;
+}
+
+FicWeightResult FicCooccurrenceMatrix::ToWeightResult(const FicCooccurrence& pair) const
+{
+    FicWeightResult result;
+    result.ficId1 = static_cast<int>(pair.fic1);
+    result.ficId2 = static_cast<int>(pair.fic2);
+    result.ficListCount1 = static_cast<int>(ListCountForFic(pair.fic1));
+    result.ficListCount2 = static_cast<int>(ListCountForFic(pair.fic2));
+    result.meetingCount = static_cast<int>(pair.meetingCount);
+    // fandoms aren't known here
+    result.sameFandom = false;
+    result.attraction = pair.attraction;
+    result.repulsion = pair.repulsion;
+    result.finalAttraction = pair.attraction*(1 - pair.repulsion);
+    return result;
+}
+
+}
@@ -0,0 +1,197 @@
+/*
+Flipper is a recommendation and search engine for fanfiction.net
+Copyright (C) 2017-2020  Marchenko Nikolai
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+#include "include/data_code/fic_neighbour_index.h"
+#include "include/data_code/rec_calc_data.h"
+#include "include/threaded_data/parallel_for.h"
+#include "include/core/top_k.h"
+#include "include/timeutils.h"
+#include "logger/QsLog.h"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+namespace core{
+
+static constexpr uint32_t neighbourIndexMagic = 0x464e4958;
+static constexpr uint32_t neighbourIndexVersion = 1;
+
+// file layout: header, sorted fic ids, ficCount + 1 offsets into entries, entries
+struct NeighbourIndexHeader{
+    uint32_t magic = neighbourIndexMagic;
+    uint32_t version = neighbourIndexVersion;
+    uint32_t neighbourLimit = 0;
+    uint32_t ficCount = 0;
+    uint64_t fingerprint = 0;
+    uint64_t entryCount = 0;
+};
+
+bool FicNeighbourIndex::Build(const DataHolder& data, QString fileName, BuildOptions options)
+{
+    const auto& ordinals = data.ficOrdinals;
+    const size_t ficTotal = ordinals.Size();
+    const size_t limit = static_cast<size_t>(std::max(1, options.neighbours));
+
+    Roaring eligibleAuthors;
+    for(auto i = data.faves.cbegin(); i != data.faves.cend(); i++)
+    {
+        const auto size = i.value().cardinality();
+        if(size >= static_cast<uint64_t>(options.minListSize) && size <= static_cast<uint64_t>(options.maxListSize))
+            eligibleAuthors.add(static_cast<uint32_t>(i.key()));
+    }
+
+    // indexed by fic ordinal, every worker fills its own fics
+    std::vector<std::vector<Neighbour>> neighbours(ficTotal);
+    struct Counter{
+        std::vector<uint32_t> counts;
+        std::vector<uint32_t> touched;
+    };
+    auto worker = [&](Counter& counter, size_t begin, size_t end){
+        if(counter.counts.empty())
+            counter.counts.resize(ficTotal, 0);
+        for(auto ordinal = begin; ordinal < end; ordinal++)
+        {
+            const auto fic = ordinals.ficForOrdinal[ordinal];
+            auto it = data.favouritesByFic.constFind(static_cast<int>(fic));
+            if(it == data.favouritesByFic.cend())
+                continue;
+            for(auto author : it.value())
+            {
+                if(!eligibleAuthors.contains(author))
+                    continue;
+                auto itFaves = data.faves.constFind(static_cast<int>(author));
+                if(itFaves == data.faves.cend())
+                    continue;
+                for(auto otherFic : itFaves.value())
+                {
+                    const auto otherOrdinal = ordinals.OrdinalForFic(otherFic);
+                    if(otherOrdinal == FicOrdinals::invalid || otherOrdinal == ordinal)
+                        continue;
+                    if(counter.counts[otherOrdinal]++ == 0)
+                        counter.touched.push_back(otherOrdinal);
+                }
+            }
+            TopK best(limit);
+            for(auto otherOrdinal : counter.touched)
+            {
+                best.Push(static_cast<int>(counter.counts[otherOrdinal]), static_cast<int>(ordinals.ficForOrdinal[otherOrdinal]));
+                counter.counts[otherOrdinal] = 0;
+            }
+            counter.touched.clear();
+            auto& target = neighbours[ordinal];
+            for(const auto& neighbour : best.Take())
+                target.push_back({static_cast<uint32_t>(neighbour.id), static_cast<uint32_t>(neighbour.score)});
+        }
+    };
+    TimedAction action("Building fic neighbour index",[&](){
+        thread_boost::ParallelReduce<Counter>(ficTotal, {0, 256}, worker);
+    });
+    action.run();
+
+    NeighbourIndexHeader header;
+    header.neighbourLimit = static_cast<uint32_t>(limit);
+    header.fingerprint = FavouritesSketch::Fingerprint(data.faves);
+    std::vector<uint32_t> fics;
+    std::vector<uint32_t> offsets{0};
+    for(size_t ordinal = 0; ordinal < ficTotal; ordinal++)
+    {
+        if(neighbours[ordinal].empty())
+            continue;
+        fics.push_back(ordinals.ficForOrdinal[ordinal]);
+        offsets.push_back(offsets.back() + static_cast<uint32_t>(neighbours[ordinal].size()));
+    }
+    header.ficCount = static_cast<uint32_t>(fics.size());
+    header.entryCount = offsets.back();
+
+    // snapshots that are still in use keep the old file mapped, so it's replaced instead of being rewritten
+    QFile output(fileName + ".tmp");
+    if(!output.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        return false;
+    bool written = output.write(reinterpret_cast<const char*>(&header), sizeof(header)) == sizeof(header);
+    written = written && output.write(reinterpret_cast<const char*>(fics.data()), static_cast<qint64>(fics.size()*sizeof(uint32_t))) >= 0;
+    written = written && output.write(reinterpret_cast<const char*>(offsets.data()), static_cast<qint64>(offsets.size()*sizeof(uint32_t))) >= 0;
+    for(const auto& ficNeighbours : neighbours)
+    {
+        if(!written)
+            break;
+        written = output.write(reinterpret_cast<const char*>(ficNeighbours.data()), static_cast<qint64>(ficNeighbours.size()*sizeof(Neighbour))) >= 0;
+    }
+    output.close();
+    QLOG_INFO() << "fic neighbour index contains fics: " << header.ficCount << " entries: " << header.entryCount;
+    if(!written)
+        return false;
+    QFile::remove(fileName);
+    return QFile::rename(fileName + ".tmp", fileName);
+}
+
+bool FicNeighbourIndex::Open(QString fileName, uint64_t favouritesFingerprint)
+{
+    Close();
+    file.setFileName(fileName);
+    if(!file.open(QIODevice::ReadOnly) || file.size() < static_cast<qint64>(sizeof(NeighbourIndexHeader)))
+    {
+        Close();
+        return false;
+    }
+    const uchar* mapped = file.map(0, file.size());
+    if(!mapped)
+    {
+        Close();
+        return false;
+    }
+    NeighbourIndexHeader header;
+    memcpy(&header, mapped, sizeof(header));
+    const uint64_t expectedSize = sizeof(header) + (2*static_cast<uint64_t>(header.ficCount) + 1)*sizeof(uint32_t)
+            + header.entryCount*sizeof(Neighbour);
+    if(header.magic != neighbourIndexMagic || header.version != neighbourIndexVersion
+            || header.fingerprint != favouritesFingerprint || expectedSize != static_cast<uint64_t>(file.size()))
+    {
+        Close();
+        return false;
+    }
+    neighbourLimit = static_cast<int>(header.neighbourLimit);
+    ficCount = header.ficCount;
+    fics = reinterpret_cast<const uint32_t*>(mapped + sizeof(header));
+    offsets = fics + ficCount;
+    entries = reinterpret_cast<const Neighbour*>(offsets + ficCount + 1);
+    return true;
+}
+
+void FicNeighbourIndex::Close()
+{
+    // closing the file also unmaps it
+    file.close();
+    neighbourLimit = 0;
+    ficCount = 0;
+    fics = nullptr;
+    offsets = nullptr;
+    entries = nullptr;
+}
+
+FicNeighbourIndex::Range FicNeighbourIndex::NeighboursOf(uint32_t fic) const
+{
+    if(!IsReady())
+        return {nullptr, nullptr};
+    auto it = std::lower_bound(fics, fics + ficCount, fic);
+    if(it == fics + ficCount || *it != fic)
+        return {nullptr, nullptr};
+    const auto position = it - fics;
+    return {entries + offsets[position], entries + offsets[position + 1]};
+}
+
+}
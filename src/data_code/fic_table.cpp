@@ -0,0 +1,231 @@
+/*
+Flipper is a recommendation and search engine for fanfiction.net
+Copyright (C) 2017-2020  Marchenko Nikolai
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+#include "include/data_code/fic_table.h"
+#include "include/Interfaces/genres.h"
+#include "logger/QsLog.h"
+
+#include <algorithm>
+
+namespace core{
+
+void FicTable::Clear()
+{
+    *this = FicTable();
+}
+
+uint32_t FicTable::MaskForGenres(const QStringList& genres)
+{
+    uint32_t mask = 0;
+    for(const auto& genre : genres)
+    {
+        auto index = genreNames.indexOf(genre);
+        if(index < 0)
+        {
+            if(genreNames.size() >= maxGenres)
+            {
+                QLOG_WARN() << "fic table has no room for genre: " << genre;
+                continue;
+            }
+            genreNames.push_back(genre);
+            index = genreNames.size() - 1;
+        }
+        mask |= 1u << index;
+    }
+    return mask;
+}
+
+// columns of a table that is being filled, rows have to be appended in the order of fic ids
+struct FicTable::Columns{
+    void Reserve(size_t size, int maxId){
+        for(auto* column : {&ids, &authorIds, &favCounts, &sumAuthorFaves, &reviewCounts, &wordCounts, &chapterCounts, &published, &updated})
+            column->reserve(size);
+        flags.reserve(size);
+        genreMasks.reserve(size);
+        fandomOffsets.reserve(size + 1);
+        fandomOffsets.push_back(0);
+        if(maxId >= 0)
+            ordinalForFic.assign(static_cast<size_t>(maxId) + 1, invalid);
+    }
+    void Append(const FanficDataForRecommendationCreation& fic, uint32_t genreMask){
+        ordinalForFic[static_cast<size_t>(fic.id)] = static_cast<uint32_t>(ids.size());
+        ids.push_back(fic.id);
+        uint8_t ficFlags = 0;
+        if(fic.complete)
+            ficFlags |= ff_complete;
+        if(fic.slash)
+            ficFlags |= ff_slash;
+        if(fic.dead)
+            ficFlags |= ff_dead;
+        if(fic.sameLanguage)
+            ficFlags |= ff_sameLanguage;
+        if(fic.adult)
+            ficFlags |= ff_adult;
+        flags.push_back(ficFlags);
+        authorIds.push_back(fic.authorId);
+        favCounts.push_back(fic.favCount);
+        sumAuthorFaves.push_back(fic.sumAuthorFaves);
+        reviewCounts.push_back(fic.reviewCount);
+        wordCounts.push_back(fic.wordCount);
+        chapterCounts.push_back(fic.chapterCount);
+        published.push_back(DayFromDate(fic.published));
+        updated.push_back(DayFromDate(fic.updated));
+        for(auto fandom : fic.fandoms)
+            fandoms.push_back(fandom);
+        fandomOffsets.push_back(static_cast<uint32_t>(fandoms.size()));
+        genreMasks.push_back(genreMask);
+    }
+    // the row is copied as is, so the source has to share genre names with the table being filled
+    void Append(const FicTable& source, uint32_t ordinal){
+        ordinalForFic[static_cast<size_t>(source.ids[ordinal])] = static_cast<uint32_t>(ids.size());
+        ids.push_back(source.ids[ordinal]);
+        flags.push_back(source.flags[ordinal]);
+        authorIds.push_back(source.authorIds[ordinal]);
+        favCounts.push_back(source.favCounts[ordinal]);
+        sumAuthorFaves.push_back(source.sumAuthorFaves[ordinal]);
+        reviewCounts.push_back(source.reviewCounts[ordinal]);
+        wordCounts.push_back(source.wordCounts[ordinal]);
+        chapterCounts.push_back(source.chapterCounts[ordinal]);
+        published.push_back(source.published[ordinal]);
+        updated.push_back(source.updated[ordinal]);
+        for(auto fandom : source.Fandoms(ordinal))
+            fandoms.push_back(fandom);
+        fandomOffsets.push_back(static_cast<uint32_t>(fandoms.size()));
+        genreMasks.push_back(source.genreMasks[ordinal]);
+    }
+    void MoveInto(FicTable& table){
+        fandoms.shrink_to_fit();
+        table.ordinalForFic.Assign(std::move(ordinalForFic));
+        table.ids.Assign(std::move(ids));
+        table.flags.Assign(std::move(flags));
+        table.authorIds.Assign(std::move(authorIds));
+        table.favCounts.Assign(std::move(favCounts));
+        table.sumAuthorFaves.Assign(std::move(sumAuthorFaves));
+        table.reviewCounts.Assign(std::move(reviewCounts));
+        table.wordCounts.Assign(std::move(wordCounts));
+        table.chapterCounts.Assign(std::move(chapterCounts));
+        table.published.Assign(std::move(published));
+        table.updated.Assign(std::move(updated));
+        table.fandomOffsets.Assign(std::move(fandomOffsets));
+        table.fandoms.Assign(std::move(fandoms));
+        table.genreMasks.Assign(std::move(genreMasks));
+    }
+
+    std::vector<int32_t> ids, authorIds, favCounts, sumAuthorFaves, reviewCounts, wordCounts, chapterCounts, published, updated, fandoms;
+    std::vector<uint32_t> ordinalForFic, fandomOffsets, genreMasks;
+    std::vector<uint8_t> flags;
+};
+
+static std::vector<const FanficDataForRecommendationCreation*> SortedById(const QHash<int, FicWeightPtr>& fics)
+{
+    std::vector<const FanficDataForRecommendationCreation*> sorted;
+    sorted.reserve(static_cast<size_t>(fics.size()));
+    for(const auto& fic : fics)
+        if(fic && fic->id >= 0)
+            sorted.push_back(fic.data());
+    std::sort(sorted.begin(), sorted.end(), [](const auto* first, const auto* second){
+        return first->id < second->id;
+    });
+    return sorted;
+}
+
+void FicTable::Build(const QHash<int, FicWeightPtr>& fics)
+{
+    Clear();
+    const auto sorted = SortedById(fics);
+    Columns columns;
+    columns.Reserve(sorted.size(), sorted.empty() ? -1 : sorted.back()->id);
+    interfaces::GenreConverter converter;
+    for(const auto* fic : sorted)
+        columns.Append(*fic, MaskForGenres(fic->genres.isEmpty() ? converter.GetFFNGenreList(fic->genreString) : fic->genres));
+    columns.MoveInto(*this);
+    QLOG_INFO() << "fic table contains fics: " << ids.size() << " genres: " << genreNames.size();
+}
+
+FicTable FicTable::Updated(const QHash<int, FicWeightPtr>& changed) const
+{
+    const auto sorted = SortedById(changed);
+    size_t added = 0;
+    for(const auto* fic : sorted)
+        if(!Contains(fic->id))
+            added++;
+    int maxId = Size() > 0 ? ids[Size() - 1] : -1;
+    if(!sorted.empty())
+        maxId = std::max(maxId, sorted.back()->id);
+
+    // genre names only grow, so masks of the rows that are kept stay valid
+    FicTable result;
+    result.genreNames = genreNames;
+    Columns columns;
+    columns.Reserve(Size() + added, maxId);
+    interfaces::GenreConverter converter;
+    uint32_t ordinal = 0;
+    const auto size = static_cast<uint32_t>(Size());
+    for(const auto* fic : sorted)
+    {
+        for(; ordinal < size && ids[ordinal] < fic->id; ordinal++)
+            columns.Append(*this, ordinal);
+        if(ordinal < size && ids[ordinal] == fic->id)
+            ordinal++;
+        columns.Append(*fic, result.MaskForGenres(fic->genres.isEmpty() ? converter.GetFFNGenreList(fic->genreString) : fic->genres));
+    }
+    for(; ordinal < size; ordinal++)
+        columns.Append(*this, ordinal);
+    columns.MoveInto(result);
+    QLOG_INFO() << "fic table updated with fics: " << sorted.size() << " new: " << added;
+    return result;
+}
+
+QStringList FicTable::Genres(uint32_t ordinal) const
+{
+    QStringList result;
+    const auto mask = genreMasks[ordinal];
+    for(int i = 0; i < genreNames.size(); i++)
+        if(mask & (1u << i))
+            result.push_back(genreNames[i]);
+    return result;
+}
+
+FicWeightPtr FicTable::Fic(int fic) const
+{
+    const auto ordinal = OrdinalForFic(fic);
+    if(ordinal == invalid)
+        return {};
+    FicWeightPtr result(new FanficDataForRecommendationCreation());
+    result->id = ids[ordinal];
+    result->complete = HasFlag(ordinal, ff_complete);
+    result->slash = HasFlag(ordinal, ff_slash);
+    result->dead = HasFlag(ordinal, ff_dead);
+    result->sameLanguage = HasFlag(ordinal, ff_sameLanguage);
+    result->adult = HasFlag(ordinal, ff_adult);
+    result->authorId = authorIds[ordinal];
+    result->favCount = favCounts[ordinal];
+    result->sumAuthorFaves = sumAuthorFaves[ordinal];
+    result->reviewCount = reviewCounts[ordinal];
+    result->wordCount = wordCounts[ordinal];
+    result->chapterCount = chapterCounts[ordinal];
+    result->published = Published(ordinal);
+    result->updated = Updated(ordinal);
+    for(auto fandom : Fandoms(ordinal))
+        result->fandoms.push_back(fandom);
+    result->genres = Genres(ordinal);
+    // Hurt/Comfort is recognized as a whole when the string is split again
+    result->genreString = result->genres.join("/");
+    return result;
+}
+
+}
@@ -16,9 +16,12 @@ You should have received a copy of the GNU General Public License
 along with this program.  If not, see <http://www.gnu.org/licenses/>
 */
 #include "include/data_code/rec_calc_data.h"
+#include "include/timeutils.h"
 
 #include <QSettings>
 #include <QFileInfo>
+#include <algorithm>
+#include <cmath>
 
 
 
@@ -44,6 +47,167 @@ auto lambda = [](DataHolder* holder, QString storageFolder, QString fileBase, au
     auto[data, interface] = get<X>(); \
     lambda(this,storageFolder, QString::fromStdString(DataHolderInfo<X>::fileBase()), data.get(),interface, DataHolderInfo<X>::loadFunc(),\
     std::bind(&DataHolder::SaveData<X>, this, std::placeholders::_1));\
+    BuildDerivedData<X>(storageFolder); \
+}
+
+template <>
+void DataHolder::BuildDerivedData<rdt_favourites>(QString storageFolder){
+    TimedAction action("Building fic to favourites index",[&](){
+        favouritesByFic.clear();
+        for(auto i = faves.cbegin(); i != faves.cend(); i++)
+        {
+            const auto author = static_cast<uint32_t>(i.key());
+            for(auto fic : i.value())
+                favouritesByFic[static_cast<int>(fic)].add(author);
+        }
+        for(auto& authors : favouritesByFic)
+            authors.runOptimize();
+        ficOrdinals.Build(favouritesByFic);
+        authorOrdinals.Build(faves);
+    });
+    action.run();
+    QLOG_INFO() << "fic to favourites index contains fics: " << favouritesByFic.size();
+
+    // the sketch takes an entry per author in every band, it's only worth keeping when lists use it
+    QSettings settings(settingsFile, QSettings::IniFormat);
+    if(!settings.value("Settings/approximateCandidatesForLimitedLists", false).toBool())
+    {
+        favouritesSketch.Clear();
+        return;
+    }
+    const int rowsPerBand = settings.value("Settings/minhashRowsPerBand", 2).toInt();
+    TimedAction sketchAction("Preparing favourites sketch",[&](){
+        if(favouritesSketch.Load(storageFolder, faves, rowsPerBand))
+            return;
+        favouritesSketch.Build(faves, rowsPerBand);
+        favouritesSketch.Save(storageFolder);
+    });
+    sketchAction.run();
+}
+
+template <>
+void DataHolder::BuildDerivedData<rdt_fics>(QString){
+    // a table read from the server snapshot arrives without the loaded hash
+    if(!fics.isEmpty() || ficTable.Size() == 0)
+    {
+        TimedAction action("Building fic table",[&](){
+            ficTable.Build(fics);
+            fics.clear();
+            fics.squeeze();
+        });
+        action.run();
+    }
+
+    TimedAction fandomAction("Building fandom to fics index",[&](){
+        ficsByFandom.clear();
+        for(uint32_t ordinal = 0; ordinal < ficTable.Size(); ordinal++)
+        {
+            const auto fic = static_cast<uint32_t>(ficTable.Id(ordinal));
+            for(auto fandom : ficTable.Fandoms(ordinal))
+                ficsByFandom[fandom].add(fic);
+        }
+        for(auto& fandomFics : ficsByFandom)
+            fandomFics.runOptimize();
+    });
+    fandomAction.run();
+    QLOG_INFO() << "fandom to fics index contains fandoms: " << ficsByFandom.size();
+}
+
+template <>
+void DataHolder::BuildDerivedData<rdt_author_mood_distribution>(QString){
+    authorMoods.Build(authorMoodDistributions);
+}
+
+AuthorMoodMatrix::MoodVector AuthorMoodMatrix::ReadMoods(const genre_stats::ListMoodData& data)
+{
+    return {data.strengthNeutral, data.strengthFunny, data.strengthShocky, data.strengthFlirty,
+                data.strengthDramatic, data.strengthHurty, data.strengthBondy};
+}
+
+void AuthorMoodMatrix::Build(const AuthorMoodDistributions& moods)
+{
+    authorForRow.clear();
+    authorForRow.reserve(moods.size());
+    for(auto i = moods.cbegin(); i != moods.cend(); i++)
+        authorForRow.push_back(i.key());
+    std::sort(authorForRow.begin(), authorForRow.end());
+
+    rowForAuthor.clear();
+    if(!authorForRow.empty())
+        rowForAuthor.resize(static_cast<size_t>(authorForRow.back()) + 1, invalid);
+    const size_t blocks = (authorForRow.size() + blockSize - 1)/blockSize;
+    for(auto& column : columns)
+        column.assign(blocks, Block{{}});
+
+    for(uint32_t row = 0; row < authorForRow.size(); row++)
+    {
+        rowForAuthor[authorForRow[row]] = row;
+        const auto values = ReadMoods(moods.value(authorForRow[row]));
+        for(int mood = 0; mood < moodCount; mood++)
+            columns[mood][row/blockSize].values[row%blockSize] = values[mood];
+    }
+}
+
+void AuthorMoodMatrix::Distances(const MoodVector& user, float* neutral, float* touchy) const
+{
+    // fixed size inner loops over aligned blocks, the compiler turns every mood into a couple of vector ops
+    const size_t blocks = BlockCount();
+    for(size_t block = 0; block < blocks; block++)
+    {
+        alignas(32) float touchyBlock[blockSize] = {};
+        for(int mood = 2; mood < moodCount; mood++)
+        {
+            const auto& values = columns[mood][block].values;
+            for(int i = 0; i < blockSize; i++)
+                touchyBlock[i] += std::abs(values[i] - user[mood]);
+        }
+        alignas(32) float neutralBlock[blockSize];
+        for(int i = 0; i < blockSize; i++)
+            neutralBlock[i] = touchyBlock[i];
+        for(int mood = 0; mood < 2; mood++)
+        {
+            const auto& values = columns[mood][block].values;
+            for(int i = 0; i < blockSize; i++)
+                neutralBlock[i] += std::abs(values[i] - user[mood]);
+        }
+        for(int i = 0; i < blockSize; i++)
+        {
+            touchy[block*blockSize + i] = touchyBlock[i];
+            neutral[block*blockSize + i] = neutralBlock[i];
+        }
+    }
+}
+
+void FicOrdinals::Build(const QHash<int, Roaring>& favouritesByFic)
+{
+    ficForOrdinal.clear();
+    ficForOrdinal.reserve(favouritesByFic.size());
+    for(auto i = favouritesByFic.cbegin(); i != favouritesByFic.cend(); i++)
+        ficForOrdinal.push_back(static_cast<uint32_t>(i.key()));
+    std::sort(ficForOrdinal.begin(), ficForOrdinal.end());
+
+    ordinalForFic.clear();
+    if(ficForOrdinal.empty())
+        return;
+    ordinalForFic.resize(static_cast<size_t>(ficForOrdinal.back()) + 1, invalid);
+    for(uint32_t ordinal = 0; ordinal < ficForOrdinal.size(); ordinal++)
+        ordinalForFic[ficForOrdinal[ordinal]] = ordinal;
+}
+
+void AuthorOrdinals::Build(const QHash<int, Roaring>& faves)
+{
+    authorForOrdinal.clear();
+    authorForOrdinal.reserve(faves.size());
+    for(auto i = faves.cbegin(); i != faves.cend(); i++)
+        authorForOrdinal.push_back(static_cast<uint32_t>(i.key()));
+    std::sort(authorForOrdinal.begin(), authorForOrdinal.end());
+
+    ordinalForAuthor.clear();
+    if(authorForOrdinal.empty())
+        return;
+    ordinalForAuthor.resize(static_cast<size_t>(authorForOrdinal.back()) + 1, invalid);
+    for(uint32_t ordinal = 0; ordinal < authorForOrdinal.size(); ordinal++)
+        ordinalForAuthor[authorForOrdinal[ordinal]] = ordinal;
 }
 
 DISPATCH(rdt_favourites)
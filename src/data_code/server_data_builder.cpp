@@ -0,0 +1,314 @@
+/*
+Flipper is a recommendation and search engine for fanfiction.net
+Copyright (C) 2017-2020  Marchenko Nikolai
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+#include "include/data_code/server_data_builder.h"
+#include "include/data_code/server_snapshot.h"
+#include "include/data_code/server_data_delta.h"
+#include "include/data_code/rec_calc_data.h"
+#include "include/tasks/author_genre_iteration_processor.h"
+#include "include/timeutils.h"
+#include "logger/QsLog.h"
+
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSettings>
+
+namespace core{
+
+QString SnapshotManifest::FileName(QString storageFolder)
+{
+    return storageFolder + "/snapshot_manifest.ini";
+}
+
+bool SnapshotManifest::Read(QString storageFolder)
+{
+    if(!QFile::exists(FileName(storageFolder)))
+        return false;
+    QSettings settings(FileName(storageFolder), QSettings::IniFormat);
+    settings.beginGroup("Snapshot");
+    buildId = settings.value("buildId").toString();
+    databaseUpdate = settings.value("databaseUpdate").toString();
+    snapshotFile = settings.value("snapshotFile").toString();
+    neighboursFile = settings.value("neighboursFile").toString();
+    deltas = settings.value("deltas").toStringList();
+    dataTimestamp = QDateTime::fromString(settings.value("dataTimestamp").toString(), Qt::ISODateWithMs);
+    snapshotSize = settings.value("snapshotSize", 0).toULongLong();
+    fics = settings.value("fics", 0).toInt();
+    authors = settings.value("authors", 0).toInt();
+    moods = settings.value("moods", 0).toInt();
+    return !buildId.isEmpty() && !snapshotFile.isEmpty();
+}
+
+bool SnapshotManifest::Write(QString storageFolder) const
+{
+    // readers never see a manifest that is only partially written
+    const auto fileName = FileName(storageFolder);
+    QFile::remove(fileName + ".tmp");
+    {
+        QSettings settings(fileName + ".tmp", QSettings::IniFormat);
+        settings.beginGroup("Snapshot");
+        settings.setValue("buildId", buildId);
+        settings.setValue("databaseUpdate", databaseUpdate);
+        settings.setValue("snapshotFile", snapshotFile);
+        settings.setValue("neighboursFile", neighboursFile);
+        settings.setValue("deltas", deltas);
+        settings.setValue("dataTimestamp", dataTimestamp.toString(Qt::ISODateWithMs));
+        settings.setValue("snapshotSize", static_cast<qulonglong>(snapshotSize));
+        settings.setValue("fics", fics);
+        settings.setValue("authors", authors);
+        settings.setValue("moods", moods);
+        settings.endGroup();
+        settings.sync();
+        if(settings.status() != QSettings::NoError)
+            return false;
+    }
+    QFile::remove(fileName);
+    return QFile::rename(fileName + ".tmp", fileName);
+}
+
+bool SnapshotManifest::Matches(QString storageFolder) const
+{
+    QFileInfo snapshot(storageFolder + "/" + snapshotFile);
+    if(!snapshot.exists() || static_cast<uint64_t>(snapshot.size()) != snapshotSize)
+        return false;
+    for(const auto& delta : deltas)
+        if(!QFile::exists(storageFolder + "/" + delta))
+            return false;
+    return true;
+}
+
+static QSharedPointer<FicNeighbourIndex> OpenNeighbours(const DataHolder& data, QString fileName)
+{
+    QSharedPointer<FicNeighbourIndex> ficNeighbours(new FicNeighbourIndex);
+    if(!ficNeighbours->Open(fileName, FavouritesSketch::Fingerprint(data.faves)))
+        QLOG_WARN() << "fic neighbours are not available: " << fileName;
+    return ficNeighbours;
+}
+
+static void BuildDerivedServerData(DataHolder& data, QString storageFolder)
+{
+    data.BuildDerivedData<rdt_fics>(storageFolder);
+    data.BuildDerivedData<rdt_favourites>(storageFolder);
+    data.BuildDerivedData<rdt_author_mood_distribution>(storageFolder);
+}
+
+static bool ApplyDeltas(DataHolder& data, QString storageFolder, const SnapshotManifest& manifest, int firstDelta)
+{
+    for(int i = firstDelta; i < manifest.deltas.size(); i++)
+    {
+        const auto fileName = storageFolder + "/" + manifest.deltas[i];
+        ServerDataDelta delta;
+        if(!delta.Load(fileName) || delta.baseBuildId != manifest.buildId || delta.sequence != i + 1)
+        {
+            QLOG_WARN() << "server delta can't be applied to snapshot: " << manifest.buildId << " " << fileName;
+            return false;
+        }
+        // span names are kept for the lifetime of the process, the sequence only goes into the log
+        QLOG_INFO() << "applying server delta: " << delta.sequence;
+        TimedAction action("Applying server delta",[&](){
+            delta.Apply(data);
+        });
+        action.run();
+    }
+    return true;
+}
+
+// delta files of earlier snapshots are only removed once nothing refers to them
+static void RemoveUnusedDeltas(QString storageFolder, const SnapshotManifest& manifest)
+{
+    QDir dir(storageFolder);
+    const auto files = dir.entryList({"server_delta_*.bin"}, QDir::Files);
+    for(const auto& file : files)
+        if(!manifest.deltas.contains(file))
+            dir.remove(file);
+}
+
+// writes data as a new snapshot without deltas, builds its neighbours and publishes both with a manifest
+static bool PublishServerData(DataHolder& data, QString storageFolder, SnapshotManifest manifest)
+{
+    QSettings settings(data.settingsFile, QSettings::IniFormat);
+    manifest.buildId = QDateTime::currentDateTimeUtc().toString("yyyyMMdd-hhmmss-zzz");
+    manifest.snapshotFile = "server_snapshot.bin";
+    manifest.neighboursFile = "fic_neighbours.bin";
+    manifest.deltas.clear();
+    const auto snapshotFile = storageFolder + "/" + manifest.snapshotFile;
+    const auto neighboursFile = storageFolder + "/" + manifest.neighboursFile;
+
+    if(!ServerSnapshot::Save(data, snapshotFile))
+    {
+        QLOG_ERROR() << "couldn't write server snapshot into: " << snapshotFile;
+        return false;
+    }
+    FicNeighbourIndex::BuildOptions neighbourOptions;
+    neighbourOptions.neighbours = settings.value("Settings/ficNeighbourCount", 120).toInt();
+    neighbourOptions.minListSize = settings.value("Settings/ficNeighbourMinListSize", neighbourOptions.minListSize).toInt();
+    neighbourOptions.maxListSize = settings.value("Settings/ficNeighbourMaxListSize", neighbourOptions.maxListSize).toInt();
+    if(!FicNeighbourIndex::Build(data, neighboursFile, neighbourOptions))
+        QLOG_WARN() << "couldn't write fic neighbours into: " << neighboursFile;
+    data.ficNeighbours = OpenNeighbours(data, neighboursFile);
+
+    // the written file is read back the way a server will read it before anyone is told about it
+    bool valid = false;
+    {
+        DataHolder check(data.settingsFile, {}, {});
+        valid = ServerSnapshot::Load(check, snapshotFile, true)
+                && check.ficTable.Size() == data.ficTable.Size()
+                && check.faves.size() == data.faves.size()
+                && check.genreComposites.size() == data.genreComposites.size()
+                && check.authorMoodDistributions.size() == data.authorMoodDistributions.size();
+    }
+    if(!valid)
+    {
+        QLOG_ERROR() << "written server snapshot doesn't match the data it was built from: " << snapshotFile;
+        return false;
+    }
+
+    manifest.snapshotSize = static_cast<uint64_t>(QFileInfo(snapshotFile).size());
+    manifest.fics = static_cast<int>(data.ficTable.Size());
+    manifest.authors = data.faves.size();
+    manifest.moods = data.authorMoodDistributions.size();
+    if(!manifest.Write(storageFolder))
+    {
+        QLOG_ERROR() << "couldn't write snapshot manifest into: " << storageFolder;
+        return false;
+    }
+    RemoveUnusedDeltas(storageFolder, manifest);
+    QLOG_INFO() << "built server snapshot: " << manifest.buildId << " fics: " << manifest.fics
+                << " authors: " << manifest.authors << " moods: " << manifest.moods;
+    return true;
+}
+
+bool BuildServerData(DataHolder& data, QString storageFolder, QString databaseUpdate)
+{
+    SnapshotManifest manifest;
+    manifest.databaseUpdate = databaseUpdate;
+    // changes made while the data is being read are collected into the first delta again
+    manifest.dataTimestamp = QDateTime::currentDateTime();
+
+    QLOG_INFO() << "loading fics";
+    data.LoadData<rdt_fics>(storageFolder);
+    QLOG_INFO() << "loading favourites";
+    data.LoadData<rdt_favourites>(storageFolder);
+    QLOG_INFO() << "loading genres composite";
+    data.LoadData<rdt_fic_genres_composite>(storageFolder);
+    QLOG_INFO() << "loading moods";
+    data.LoadData<rdt_author_mood_distribution>(storageFolder);
+
+    if(data.authorMoodDistributions.size() == 0)
+    {
+        QLOG_INFO() << "calculating moods";
+        AuthorGenreIterationProcessor iteratorProcessor;
+        data.LoadData<rdt_author_genre_distribution>(storageFolder);
+        TimedAction action("Calculating author moods",[&](){
+            iteratorProcessor.ReprocessGenreStats(data.genreComposites, data.faves);
+        });
+        action.run();
+        thread_boost::SaveData(storageFolder, "amd", iteratorProcessor.resultingMoodAuthorData);
+        data.authorMoodDistributions = iteratorProcessor.resultingMoodAuthorData;
+        data.BuildDerivedData<rdt_author_mood_distribution>(storageFolder);
+        // only needed to calculate moods
+        data.genres.clear();
+    }
+    return PublishServerData(data, storageFolder, manifest);
+}
+
+bool LoadServerData(DataHolder& data, QString storageFolder, const SnapshotManifest& manifest)
+{
+    QSettings settings(data.settingsFile, QSettings::IniFormat);
+    const auto snapshotFile = storageFolder + "/" + manifest.snapshotFile;
+    if(!ServerSnapshot::Load(data, snapshotFile, settings.value("Settings/verifyServerSnapshot", true).toBool()))
+        return false;
+    // the index belongs to the snapshot's own favourites, with deltas it's only as stale as the latest compaction
+    data.ficNeighbours = OpenNeighbours(data, storageFolder + "/" + manifest.neighboursFile);
+    if(!ApplyDeltas(data, storageFolder, manifest, 0))
+        return false;
+    BuildDerivedServerData(data, storageFolder);
+    QLOG_INFO() << "loaded server snapshot: " << manifest.buildId << " with deltas: " << manifest.deltas.size()
+                << " built for database update: " << manifest.databaseUpdate;
+    return true;
+}
+
+bool ApplyServerDeltas(DataHolder& data, QString storageFolder, const SnapshotManifest& manifest, int firstDelta)
+{
+    if(!ApplyDeltas(data, storageFolder, manifest, firstDelta))
+        return false;
+    BuildDerivedServerData(data, storageFolder);
+    QLOG_INFO() << "applied deltas: " << manifest.deltas.size() - firstDelta << " to server snapshot: " << manifest.buildId
+                << " built for database update: " << manifest.databaseUpdate;
+    return true;
+}
+
+bool BuildServerDelta(DataHolder& data, QString storageFolder, SnapshotManifest& manifest, QString databaseUpdate)
+{
+    // moods of changed authors need the genres of everything before them
+    if(!ServerSnapshot::Load(data, storageFolder + "/" + manifest.snapshotFile, true)
+            || !ApplyDeltas(data, storageFolder, manifest, 0))
+        return false;
+
+    ServerDataDelta delta;
+    delta.baseBuildId = manifest.buildId;
+    delta.sequence = manifest.deltas.size() + 1;
+    delta.Collect(data, manifest.dataTimestamp);
+    if(delta.IsEmpty())
+    {
+        QLOG_INFO() << "nothing has changed since: " << manifest.dataTimestamp;
+        return true;
+    }
+
+    const auto fileName = ServerDataDelta::FileName(manifest.buildId, delta.sequence);
+    if(!delta.Save(storageFolder + "/" + fileName))
+    {
+        QLOG_ERROR() << "couldn't write server delta into: " << fileName;
+        return false;
+    }
+    ServerDataDelta check;
+    if(!check.Load(storageFolder + "/" + fileName) || check.favourites.size() != delta.favourites.size()
+            || check.fics.size() != delta.fics.size() || check.moods.size() != delta.moods.size())
+    {
+        QLOG_ERROR() << "written server delta doesn't match the data it was collected from: " << fileName;
+        return false;
+    }
+    delta.Apply(data);
+
+    manifest.databaseUpdate = databaseUpdate;
+    manifest.dataTimestamp = delta.until;
+    manifest.deltas.push_back(fileName);
+    manifest.fics = static_cast<int>(data.ficTable.Size());
+    manifest.authors = data.faves.size();
+    manifest.moods = data.authorMoodDistributions.size();
+    if(!manifest.Write(storageFolder))
+    {
+        QLOG_ERROR() << "couldn't write snapshot manifest into: " << storageFolder;
+        return false;
+    }
+    QLOG_INFO() << "added delta: " << delta.sequence << " to server snapshot: " << manifest.buildId;
+    return true;
+}
+
+bool CompactServerData(DataHolder& data, QString storageFolder, const SnapshotManifest& manifest)
+{
+    QLOG_INFO() << "compacting server snapshot: " << manifest.buildId << " with deltas: " << manifest.deltas.size();
+    BuildDerivedServerData(data, storageFolder);
+    SnapshotManifest compacted;
+    compacted.databaseUpdate = manifest.databaseUpdate;
+    compacted.dataTimestamp = manifest.dataTimestamp;
+    return PublishServerData(data, storageFolder, compacted);
+}
+
+}
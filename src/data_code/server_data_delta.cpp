@@ -0,0 +1,198 @@
+/*
+Flipper is a recommendation and search engine for fanfiction.net
+Copyright (C) 2017-2020  Marchenko Nikolai
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+#include "include/data_code/server_data_delta.h"
+#include "include/data_code/rec_calc_data.h"
+#include "include/tasks/author_genre_iteration_processor.h"
+#include "include/timeutils.h"
+#include "logger/QsLog.h"
+
+#include <QDataStream>
+#include <QFile>
+#include <QSet>
+
+namespace core{
+
+static constexpr quint32 serverDeltaMagic = 0x464c5344;
+static constexpr quint32 serverDeltaVersion = 1;
+
+QString ServerDataDelta::FileName(QString baseBuildId, int sequence)
+{
+    return QString("server_delta_%1_%2.bin").arg(baseBuildId, QString::number(sequence));
+}
+
+void ServerDataDelta::Collect(const DataHolder& data, QDateTime since)
+{
+    this->since = since;
+    // taken before anything is read, whatever changes during the reads gets into the next delta as well
+    until = QDateTime::currentDateTime();
+
+    TimedAction action("Collecting changed favourites",[&](){
+        const auto changedFavourites = data.authorsInterface->LoadFavouritesHashsetUpdatedSince(since);
+        for(auto i = changedFavourites.cbegin(); i != changedFavourites.cend(); i++)
+        {
+            auto& bitmap = favourites[i.key()];
+            for(auto fic : i.value())
+                bitmap.add(static_cast<uint32_t>(fic));
+        }
+        // authors that were updated and have nothing left in their favourites
+        const auto changedAuthors = data.authorsInterface->GetAllAuthorsWithFavUpdateSince("ffn", since);
+        for(const auto& author : changedAuthors)
+            if(!favourites.contains(author->id) && data.faves.contains(author->id))
+                removedAuthors.push_back(author->id);
+    });
+    action.run();
+
+    TimedAction ficsAction("Collecting changed fics",[&](){
+        fics = data.fanficsInterface->GetHashOfFicsWithEnoughFavesForWeightsUpdatedSince(0, since);
+        if(data.genresInterface)
+            genreComposites = data.genresInterface->GetGenreListUpdatedSince(since);
+    });
+    ficsAction.run();
+
+    // authors that favourite a fic whose genres changed need their moods recalculated too
+    QHash<int, Roaring> moodFavourites = favourites;
+    if(!genreComposites.isEmpty())
+    {
+        TimedAction affectedAction("Collecting authors of regenred fics",[&](){
+            Roaring regenredFics;
+            for(auto i = genreComposites.cbegin(); i != genreComposites.cend(); i++)
+                regenredFics.add(static_cast<uint32_t>(i.key()));
+            const QSet<int> removed(removedAuthors.cbegin(), removedAuthors.cend());
+            for(auto i = data.faves.cbegin(); i != data.faves.cend(); i++)
+                if(!moodFavourites.contains(i.key()) && !removed.contains(i.key()) && i.value().intersect(regenredFics))
+                    moodFavourites.insert(i.key(), i.value());
+        });
+        affectedAction.run();
+    }
+
+    if(!moodFavourites.isEmpty())
+    {
+        TimedAction moodsAction("Calculating moods of changed authors",[&](){
+            auto composites = data.genreComposites;
+            for(auto i = genreComposites.cbegin(); i != genreComposites.cend(); i++)
+                composites[i.key()] = i.value();
+            AuthorGenreIterationProcessor iteratorProcessor;
+            iteratorProcessor.ReprocessGenreStats(composites, moodFavourites);
+            moods = iteratorProcessor.resultingMoodAuthorData;
+        });
+        moodsAction.run();
+    }
+    QLOG_INFO() << "delta since: " << since << " changed authors: " << favourites.size() << " removed authors: " << removedAuthors.size()
+                << " fics: " << fics.size() << " genre composites: " << genreComposites.size() << " moods: " << moods.size();
+}
+
+bool ServerDataDelta::IsEmpty() const
+{
+    return favourites.isEmpty() && removedAuthors.isEmpty() && fics.isEmpty() && genreComposites.isEmpty() && moods.isEmpty();
+}
+
+bool ServerDataDelta::Save(QString fileName) const
+{
+    QFile file(fileName + ".tmp");
+    if(!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        return false;
+    QDataStream out(&file);
+    out << serverDeltaMagic << serverDeltaVersion << baseBuildId << static_cast<qint32>(sequence) << since << until;
+    out << removedAuthors;
+    out << static_cast<quint32>(favourites.size());
+    QByteArray bitmap;
+    for(auto i = favourites.cbegin(); i != favourites.cend(); i++)
+    {
+        bitmap.resize(static_cast<int>(i.value().getSizeInBytes(true)));
+        i.value().write(bitmap.data(), true);
+        out << static_cast<qint32>(i.key()) << bitmap;
+    }
+    out << static_cast<quint32>(fics.size());
+    for(const auto& fic : fics)
+        fic->Serialize(out);
+    out << genreComposites << moods;
+    // a delta that was cut short doesn't end with it and is never applied
+    out << serverDeltaMagic;
+    const bool written = out.status() == QDataStream::Ok;
+    file.close();
+    if(!written)
+        return false;
+    QFile::remove(fileName);
+    return QFile::rename(fileName + ".tmp", fileName);
+}
+
+bool ServerDataDelta::Load(QString fileName)
+{
+    *this = ServerDataDelta();
+    QFile file(fileName);
+    if(!file.open(QIODevice::ReadOnly))
+        return false;
+    QDataStream in(&file);
+    quint32 magic = 0, version = 0;
+    in >> magic >> version;
+    if(magic != serverDeltaMagic || version != serverDeltaVersion)
+    {
+        QLOG_WARN() << "server delta was written in a different format, version: " << version;
+        return false;
+    }
+    qint32 storedSequence = 0;
+    in >> baseBuildId >> storedSequence >> since >> until;
+    sequence = storedSequence;
+    in >> removedAuthors;
+
+    quint32 count = 0;
+    in >> count;
+    QByteArray bitmap;
+    for(quint32 i = 0; i < count && in.status() == QDataStream::Ok; i++)
+    {
+        qint32 author = 0;
+        in >> author >> bitmap;
+        try{
+            favourites.insert(author, Roaring::readSafe(bitmap.constData(), static_cast<size_t>(bitmap.size())));
+        }
+        catch(const std::exception&){
+            QLOG_WARN() << "server delta contains broken favourites: " << fileName;
+            return false;
+        }
+    }
+    in >> count;
+    for(quint32 i = 0; i < count && in.status() == QDataStream::Ok; i++)
+    {
+        FicWeightPtr fic(new FanficDataForRecommendationCreation());
+        fic->Deserialize(in);
+        fics.insert(fic->id, fic);
+    }
+    in >> genreComposites >> moods;
+    quint32 trailer = 0;
+    in >> trailer;
+    return in.status() == QDataStream::Ok && trailer == serverDeltaMagic;
+}
+
+void ServerDataDelta::Apply(DataHolder& data) const
+{
+    for(auto author : removedAuthors)
+    {
+        data.faves.remove(author);
+        data.authorMoodDistributions.remove(static_cast<uint32_t>(author));
+    }
+    for(auto i = favourites.cbegin(); i != favourites.cend(); i++)
+        data.faves[i.key()] = i.value();
+    if(!fics.isEmpty())
+        data.ficTable = data.ficTable.Updated(fics);
+    for(auto i = genreComposites.cbegin(); i != genreComposites.cend(); i++)
+        data.genreComposites[i.key()] = i.value();
+    for(auto i = moods.cbegin(); i != moods.cend(); i++)
+        data.authorMoodDistributions[i.key()] = i.value();
+}
+
+}
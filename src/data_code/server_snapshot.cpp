@@ -0,0 +1,539 @@
+/*
+Flipper is a recommendation and search engine for fanfiction.net
+Copyright (C) 2017-2020  Marchenko Nikolai
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+#include "include/data_code/server_snapshot.h"
+#include "include/data_code/rec_calc_data.h"
+#include "include/threaded_data/parallel_for.h"
+#include "include/timeutils.h"
+#include "logger/QsLog.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+namespace core{
+
+static constexpr uint32_t serverSnapshotMagic = 0x464c5353;
+static constexpr uint32_t serverSnapshotVersion = 1;
+// sections start at multiples of this so that any column can be used in place
+static constexpr uint64_t sectionAlignment = 64;
+
+enum ESnapshotSection : uint32_t{
+    ss_fic_ordinals = 0,
+    ss_fic_ids,
+    ss_fic_flags,
+    ss_fic_authors,
+    ss_fic_fav_counts,
+    ss_fic_sum_author_faves,
+    ss_fic_reviews,
+    ss_fic_words,
+    ss_fic_chapters,
+    ss_fic_published,
+    ss_fic_updated,
+    ss_fic_fandom_offsets,
+    ss_fic_fandoms,
+    ss_fic_genre_masks,
+    ss_fic_genre_names,
+    ss_favourite_authors,
+    ss_favourite_offsets,
+    ss_favourite_bitmaps,
+    ss_composite_fics,
+    ss_composite_offsets,
+    ss_composite_bits,
+    ss_composite_genres,
+    ss_composite_genre_names,
+    ss_mood_authors,
+    ss_mood_values,
+    ss_count
+};
+
+// file layout: header, section table, sections in the order of ESnapshotSection
+struct SnapshotHeader{
+    uint32_t magic = serverSnapshotMagic;
+    uint32_t version = serverSnapshotVersion;
+    uint32_t sectionCount = ss_count;
+    // moods are stored as raw records, a different layout makes the file unusable
+    uint32_t moodRecordSize = sizeof(genre_stats::ListMoodData);
+};
+
+struct SnapshotSection{
+    uint64_t offset = 0;
+    uint64_t size = 0;
+    uint64_t checksum = 0;
+};
+
+// genre bits of a fic, names are indices into the composite genre names
+struct SnapshotGenreBit{
+    static constexpr uint8_t detected = 1;
+    static constexpr uint8_t inTheOriginal = 2;
+    float relevance = 0.f;
+    uint8_t flags = 0;
+    uint8_t padding = 0;
+    uint16_t genreCount = 0;
+    uint32_t firstGenre = 0;
+};
+
+static_assert(std::is_trivially_copyable<genre_stats::ListMoodData>::value, "moods are stored as raw records");
+
+// word at a time FNV-1a, fed in pieces of any size
+class SnapshotChecksum{
+public:
+    void Add(const uchar* data, uint64_t size){
+        while(size > 0 && pendingBytes > 0)
+        {
+            AddByte(*data++);
+            size--;
+        }
+        for(; size >= 8; size -= 8, data += 8)
+        {
+            uint64_t word;
+            memcpy(&word, data, 8);
+            Mix(word);
+        }
+        while(size-- > 0)
+            AddByte(*data++);
+    }
+    uint64_t Value() const{
+        auto result = hash;
+        if(pendingBytes > 0)
+            result = (result ^ pending) * prime;
+        return result;
+    }
+
+private:
+    static constexpr uint64_t prime = 0x100000001b3ull;
+    void Mix(uint64_t word){hash = (hash ^ word) * prime;}
+    void AddByte(uchar byte){
+        pending |= static_cast<uint64_t>(byte) << (8*pendingBytes);
+        if(++pendingBytes == 8)
+        {
+            Mix(pending);
+            pending = 0;
+            pendingBytes = 0;
+        }
+    }
+    uint64_t hash = 0xcbf29ce484222325ull;
+    uint64_t pending = 0;
+    int pendingBytes = 0;
+};
+
+class SnapshotWriter{
+public:
+    bool Begin(QString fileName){
+        output.setFileName(fileName);
+        if(!output.open(QIODevice::WriteOnly | QIODevice::Truncate))
+            return false;
+        // filled in by Finish once every section is known
+        QByteArray placeholder(static_cast<int>(sizeof(SnapshotHeader) + sizeof(sections)), 0);
+        return Put(reinterpret_cast<const uchar*>(placeholder.constData()), static_cast<uint64_t>(placeholder.size()));
+    }
+    void BeginSection(ESnapshotSection section){
+        const auto position = static_cast<uint64_t>(output.pos());
+        const auto padding = (sectionAlignment - position%sectionAlignment)%sectionAlignment;
+        static const std::array<char, sectionAlignment> zeroes{};
+        Put(reinterpret_cast<const uchar*>(zeroes.data()), padding);
+        current = section;
+        sections[section].offset = position + padding;
+        checksum = SnapshotChecksum();
+    }
+    void Append(const void* data, uint64_t size){
+        checksum.Add(static_cast<const uchar*>(data), size);
+        sections[current].size += size;
+        Put(static_cast<const uchar*>(data), size);
+    }
+    void EndSection(){
+        sections[current].checksum = checksum.Value();
+    }
+    template <typename T>
+    void Write(ESnapshotSection section, const T* values, size_t count){
+        BeginSection(section);
+        Append(values, static_cast<uint64_t>(count*sizeof(T)));
+        EndSection();
+    }
+    template <typename T>
+    void Write(ESnapshotSection section, const std::vector<T>& values){
+        Write(section, values.data(), values.size());
+    }
+    template <typename T>
+    void Write(ESnapshotSection section, const FicColumn<T>& values){
+        Write(section, values.data(), values.size());
+    }
+    void Write(ESnapshotSection section, const QStringList& strings){
+        const auto utf = strings.join('\n').toUtf8();
+        Write(section, utf.constData(), static_cast<size_t>(utf.size()));
+    }
+    bool Finish(){
+        SnapshotHeader header;
+        written = written && output.seek(0);
+        Put(reinterpret_cast<const uchar*>(&header), sizeof(header));
+        Put(reinterpret_cast<const uchar*>(sections.data()), sizeof(sections));
+        output.close();
+        return written;
+    }
+
+private:
+    bool Put(const uchar* data, uint64_t size){
+        if(written && size > 0)
+            written = output.write(reinterpret_cast<const char*>(data), static_cast<qint64>(size)) == static_cast<qint64>(size);
+        return written;
+    }
+    QFile output;
+    std::array<SnapshotSection, ss_count> sections{};
+    ESnapshotSection current = ss_fic_ordinals;
+    SnapshotChecksum checksum;
+    bool written = true;
+};
+
+class SnapshotReader{
+public:
+    bool Open(const ServerSnapshotFile& file, bool verifyChecksums){
+        base = file.Data();
+        const uint64_t size = file.Size();
+        if(size < sizeof(SnapshotHeader) + sizeof(sections))
+            return false;
+        SnapshotHeader header;
+        memcpy(&header, base, sizeof(header));
+        const SnapshotHeader expected;
+        if(header.magic != expected.magic || header.version != expected.version
+                || header.sectionCount != expected.sectionCount || header.moodRecordSize != expected.moodRecordSize)
+        {
+            QLOG_WARN() << "server snapshot was written in a different format, version: " << header.version;
+            return false;
+        }
+        memcpy(sections.data(), base + sizeof(header), sizeof(sections));
+        for(const auto& section : sections)
+            if(section.offset%sectionAlignment != 0 || section.offset > size || section.size > size - section.offset)
+                return false;
+        if(!verifyChecksums)
+            return true;
+
+        std::atomic<bool> valid{true};
+        TimedAction action("Verifying server snapshot",[&](){
+            thread_boost::ParallelFor(sections.size(), {0, 1}, [&](size_t begin, size_t end){
+                for(auto i = begin; i < end; i++)
+                {
+                    SnapshotChecksum checksum;
+                    checksum.Add(base + sections[i].offset, sections[i].size);
+                    if(checksum.Value() != sections[i].checksum)
+                    {
+                        QLOG_WARN() << "server snapshot section " << i << " is corrupted";
+                        valid = false;
+                    }
+                }
+            });
+        });
+        action.run();
+        return valid;
+    }
+    template <typename T>
+    bool Column(ESnapshotSection section, const T*& values, size_t& count) const{
+        if(sections[section].size%sizeof(T) != 0)
+            return false;
+        values = reinterpret_cast<const T*>(base + sections[section].offset);
+        count = static_cast<size_t>(sections[section].size/sizeof(T));
+        return true;
+    }
+    template <typename T>
+    bool Column(ESnapshotSection section, FicColumn<T>& column, size_t expectedCount) const{
+        const T* values = nullptr;
+        size_t count = 0;
+        if(!Column(section, values, count) || count != expectedCount)
+            return false;
+        column.View(values, count);
+        return true;
+    }
+    QStringList Strings(ESnapshotSection section) const{
+        if(sections[section].size == 0)
+            return {};
+        return QString::fromUtf8(reinterpret_cast<const char*>(base + sections[section].offset),
+                                 static_cast<int>(sections[section].size)).split('\n');
+    }
+
+private:
+    const uchar* base = nullptr;
+    std::array<SnapshotSection, ss_count> sections{};
+};
+
+// offsets have to grow and stay within the data they point into
+template <typename T>
+static bool ValidOffsets(const T* offsets, size_t count, uint64_t dataSize)
+{
+    if(count == 0 || offsets[0] != 0 || offsets[count - 1] != dataSize)
+        return false;
+    for(size_t i = 1; i < count; i++)
+        if(offsets[i] < offsets[i - 1])
+            return false;
+    return true;
+}
+
+bool ServerSnapshotFile::Open(QString fileName)
+{
+    file.setFileName(fileName);
+    if(!file.open(QIODevice::ReadOnly) || file.size() == 0)
+        return false;
+    data = file.map(0, file.size());
+    size = data ? static_cast<uint64_t>(file.size()) : 0;
+    return data != nullptr;
+}
+
+bool ServerSnapshot::Save(const DataHolder& data, QString fileName)
+{
+    SnapshotWriter writer;
+    // servers that are still running keep the old file mapped, so it's replaced instead of being rewritten
+    if(!writer.Begin(fileName + ".tmp"))
+        return false;
+
+    TimedAction action("Writing server snapshot",[&](){
+        const auto& fics = data.ficTable;
+        writer.Write(ss_fic_ordinals, fics.ordinalForFic);
+        writer.Write(ss_fic_ids, fics.ids);
+        writer.Write(ss_fic_flags, fics.flags);
+        writer.Write(ss_fic_authors, fics.authorIds);
+        writer.Write(ss_fic_fav_counts, fics.favCounts);
+        writer.Write(ss_fic_sum_author_faves, fics.sumAuthorFaves);
+        writer.Write(ss_fic_reviews, fics.reviewCounts);
+        writer.Write(ss_fic_words, fics.wordCounts);
+        writer.Write(ss_fic_chapters, fics.chapterCounts);
+        writer.Write(ss_fic_published, fics.published);
+        writer.Write(ss_fic_updated, fics.updated);
+        writer.Write(ss_fic_fandom_offsets, fics.fandomOffsets);
+        writer.Write(ss_fic_fandoms, fics.fandoms);
+        writer.Write(ss_fic_genre_masks, fics.genreMasks);
+        writer.Write(ss_fic_genre_names, fics.genreNames);
+
+        std::vector<std::pair<uint32_t, const Roaring*>> sortedFaves;
+        sortedFaves.reserve(static_cast<size_t>(data.faves.size()));
+        for(auto i = data.faves.cbegin(); i != data.faves.cend(); i++)
+            sortedFaves.push_back({static_cast<uint32_t>(i.key()), &i.value()});
+        std::sort(sortedFaves.begin(), sortedFaves.end());
+        std::vector<uint32_t> authors;
+        std::vector<uint64_t> offsets{0};
+        authors.reserve(sortedFaves.size());
+        offsets.reserve(sortedFaves.size() + 1);
+        for(const auto& [author, favourites] : sortedFaves)
+        {
+            authors.push_back(author);
+            offsets.push_back(offsets.back() + favourites->getSizeInBytes(true));
+        }
+        writer.Write(ss_favourite_authors, authors);
+        writer.Write(ss_favourite_offsets, offsets);
+        writer.BeginSection(ss_favourite_bitmaps);
+        std::vector<char> buffer;
+        for(const auto& entry : sortedFaves)
+        {
+            buffer.resize(entry.second->getSizeInBytes(true));
+            entry.second->write(buffer.data(), true);
+            writer.Append(buffer.data(), buffer.size());
+        }
+        writer.EndSection();
+
+        std::vector<int32_t> compositeFics;
+        compositeFics.reserve(static_cast<size_t>(data.genreComposites.size()));
+        for(auto i = data.genreComposites.cbegin(); i != data.genreComposites.cend(); i++)
+            compositeFics.push_back(i.key());
+        std::sort(compositeFics.begin(), compositeFics.end());
+        std::vector<uint32_t> bitOffsets{0};
+        std::vector<SnapshotGenreBit> bits;
+        std::vector<uint16_t> bitGenres;
+        QStringList genreNames;
+        QHash<QString, uint16_t> genreIndices;
+        for(auto fic : compositeFics)
+        {
+            for(const auto& bit : data.genreComposites[fic])
+            {
+                SnapshotGenreBit stored;
+                stored.relevance = bit.relevance;
+                stored.flags = (bit.isDetected ? SnapshotGenreBit::detected : 0) | (bit.isInTheOriginal ? SnapshotGenreBit::inTheOriginal : 0);
+                stored.genreCount = static_cast<uint16_t>(bit.genres.size());
+                stored.firstGenre = static_cast<uint32_t>(bitGenres.size());
+                for(const auto& genre : bit.genres)
+                {
+                    auto it = genreIndices.find(genre);
+                    if(it == genreIndices.end())
+                    {
+                        it = genreIndices.insert(genre, static_cast<uint16_t>(genreNames.size()));
+                        genreNames.push_back(genre);
+                    }
+                    bitGenres.push_back(it.value());
+                }
+                bits.push_back(stored);
+            }
+            bitOffsets.push_back(static_cast<uint32_t>(bits.size()));
+        }
+        writer.Write(ss_composite_fics, compositeFics);
+        writer.Write(ss_composite_offsets, bitOffsets);
+        writer.Write(ss_composite_bits, bits);
+        writer.Write(ss_composite_genres, bitGenres);
+        writer.Write(ss_composite_genre_names, genreNames);
+
+        std::vector<uint32_t> moodAuthors;
+        moodAuthors.reserve(static_cast<size_t>(data.authorMoodDistributions.size()));
+        for(auto i = data.authorMoodDistributions.cbegin(); i != data.authorMoodDistributions.cend(); i++)
+            moodAuthors.push_back(i.key());
+        std::sort(moodAuthors.begin(), moodAuthors.end());
+        std::vector<genre_stats::ListMoodData> moods;
+        moods.reserve(moodAuthors.size());
+        for(auto author : moodAuthors)
+            moods.push_back(data.authorMoodDistributions[author]);
+        writer.Write(ss_mood_authors, moodAuthors);
+        writer.Write(ss_mood_values, moods);
+    });
+    action.run();
+
+    if(!writer.Finish())
+        return false;
+    QFile::remove(fileName);
+    return QFile::rename(fileName + ".tmp", fileName);
+}
+
+bool ServerSnapshot::Load(DataHolder& data, QString fileName, bool verifyChecksums)
+{
+    QSharedPointer<ServerSnapshotFile> file(new ServerSnapshotFile);
+    SnapshotReader reader;
+    if(!file->Open(fileName) || !reader.Open(*file, verifyChecksums))
+        return false;
+
+    FicTable fics;
+    const int32_t* ids = nullptr;
+    size_t ficCount = 0;
+    const uint32_t* ordinals = nullptr;
+    size_t ordinalCount = 0;
+    // raw columns first, their sizes are what every other column is checked against
+    bool valid = reader.Column(ss_fic_ids, ids, ficCount) && reader.Column(ss_fic_ordinals, ordinals, ordinalCount);
+    valid = valid && reader.Column(ss_fic_ids, fics.ids, ficCount)
+            && reader.Column(ss_fic_ordinals, fics.ordinalForFic, ordinalCount)
+            && reader.Column(ss_fic_flags, fics.flags, ficCount)
+            && reader.Column(ss_fic_authors, fics.authorIds, ficCount)
+            && reader.Column(ss_fic_fav_counts, fics.favCounts, ficCount)
+            && reader.Column(ss_fic_sum_author_faves, fics.sumAuthorFaves, ficCount)
+            && reader.Column(ss_fic_reviews, fics.reviewCounts, ficCount)
+            && reader.Column(ss_fic_words, fics.wordCounts, ficCount)
+            && reader.Column(ss_fic_chapters, fics.chapterCounts, ficCount)
+            && reader.Column(ss_fic_published, fics.published, ficCount)
+            && reader.Column(ss_fic_updated, fics.updated, ficCount)
+            && reader.Column(ss_fic_genre_masks, fics.genreMasks, ficCount);
+    const int32_t* fandoms = nullptr;
+    size_t fandomCount = 0;
+    valid = valid && reader.Column(ss_fic_fandoms, fandoms, fandomCount)
+            && reader.Column(ss_fic_fandoms, fics.fandoms, fandomCount)
+            && reader.Column(ss_fic_fandom_offsets, fics.fandomOffsets, ficCount + 1)
+            && ValidOffsets(fics.fandomOffsets.data(), ficCount + 1, fandomCount);
+    for(size_t i = 0; valid && i < ordinalCount; i++)
+        valid = ordinals[i] == FicTable::invalid || ordinals[i] < ficCount;
+
+    const uint32_t* authors = nullptr;
+    const uint64_t* offsets = nullptr;
+    const char* bitmaps = nullptr;
+    size_t authorCount = 0, offsetCount = 0, bitmapBytes = 0;
+    valid = valid && reader.Column(ss_favourite_authors, authors, authorCount)
+            && reader.Column(ss_favourite_offsets, offsets, offsetCount) && offsetCount == authorCount + 1
+            && reader.Column(ss_favourite_bitmaps, bitmaps, bitmapBytes)
+            && ValidOffsets(offsets, offsetCount, bitmapBytes);
+
+    const int32_t* compositeFics = nullptr;
+    const uint32_t* bitOffsets = nullptr;
+    const SnapshotGenreBit* bits = nullptr;
+    const uint16_t* bitGenres = nullptr;
+    size_t compositeCount = 0, bitOffsetCount = 0, bitCount = 0, bitGenreCount = 0;
+    valid = valid && reader.Column(ss_composite_fics, compositeFics, compositeCount)
+            && reader.Column(ss_composite_offsets, bitOffsets, bitOffsetCount) && bitOffsetCount == compositeCount + 1
+            && reader.Column(ss_composite_bits, bits, bitCount)
+            && reader.Column(ss_composite_genres, bitGenres, bitGenreCount)
+            && ValidOffsets(bitOffsets, bitOffsetCount, bitCount);
+    const auto compositeGenreNames = reader.Strings(ss_composite_genre_names);
+    for(size_t i = 0; valid && i < bitCount; i++)
+        valid = static_cast<uint64_t>(bits[i].firstGenre) + bits[i].genreCount <= bitGenreCount;
+    for(size_t i = 0; valid && i < bitGenreCount; i++)
+        valid = bitGenres[i] < compositeGenreNames.size();
+
+    const uint32_t* moodAuthors = nullptr;
+    const genre_stats::ListMoodData* moods = nullptr;
+    size_t moodAuthorCount = 0, moodCount = 0;
+    valid = valid && reader.Column(ss_mood_authors, moodAuthors, moodAuthorCount)
+            && reader.Column(ss_mood_values, moods, moodCount) && moodAuthorCount == moodCount;
+    if(!valid)
+    {
+        QLOG_WARN() << "server snapshot is inconsistent: " << fileName;
+        return false;
+    }
+
+    // bitmaps are deserialized straight from the mapping, there is no intermediate copy of the file
+    std::vector<Roaring> favourites(authorCount);
+    std::atomic<bool> readable{true};
+    TimedAction favouritesAction("Reading favourites from server snapshot",[&](){
+        thread_boost::ParallelFor(authorCount, {0, 1024}, [&](size_t begin, size_t end){
+            for(auto i = begin; i < end; i++)
+            {
+                try{
+                    favourites[i] = Roaring::readSafe(bitmaps + offsets[i], static_cast<size_t>(offsets[i + 1] - offsets[i]));
+                }
+                catch(const std::exception&){
+                    readable = false;
+                }
+            }
+        });
+    });
+    favouritesAction.run();
+    if(!readable)
+    {
+        QLOG_WARN() << "server snapshot contains broken favourites: " << fileName;
+        return false;
+    }
+
+    fics.genreNames = reader.Strings(ss_fic_genre_names);
+    fics.mapping = file;
+    data.ficTable = std::move(fics);
+    data.fics.clear();
+
+    data.faves.clear();
+    data.faves.reserve(static_cast<int>(authorCount));
+    for(size_t i = 0; i < authorCount; i++)
+        data.faves.insert(static_cast<int>(authors[i]), std::move(favourites[i]));
+
+    data.genreComposites.clear();
+    data.genreComposites.reserve(static_cast<int>(compositeCount));
+    for(size_t i = 0; i < compositeCount; i++)
+    {
+        auto& ficBits = data.genreComposites[compositeFics[i]];
+        ficBits.reserve(static_cast<int>(bitOffsets[i + 1] - bitOffsets[i]));
+        for(auto bit = bitOffsets[i]; bit < bitOffsets[i + 1]; bit++)
+        {
+            const auto& stored = bits[bit];
+            genre_stats::GenreBit genreBit;
+            genreBit.relevance = stored.relevance;
+            genreBit.isDetected = stored.flags & SnapshotGenreBit::detected;
+            genreBit.isInTheOriginal = stored.flags & SnapshotGenreBit::inTheOriginal;
+            for(uint32_t genre = stored.firstGenre; genre < stored.firstGenre + stored.genreCount; genre++)
+                genreBit.genres.push_back(compositeGenreNames[bitGenres[genre]]);
+            ficBits.push_back(genreBit);
+        }
+    }
+
+    data.authorMoodDistributions.clear();
+    data.authorMoodDistributions.reserve(static_cast<int>(moodCount));
+    for(size_t i = 0; i < moodCount; i++)
+        data.authorMoodDistributions.insert(moodAuthors[i], moods[i]);
+
+    QLOG_INFO() << "loaded server snapshot with fics: " << ficCount << " authors: " << authorCount
+                << " genre composites: " << compositeCount << " moods: " << moodCount;
+    return true;
+}
+
+}
@@ -24,21 +24,45 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #include "threaded_data/threaded_load.h"
 #include "rec_calc/rec_calculator_weighted.h"
 #include "rec_calc/rec_calculator_mood_adjusted.h"
+#include "rec_calc/rec_calculator_pipeline.h"
+#include "core/top_k.h"
 
 #include <QSettings>
+#include <QElapsedTimer>
 #include <QDir>
 #include <algorithm>
 //#include <execution>
 #include <cmath>
 namespace core{
 
+static RecInputVectors InputsFromSnapshot(const DataHolder& data)
+{
+    return {data.faves, data.ficTable, data.ficsByFandom, data.authorMoodDistributions, data.authorMoods, data.favouritesByFic, data.ficOrdinals, data.authorOrdinals, data.favouritesSketch};
+}
+
+DataSnapshot RecCalculator::Snapshot() const
+{
+    QMutexLocker locker(&snapshotLock);
+    return snapshot;
+}
+
+void RecCalculator::SetSnapshot(QSharedPointer<DataHolder> data)
+{
+    QMutexLocker locker(&snapshotLock);
+    data->generation = ++lastGeneration;
+    snapshot = data;
+    QLOG_INFO() << "published data snapshot: " << data->generation;
+}
+
 void RecCalculator::LoadFavourites(QSharedPointer<interfaces::Authors> authorInterface)
 {
     CreateTempDataDir();
     QSettings settings("settings/settings_server.ini", QSettings::IniFormat);
     if(settings.value("Settings/usestoreddata", false).toBool() && QFile::exists("ServerData/roafav_0.txt"))
     {
-        holder.LoadData<core::rdt_favourites>("ServerData");
+        QSharedPointer<DataHolder> data(new DataHolder(*Snapshot()));
+        data->LoadData<core::rdt_favourites>("ServerData");
+        SetSnapshot(data);
     }
     else
     {
@@ -77,92 +101,233 @@ void RecCalculator::SaveFavouritesData()
 
 
 
-RecommendationListResult RecCalculator::GetMatchedFicsForFavList(QHash<uint32_t, core::FicWeightPtr> fetchedFics,
-                                                                 QSharedPointer<RecommendationList> params,
-                                                                 genre_stats::GenreMoodData moodData)
+QSharedPointer<RecCalculatorImplBase> RecCalculator::CreateCalculator(const DataSnapshot& data,
+                                                                      QHash<uint32_t, FicWeightPtr> fetchedFics,
+                                                                      QSharedPointer<RecommendationList> params,
+                                                                      genre_stats::GenreMoodData moodData)
 {
     QSharedPointer<RecCalculatorImplBase> calculator;
     if(params->useWeighting)
     {
         if(params->useMoodAdjustment)
-           calculator.reset(new RecCalculatorImplMoodAdjusted({holder.faves, holder.fics, holder.authorMoodDistributions}, moodData));
+           calculator.reset(new MoodAdjustedCalculator(InputsFromSnapshot(*data), moodData));
         else
-           calculator.reset(new RecCalculatorImplWeighted({holder.faves, holder.fics, holder.authorMoodDistributions}));
+           calculator.reset(new WeightedCalculator(InputsFromSnapshot(*data)));
     }
     else
-        calculator.reset(new RecCalculatorImplDefault({holder.faves, holder.fics, holder.authorMoodDistributions}));
+        calculator.reset(new DefaultCalculator(InputsFromSnapshot(*data)));
+    calculator->snapshot = data;
     calculator->fetchedFics = fetchedFics;
+    calculator->threadBudget = threadBudget;
     calculator->doTrashCounting = params->useDislikes;
     calculator->params = params;
     for(auto fic : std::as_const(params->majorNegativeVotes))
         calculator->ownMajorNegatives.add(static_cast<uint32_t>(fic));
     QLOG_INFO() << "Received negative votes: " << params->majorNegativeVotes.size();
+    return calculator;
+}
+
+RecommendationListResult RecCalculator::GetMatchedFicsForFavList(const DataSnapshot& data,
+                                                                 QHash<uint32_t, core::FicWeightPtr> fetchedFics,
+                                                                 QSharedPointer<RecommendationList> params,
+                                                                 genre_stats::GenreMoodData moodData)
+{
+    auto calculator = CreateCalculator(data, fetchedFics, params, moodData);
     TimedAction action("Reclist Creation",[&](){
         calculator->result.success = calculator->Calc();
     });
     action.run();
-    calculator->result.authors = calculator->filteredAuthors;
+    calculator->result.authors = calculator->FilteredAuthorSet();
 
     return calculator->result;
 }
 
-DiagnosticRecommendationListResult RecCalculator::GetDiagnosticRecommendationList(QHash<uint32_t, FicWeightPtr> fetchedFics, QSharedPointer<RecommendationList> params, genre_stats::GenreMoodData moodData)
+std::optional<RecommendationListResult> RecCalculator::GetSimilarFicsFromIndex(const DataSnapshot& data, uint32_t fic,
+                                                                               QSharedPointer<RecommendationList> params)
+{
+    // the index only knows plain co-favourite counts
+    if(!data->ficNeighbours || params->resultLimit <= 0 || params->useWeighting || params->useMoodAdjustment)
+        return {};
+    auto neighbours = data->ficNeighbours->NeighboursOf(fic);
+    if(neighbours.first == neighbours.second)
+        return {};
+
+    auto calculator = CreateCalculator(data, {}, params);
+    auto ignores = calculator->BuildIgnoreList();
+    std::vector<FicNeighbourIndex::Neighbour> picked;
+    picked.reserve(static_cast<size_t>(params->resultLimit));
+    for(auto it = neighbours.first; it != neighbours.second && picked.size() < static_cast<size_t>(params->resultLimit); it++)
+        if(!ignores.contains(it->fic))
+            picked.push_back(*it);
+
+    // ignores have eaten into a truncated neighbour list, only the full calculation knows what comes after it
+    const auto available = neighbours.second - neighbours.first;
+    if(picked.size() < static_cast<size_t>(params->resultLimit) && available >= data->ficNeighbours->NeighbourLimit())
+        return {};
+
+    std::sort(picked.begin(), picked.end(), [](const auto& first, const auto& second){
+        return first.fic < second.fic;
+    });
+    RecommendationListResult result;
+    result.success = true;
+    result.votes.Resize(picked.size());
+    for(size_t i = 0; i < picked.size(); i++)
+    {
+        result.votes.ficIds[i] = picked[i].fic;
+        result.votes.recommendations[i] = static_cast<int>(picked[i].score);
+        result.votes.pureMatches[i] = static_cast<int>(picked[i].score);
+        result.limitedResults.insert(static_cast<int>(picked[i].fic));
+    }
+    QLOG_INFO() << "similar fics for: " << fic << " were taken from neighbour index: " << picked.size();
+    return result;
+}
+
+QVector<RecommendationListResult> RecCalculator::GetMatchedFicsForFavLists(const DataSnapshot& data, const QVector<ReclistCreationInput>& inputs)
+{
+    QVector<RecommendationListResult> results;
+    results.reserve(inputs.size());
+    // every calculator holds a workspace until its list is done, favourites are scanned once per chunk
+    const int chunkSize = batchListsPerScan > 0 ? batchListsPerScan : std::max(1, static_cast<int>(inputs.size()));
+    for(int chunkStart = 0; chunkStart < inputs.size(); chunkStart += chunkSize)
+    {
+        const int chunkEnd = std::min(static_cast<int>(inputs.size()), chunkStart + chunkSize);
+        QVector<QSharedPointer<RecCalculatorImplBase>> calculators;
+        std::vector<RecCalculatorImplBase*> calculatorPointers;
+        for(int i = chunkStart; i < chunkEnd; i++)
+        {
+            const auto& input = inputs[i];
+            calculators.push_back(CreateCalculator(data, input.fetchedFics, input.params, input.moodData));
+            calculatorPointers.push_back(calculators.back().data());
+        }
+
+        TimedAction relationsAction("Batch relations creation",[&](){
+            RecCalculatorImplBase::FetchAuthorRelationsBatch(calculatorPointers);
+        });
+        relationsAction.run();
+
+        TimedAction action("Batch reclist creation",[&](){
+            for(auto& calculator : calculators)
+            {
+                calculator->result.success = calculator->CalcFromRelations();
+                calculator->result.authors = calculator->FilteredAuthorSet();
+                results.push_back(std::move(calculator->result));
+                // author data is the bulk of calculator's memory and isn't needed past this point
+                calculator.reset();
+            }
+        });
+        action.run();
+    }
+    return results;
+}
+
+ApproximateCandidatesReport RecCalculator::CompareApproximateCandidates(const DataSnapshot& data,
+                                                                        QHash<uint32_t, FicWeightPtr> fetchedFics,
+                                                                        const RecommendationList& params,
+                                                                        genre_stats::GenreMoodData moodData)
+{
+    ApproximateCandidatesReport report;
+    auto createList = [&](bool approximate, qint64& elapsed){
+        QSharedPointer<RecommendationList> listParams(new RecommendationList(params));
+        listParams->useApproximateCandidates = approximate;
+        auto calculator = CreateCalculator(data, fetchedFics, listParams, moodData);
+        QElapsedTimer timer;
+        timer.start();
+        calculator->result.success = calculator->Calc();
+        elapsed = timer.elapsed();
+        calculator->result.authors = calculator->FilteredAuthorSet();
+        auto candidates = calculator->FetchCandidateAuthors().cardinality();
+        return std::make_pair(calculator->result, candidates);
+    };
+    auto [exact, exactCandidates] = createList(false, report.exactMs);
+    auto [approximate, approximateCandidates] = createList(true, report.approximateMs);
+    report.exactCandidates = exactCandidates;
+    report.approximateCandidates = approximateCandidates;
+
+    int foundAuthors = 0;
+    for(auto author : std::as_const(exact.authors))
+        if(approximate.authors.contains(author))
+            foundAuthors++;
+    report.authorRecall = exact.authors.isEmpty() ? 1. : static_cast<double>(foundAuthors)/exact.authors.size();
+
+    const size_t topSize = params.resultLimit > 0 ? static_cast<size_t>(params.resultLimit) : 100;
+    auto topFics = [topSize](const FicVoteData& votes){
+        TopK top(topSize);
+        for(size_t i = 0; i < votes.Size(); i++)
+            top.Push(votes.recommendations[i], static_cast<int>(votes.ficIds[i]));
+        QSet<int> result;
+        for(const auto& fic : top.Take())
+            result.insert(fic.id);
+        return result;
+    };
+    auto exactTop = topFics(exact.votes);
+    auto approximateTop = topFics(approximate.votes);
+    report.comparedFics = exactTop.size();
+    report.ficRecall = exactTop.isEmpty() ? 1. : static_cast<double>(QSet<int>(exactTop).intersect(approximateTop).size())/exactTop.size();
+
+    QLOG_INFO() << "approximate candidates: " << report.approximateCandidates << " exact: " << report.exactCandidates
+                << " author recall: " << report.authorRecall << " top " << report.comparedFics << " fic recall: " << report.ficRecall
+                << " time approximate: " << report.approximateMs << " exact: " << report.exactMs;
+    return report;
+}
+
+DiagnosticRecommendationListResult RecCalculator::GetDiagnosticRecommendationList(const DataSnapshot& data, QHash<uint32_t, FicWeightPtr> fetchedFics,
+                                                                                  QSharedPointer<RecommendationList> params, genre_stats::GenreMoodData moodData,
+                                                                                  const DiagnosticScope& scope)
 {
     DiagnosticRecommendationListResult result;
 
-    QSharedPointer<RecCalculatorImplWeighted> actualCalculator(new RecCalculatorImplMoodAdjusted({holder.faves, holder.fics, holder.authorMoodDistributions}, moodData));
+    QSharedPointer<RecCalculatorImplWeighted> actualCalculator(new MoodAdjustedCalculator(InputsFromSnapshot(*data), moodData));
+    actualCalculator->snapshot = data;
     actualCalculator->fetchedFics = fetchedFics;
+    actualCalculator->threadBudget = threadBudget;
     actualCalculator->params = params;
-    actualCalculator->needsDiagnosticData = true;
 
     for(auto fic : std::as_const(params->majorNegativeVotes))
         actualCalculator->ownMajorNegatives.add(static_cast<uint32_t>(fic));
 
     TimedAction action("Reclist Creation",[&](){
-        result.recs.success = actualCalculator->Calc();
+        actualCalculator->result.success = actualCalculator->Calc();
         QLOG_INFO() << "Param calc finished";
     });
     action.run();
-    actualCalculator->result.authors = actualCalculator->filteredAuthors;
-    result.recs = actualCalculator->result;
+    actualCalculator->result.authors = actualCalculator->FilteredAuthorSet();
+    result.diagnostics.reset(new ReclistDiagnostics(actualCalculator, scope));
+    result.recs = std::move(actualCalculator->result);
     result.quad = actualCalculator->quadraticDeviation;
     result.ratioMedian = actualCalculator->ratioMedian;
     result.sigma2Dist = actualCalculator->endOfUniqueAuthorRange;
-    //result.authorData = actualCalculator->
-    for(auto author : std::as_const(actualCalculator->filteredAuthors)){
-        result.authorData.push_back(actualCalculator->allAuthors[author]);
-    }
-    result.authorsForFics = actualCalculator->authorsForFics;
-
     return result;
 }
 
-FavouritesMatchResult RecCalculator::GetMatchedFics(UserMatchesInput input, int user2)
+FavouritesMatchResult RecCalculator::GetMatchedFics(const DataSnapshot& data, UserMatchesInput input, int user2)
 {
     QLOG_INFO() << "Creating calculator";
     QSharedPointer<RecCalculatorImplWeighted> calculator;
-    calculator.reset(new RecCalculatorImplWeighted({holder.faves, holder.fics, holder.authorMoodDistributions}));
+    calculator.reset(new WeightedCalculator(InputsFromSnapshot(*data)));
+    calculator->snapshot = data;
     //calculator->fetchedFics = fetchedFics;
+    calculator->threadBudget = threadBudget;
     QSharedPointer<RecommendationList> params(new RecommendationList);
     for(auto ignore: input.userIgnoredFandoms)
         params->ignoredFandoms.insert(ignore);
     calculator->params = params;
 
     auto ignores = calculator->BuildIgnoreList();
+    const Roaring userFavourites = data->faves.value(user2);
     QLOG_INFO() << "Making & list";
-    Roaring ignoredTemp = holder.faves[user2];
+    Roaring ignoredTemp = userFavourites;
     ignoredTemp = ignoredTemp & ignores;
     QLOG_INFO() << "Checking cardinality";
-    auto unignoredSize = holder.faves[user2].xor_cardinality(ignoredTemp);
+    auto unignoredSize = userFavourites.xor_cardinality(ignoredTemp);
 
 
     FavouritesMatchResult result;
     QLOG_INFO() << "Blargh";
     Roaring temp = input.userFavourites;
-    temp = temp & holder.faves[user2];
+    temp = temp & userFavourites;
     for(auto fic : temp)
         result.matches.push_back(fic);
-    result.ratioWithoutIgnores = static_cast<float>(holder.faves[user2].cardinality())/static_cast<float>(temp.cardinality());
+    result.ratioWithoutIgnores = static_cast<float>(userFavourites.cardinality())/static_cast<float>(temp.cardinality());
     result.ratio = static_cast<float>(unignoredSize)/static_cast<float>(temp.cardinality());
     return result;
 }
@@ -86,6 +86,13 @@ int main(int argc, char *argv[])
     SetupStatLogger();
     QLOG_INFO() << "Feeder app started server";
     FeederService service;
+    if(!service.hasData)
+    {
+        QLOG_ERROR() << "no server data to serve, stopping";
+        stateFile.setValue("server_state", "No data");
+        stateFile.sync();
+        return 1;
+    }
     auto serverSetup = [&](){
         QSettings settings("settings/settings_server.ini", QSettings::IniFormat);
         auto ip = settings.value("Settings/serverIp", "127.0.0.1").toString();
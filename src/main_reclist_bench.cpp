@@ -0,0 +1,393 @@
+/*
+Flipper is a recommendation and search engine for fanfiction.net
+Copyright (C) 2017-2020  Marchenko Nikolai
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+#include "include/bench/synthetic_favourites.h"
+#include "include/core/top_k.h"
+#include "include/favholder.h"
+#include "logger/QsLog.h"
+#include "third_party/nanobench/nanobench.h"
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QFile>
+#include <QSettings>
+#include <QTextStream>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <new>
+
+// allocations are counted only while a stage is measured
+static std::atomic<bool> countAllocations{false};
+static std::atomic<uint64_t> allocationCount{0};
+static std::atomic<uint64_t> allocatedBytes{0};
+
+static void CountAllocation(size_t size)
+{
+    if(!countAllocations.load(std::memory_order_relaxed))
+        return;
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    allocatedBytes.fetch_add(size, std::memory_order_relaxed);
+}
+
+#if defined(__GLIBC__)
+// Qt containers and roaring go straight to malloc so operator new alone would miss most of the allocations
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* pointer, size_t size);
+void* __libc_memalign(size_t alignment, size_t size);
+void __libc_free(void* pointer);
+
+void* malloc(size_t size)
+{
+    CountAllocation(size);
+    return __libc_malloc(size);
+}
+void* calloc(size_t count, size_t size)
+{
+    CountAllocation(count*size);
+    return __libc_calloc(count, size);
+}
+void* realloc(void* pointer, size_t size)
+{
+    CountAllocation(size);
+    return __libc_realloc(pointer, size);
+}
+// roaring keeps its containers aligned, these would go around the wrappers above otherwise
+void* memalign(size_t alignment, size_t size)
+{
+    CountAllocation(size);
+    return __libc_memalign(alignment, size);
+}
+void* aligned_alloc(size_t alignment, size_t size)
+{
+    CountAllocation(size);
+    return __libc_memalign(alignment, size);
+}
+int posix_memalign(void** pointer, size_t alignment, size_t size)
+{
+    if(alignment < sizeof(void*) || (alignment & (alignment - 1)) != 0)
+        return EINVAL;
+    CountAllocation(size);
+    auto result = __libc_memalign(alignment, size);
+    if(!result && size)
+        return ENOMEM;
+    *pointer = result;
+    return 0;
+}
+void free(void* pointer)
+{
+    __libc_free(pointer);
+}
+}
+#else
+void* operator new(size_t size)
+{
+    CountAllocation(size);
+    if(auto pointer = std::malloc(size ? size : 1))
+        return pointer;
+    throw std::bad_alloc();
+}
+void* operator new[](size_t size)
+{
+    return operator new(size);
+}
+void operator delete(void* pointer) noexcept
+{
+    std::free(pointer);
+}
+void operator delete[](void* pointer) noexcept
+{
+    std::free(pointer);
+}
+void operator delete(void* pointer, size_t) noexcept
+{
+    std::free(pointer);
+}
+void operator delete[](void* pointer, size_t) noexcept
+{
+    std::free(pointer);
+}
+#endif
+
+struct BenchMode{
+    QString name;
+    bool useWeighting = false;
+    bool useMoodAdjustment = false;
+};
+
+struct BenchList{
+    QString name;
+    bench::SyntheticUser user;
+};
+
+struct StageMeasure{
+    QString name;
+    std::vector<long long> microseconds;
+    uint64_t allocations = 0;
+    uint64_t bytes = 0;
+};
+
+static QSharedPointer<core::RecommendationList> CreateParams(const BenchMode& mode, const bench::SyntheticUser& user)
+{
+    // the same defaults the client sends for an automatic list
+    QSharedPointer<core::RecommendationList> params(new core::RecommendationList);
+    params->isAutomatic = true;
+    params->minimumMatch = 1;
+    params->maxUnmatchedPerMatch = 50;
+    params->alwaysPickAt = 9999;
+    params->useWeighting = mode.useWeighting;
+    params->useMoodAdjustment = mode.useMoodAdjustment;
+    for(auto i = user.fetchedFics.cbegin(); i != user.fetchedFics.cend(); i++)
+        params->ficData->sourceFics.insert(static_cast<int>(i.key()));
+    return params;
+}
+
+// the best fics of the list in the order they are shown to the user
+static QStringList DescribeResult(const core::RecommendationListResult& result, int topSize)
+{
+    core::TopK top(static_cast<size_t>(topSize));
+    for(size_t i = 0; i < result.votes.Size(); i++)
+        top.Push(result.votes.recommendations[i], static_cast<int>(result.votes.ficIds[i]));
+    QStringList lines;
+    lines.push_back(QString("success %1").arg(result.success ? 1 : 0));
+    lines.push_back(QString("authors %1").arg(result.authors.size()));
+    lines.push_back(QString("fics %1").arg(result.votes.Size()));
+    for(const auto& fic : top.Take())
+        lines.push_back(QString("%1 %2").arg(fic.id).arg(fic.score));
+    return lines;
+}
+
+static QStringList ReadGolden(QString fileName)
+{
+    QFile file(fileName);
+    if(!file.open(QIODevice::ReadOnly | QIODevice::Text))
+        return {};
+    QStringList lines;
+    QTextStream in(&file);
+    while(!in.atEnd())
+        lines.push_back(in.readLine());
+    return lines;
+}
+
+static bool WriteGolden(QString fileName, const QStringList& lines)
+{
+    QFile file(fileName);
+    if(!file.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text))
+        return false;
+    QTextStream out(&file);
+    for(const auto& line : lines)
+        out << line << "\n";
+    return true;
+}
+
+static long long Median(std::vector<long long> values)
+{
+    if(values.empty())
+        return 0;
+    auto middle = values.begin() + static_cast<std::ptrdiff_t>(values.size()/2);
+    std::nth_element(values.begin(), middle, values.end());
+    return *middle;
+}
+
+// the same steps GetMatchedFicsForFavList goes through, timed one by one
+static std::vector<StageMeasure> MeasureStages(core::RecCalculator& recCalculator, const core::DataSnapshot& data,
+                                               const BenchMode& mode, const BenchList& list, int iterations)
+{
+    std::vector<StageMeasure> stages = {{"create calculator",{},0,0}, {"author relations",{},0,0},
+                                        {"matching and weighting",{},0,0}, {"collecting votes",{},0,0}};
+    for(int iteration = 0; iteration < iterations; iteration++)
+    {
+        auto params = CreateParams(mode, list.user);
+        QSharedPointer<core::RecCalculatorImplBase> calculator;
+        std::vector<std::function<void()>> actions = {
+            [&](){calculator = recCalculator.CreateCalculator(data, list.user.fetchedFics, params, list.user.moodData);},
+            [&](){calculator->FetchAuthorRelations();},
+            [&](){
+                calculator->params->ratioCutoff = calculator->ratioCutoff;
+                calculator->RunMatchingAndWeighting(calculator->params);
+            },
+            [&](){
+                calculator->CalculateNegativeToPositiveRatio();
+                calculator->CollectVotes();
+            },
+        };
+        for(size_t stage = 0; stage < stages.size(); stage++)
+        {
+            allocationCount = 0;
+            allocatedBytes = 0;
+            countAllocations = true;
+            auto start = std::chrono::steady_clock::now();
+            actions[stage]();
+            auto elapsed = std::chrono::steady_clock::now() - start;
+            countAllocations = false;
+            stages[stage].microseconds.push_back(std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
+            // the first pass fills the workspace pool, later ones show the steady state
+            stages[stage].allocations = allocationCount;
+            stages[stage].bytes = allocatedBytes;
+        }
+    }
+    return stages;
+}
+
+void SetupLogger(QString settingsFile)
+{
+    QSettings settings(settingsFile, QSettings::IniFormat);
+    An<QsLogging::Logger> logger;
+    // calculator logs every step, only problems are interesting here
+    logger->setLoggingLevel(static_cast<QsLogging::Level>(settings.value("Logging/loglevel", 3).toInt()));
+    QsLogging::DestinationPtr debugDestination(
+                QsLogging::DestinationFactory::MakeDebugOutputDestination() );
+    logger->addDestination(debugDestination);
+}
+
+// golden outputs aren't checked in, they depend on the settings and are generated from the build
+// the change is compared against, see goldenFolder in settings_bench.ini
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+    a.setApplicationName("reclist_bench");
+    const bool updateGolden = a.arguments().contains("--update-golden");
+
+    const QString settingsFile = "settings/settings_bench.ini";
+    SetupLogger(settingsFile);
+    QSettings settings(settingsFile, QSettings::IniFormat);
+    settings.beginGroup("Bench");
+    bench::SyntheticDataOptions options;
+    options.seed = settings.value("seed", 1).toULongLong();
+    options.authors = settings.value("authors", options.authors).toInt();
+    options.fics = settings.value("fics", options.fics).toInt();
+    options.fandoms = settings.value("fandoms", options.fandoms).toInt();
+    options.minListSize = settings.value("minListSize", options.minListSize).toInt();
+    options.maxListSize = settings.value("maxListSize", options.maxListSize).toInt();
+    options.listSizeExponent = settings.value("listSizeExponent", options.listSizeExponent).toDouble();
+    options.popularityExponent = settings.value("popularityExponent", options.popularityExponent).toDouble();
+    options.fandomsPerAuthor = settings.value("fandomsPerAuthor", options.fandomsPerAuthor).toInt();
+    options.ownFandomShare = settings.value("ownFandomShare", options.ownFandomShare).toDouble();
+    const int iterations = std::max(1, settings.value("iterations", 5).toInt());
+    const int threadBudget = settings.value("threadBudget", 0).toInt();
+    const int topSize = settings.value("goldenTopSize", 100).toInt();
+    const QString goldenFolder = settings.value("goldenFolder", "bench_golden").toString();
+    const QString storageFolder = settings.value("storageFolder", "BenchData").toString();
+    const std::vector<std::pair<QString, int>> listSizes = {{"small", settings.value("smallList", 10).toInt()},
+                                                            {"medium", settings.value("mediumList", 100).toInt()},
+                                                            {"huge", settings.value("hugeList", 1500).toInt()}};
+    settings.endGroup();
+
+    QTextStream out(stdout);
+    bench::SyntheticFavourites generator(options);
+    QSharedPointer<core::DataHolder> holder(new core::DataHolder(settingsFile, {}, {}));
+    holder->CreateTempDataDir(storageFolder);
+    generator.Fill(*holder, storageFolder);
+
+    core::RecCalculator recCalculator(settingsFile);
+    recCalculator.threadBudget = threadBudget;
+    recCalculator.SetSnapshot(holder);
+    auto data = recCalculator.Snapshot();
+
+    std::vector<BenchList> lists;
+    for(size_t i = 0; i < listSizes.size(); i++)
+        lists.push_back({listSizes[i].first, generator.CreateUser(*data, listSizes[i].second, i)});
+
+    const std::vector<BenchMode> modes = {{"default", false, false}, {"weighted", true, false}, {"mood_adjusted", true, true}};
+
+    QDir().mkpath(goldenFolder);
+    bool goldenMatches = true;
+    ankerl::nanobench::Bench nanobench;
+    nanobench.title("reclist creation").unit("list").minEpochIterations(static_cast<uint64_t>(iterations)).relative(false);
+    for(const auto& mode : modes)
+    {
+        // every list is also created once more as part of a batch, it has to come out the same
+        // params are changed while a list is created so every batch gets its own
+        auto batchInputs = [&](){
+            QVector<core::ReclistCreationInput> inputs;
+            for(const auto& list : lists)
+                inputs.push_back({list.user.fetchedFics, CreateParams(mode, list.user), list.user.moodData});
+            return inputs;
+        };
+        std::vector<QStringList> singleResults;
+        for(const auto& list : lists)
+        {
+            const QString name = mode.name + "_" + list.name;
+            out << "\n" << name << ": " << list.user.fetchedFics.size() << " source fics\n";
+            out.flush();
+
+            nanobench.run(name.toStdString(), [&](){
+                auto result = recCalculator.GetMatchedFicsForFavList(data, list.user.fetchedFics, CreateParams(mode, list.user), list.user.moodData);
+                ankerl::nanobench::doNotOptimizeAway(result.votes.Size());
+            });
+
+            for(const auto& stage : MeasureStages(recCalculator, data, mode, list, iterations))
+                out << QString("  %1 median: %2us allocations: %3 bytes: %4\n")
+                       .arg(stage.name, -24).arg(Median(stage.microseconds)).arg(stage.allocations).arg(stage.bytes);
+
+            auto result = recCalculator.GetMatchedFicsForFavList(data, list.user.fetchedFics, CreateParams(mode, list.user), list.user.moodData);
+            auto lines = DescribeResult(result, topSize);
+            singleResults.push_back(lines);
+            const QString goldenFile = goldenFolder + "/" + name + ".txt";
+            if(updateGolden)
+            {
+                if(!WriteGolden(goldenFile, lines))
+                {
+                    out << "  couldn't write " << goldenFile << "\n";
+                    goldenMatches = false;
+                }
+                continue;
+            }
+            auto golden = ReadGolden(goldenFile);
+            if(golden.isEmpty())
+            {
+                out << "  no golden output in " << goldenFile << ", run with --update-golden to create it\n";
+                goldenMatches = false;
+            }
+            else if(golden != lines)
+            {
+                int line = 0;
+                while(line < std::min(golden.size(), lines.size()) && golden[line] == lines[line])
+                    line++;
+                out << "  result differs from " << goldenFile << " at line " << line + 1 << ": expected \""
+                    << golden.value(line) << "\" got \"" << lines.value(line) << "\"\n";
+                goldenMatches = false;
+            }
+            else
+                out << "  result matches golden output\n";
+        }
+
+        const QString batchName = mode.name + "_batch";
+        out << "\n" << batchName << ": " << lists.size() << " lists\n";
+        out.flush();
+        nanobench.run(batchName.toStdString(), [&](){
+            auto results = recCalculator.GetMatchedFicsForFavLists(data, batchInputs());
+            ankerl::nanobench::doNotOptimizeAway(results.size());
+        });
+        auto batchResults = recCalculator.GetMatchedFicsForFavLists(data, batchInputs());
+        for(size_t i = 0; i < singleResults.size(); i++)
+        {
+            if(i < static_cast<size_t>(batchResults.size()) && DescribeResult(batchResults[static_cast<int>(i)], topSize) == singleResults[i])
+                continue;
+            out << "  batch result for " << lists[i].name << " list differs from the single list\n";
+            goldenMatches = false;
+        }
+    }
+    out.flush();
+    return goldenMatches ? 0 : 1;
+}
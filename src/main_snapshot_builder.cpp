@@ -0,0 +1,146 @@
+/*
+Flipper is a recommendation and search engine for fanfiction.net
+Copyright (C) 2017-2020  Marchenko Nikolai
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+#include "include/data_code/server_data_builder.h"
+#include "include/data_code/rec_calc_data.h"
+#include "include/data_code/fic_cooccurrence.h"
+#include "include/sqlitefunctions.h"
+#include "include/Interfaces/interface_sqlite.h"
+#include "include/Interfaces/ffn/ffn_authors.h"
+#include "include/Interfaces/ffn/ffn_fanfics.h"
+#include "include/Interfaces/genres.h"
+#include "include/timeutils.h"
+#include "logger/QsLog.h"
+
+#include <QCoreApplication>
+#include <QSettings>
+
+#include <algorithm>
+#include <limits>
+
+// builds ServerData from CrawlerDB without a running server, or adds a delta with what changed since the last run
+// feed servers pick the result up once the manifest is written
+// started with --fic-relations it only counts fic pairs over the favourite lists into FicRelations/folder
+void SetupLogger(QString settingsFile)
+{
+    QSettings settings(settingsFile, QSettings::IniFormat);
+    An<QsLogging::Logger> logger;
+    logger->setLoggingLevel(static_cast<QsLogging::Level>(settings.value("Logging/loglevel", 0).toInt()));
+    QsLogging::DestinationPtr debugDestination(
+                QsLogging::DestinationFactory::MakeDebugOutputDestination() );
+    logger->addDestination(debugDestination);
+    QString logFile = settings.value("Logging/filename").toString();
+    if(!logFile.isEmpty())
+    {
+        QsLogging::DestinationPtr fileDestination(
+                    QsLogging::DestinationFactory::MakeFileDestination(logFile,
+                                                                       settings.value("Logging/rotate", true).toBool(),
+                                                                       settings.value("Logging/filesize", 512).toInt()*1000000,
+                                                                       settings.value("Logging/amountOfFilesToKeep", 50).toInt()));
+        logger->addDestination(fileDestination);
+    }
+}
+
+bool BuildFicRelations(QSettings& settings, QSharedPointer<interfaces::Authors> authors, QSharedPointer<interfaces::Fanfics> fanfics)
+{
+    core::FicCooccurrenceBuilder::Options options;
+    options.folder = settings.value("FicRelations/folder", "FicRelations").toString();
+    options.threads = settings.value("FicRelations/threads", 0).toInt();
+    // the builder counts pairs, 8 bytes each, large settings would overflow int when counted in bytes
+    const qint64 bytesPerThread = settings.value("FicRelations/memoryPerThreadMb", 64).toLongLong()*1024*1024;
+    options.pairsPerRun = static_cast<int>(std::clamp<qint64>(bytesPerThread/static_cast<qint64>(sizeof(uint64_t)),
+                                                              1024, std::numeric_limits<int>::max()));
+    options.partitions = settings.value("FicRelations/partitions", 64).toInt();
+    options.maxRunsPerMerge = settings.value("FicRelations/maxRunsPerMerge", 32).toInt();
+    options.maxListSize = settings.value("FicRelations/maxListSize", 1200).toInt();
+    options.minMeetings = settings.value("FicRelations/minMeetings", 2).toInt();
+
+    QVector<core::FicWeightPtr> fics;
+    QHash<int, Roaring> favourites;
+    TimedAction loadAction("Loading data for fic relations",[&](){
+        fics = fanfics->GetAllFicsWithEnoughFavesForWeights(settings.value("FicRelations/minFaves", 25).toInt());
+        favourites = core::DataHolderInfo<core::rdt_favourites>::loadFunc()(authors);
+    });
+    loadAction.run();
+    Roaring ficIds;
+    for(const auto& fic : std::as_const(fics))
+        ficIds.add(static_cast<uint32_t>(fic->id));
+    fics.clear();
+
+    core::FicCooccurrenceBuilder builder(options);
+    if(!builder.Build(favourites, ficIds))
+        return false;
+    QLOG_INFO() << "fic relations for lists: " << builder.ListCount() << " pairs: " << builder.PairCount() << " written into: " << options.folder;
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+    a.setApplicationName("snapshot_builder");
+
+    const QString settingsFile = "settings/settings_snapshot_builder.ini";
+    SetupLogger(settingsFile);
+    QSettings settings(settingsFile, QSettings::IniFormat);
+    const auto storageFolder = settings.value("Settings/storageFolder", "ServerData").toString();
+    const auto databaseFolder = settings.value("Settings/databaseFolder", "database").toString();
+    // the crawler bumps lastDBUpdate in the server's settings when it's done with the database
+    QSettings serverSettings(settings.value("Settings/serverSettings", "settings/settings_server.ini").toString(), QSettings::IniFormat);
+    const auto databaseUpdate = serverSettings.value("Settings/lastDBUpdate", "").toString();
+
+    QSharedPointer<database::IDBWrapper> dbInterface (new database::SqliteInterface());
+    dbInterface->SetDatabase(database::sqlite::InitAndUpdateSqliteDatabaseForFile(databaseFolder,"CrawlerDB","dbcode/dbinit.sql", "SnapshotBuilder", true));
+    auto mainDb = dbInterface->GetDatabase();
+
+    auto authors = QSharedPointer<interfaces::Authors> (new interfaces::FFNAuthors());
+    authors->db = mainDb;
+    auto fanfics = QSharedPointer<interfaces::Fanfics> (new interfaces::FFNFanfics());
+    fanfics->db = mainDb;
+    auto genres = QSharedPointer<interfaces::Genres> (new interfaces::Genres());
+    genres->db = mainDb;
+    fanfics->authorInterface = authors;
+    core::DataHolder data(settingsFile, authors, fanfics);
+    data.genresInterface = genres;
+    if(a.arguments().contains("--fic-relations"))
+        return BuildFicRelations(settings, authors, fanfics) ? 0 : 1;
+    data.CreateTempDataDir(storageFolder);
+
+    const int maxDeltas = settings.value("Settings/maxSnapshotDeltas", 14).toInt();
+    core::SnapshotManifest manifest;
+    // manifests written before deltas existed don't know what time their data is from
+    const bool canAddDelta = maxDeltas > 0 && !a.arguments().contains("--full")
+            && manifest.Read(storageFolder) && manifest.Matches(storageFolder) && manifest.dataTimestamp.isValid();
+    bool built = false;
+    if(canAddDelta)
+    {
+        QLOG_INFO() << "collecting changes for database update: " << databaseUpdate << " since: " << manifest.dataTimestamp;
+        built = core::BuildServerDelta(data, storageFolder, manifest, databaseUpdate);
+        if(built && manifest.deltas.size() >= maxDeltas)
+            built = core::CompactServerData(data, storageFolder, manifest);
+    }
+    else
+    {
+        QLOG_INFO() << "building snapshot for database update: " << databaseUpdate << " into: " << storageFolder;
+        built = core::BuildServerData(data, storageFolder, databaseUpdate);
+    }
+    if(!built)
+    {
+        QLOG_ERROR() << "snapshot wasn't built";
+        return 1;
+    }
+    return 0;
+}
@@ -18,6 +18,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #include "pure_sql.h"
 #include "transaction.h"
 #include "core/section.h"
+#include "core/top_k.h"
 #include "pagetask.h"
 #include "url_utils.h"
 #include "Interfaces/genres.h"
@@ -881,6 +882,20 @@ DiagnosticSQLResult<QHash<int, QSet<int>>> LoadFullFavouritesHashset(sql::Databa
     return std::move(ctx.result);
 }
 
+DiagnosticSQLResult<QHash<int, QSet<int>>> LoadFavouritesHashsetUpdatedSince(QDateTime date, sql::Database db)
+{
+    std::string qs = "select recommender_id, fic_id from recommendations where recommender_id in "
+                     " (select id from recommenders where last_favourites_update > :date) "
+                     " order by recommender_id";
+
+    SqlContext<QHash<int, QSet<int>>> ctx(db, std::move(qs));
+    ctx.bindValue("date", date);
+    ctx.ForEachInSelect([&](sql::Query& q){
+        ctx.result.data[q.value("recommender_id").toInt()].insert(q.value("fic_id").toInt());
+    });
+    return std::move(ctx.result);
+}
+
 DiagnosticSQLResult<core::AuthorPtr> GetAuthorByUrl(QString url, sql::Database db)
 {
     std::string qs = "select r.id,name, r.url, r.ffn_id, r.ao3_id, r.sb_id, r.sv_id, "
@@ -1746,63 +1761,81 @@ DiagnosticSQLResult<bool> WriteDetectedGenresIteration2(QVector<genre_stats::Fic
     return std::move(ctx.result);
 }
 
-DiagnosticSQLResult<QHash<int, QList<genre_stats::GenreBit>>> GetFullGenreList(sql::Database db,bool useOriginalOnly)
+static QList<genre_stats::GenreBit> GenreBitsFromQuery(sql::Query& q, bool useOriginalOnly)
 {
-    std::string qs = "select id, genres, "
-                         " true_genre1, "
-                         " true_genre1_percent,"
-                         " true_genre2, "
-                         " true_genre2_percent,"
-                         " true_genre3,"
-                         " true_genre3_percent"
-                         " from fanfics";
+    QList<genre_stats::GenreBit> dataForFic;
+    QString genres = QString::fromStdString(q.value("genres").toString());
+    if(QString::fromStdString(q.value("true_genre1").toString()).trimmed().isEmpty() || useOriginalOnly)
+    {
+        // genres not detected
 
-    SqlContext<QHash<int, QList<genre_stats::GenreBit>>> ctx (db, std::move(qs));
-    ctx.ForEachInSelect([&](sql::Query& q){
-        QList<genre_stats::GenreBit> dataForFic;
-        auto id = q.value("id").toInt();
-        QString genres = QString::fromStdString(q.value("genres").toString());
-        if(QString::fromStdString(q.value("true_genre1").toString()).trimmed().isEmpty() || useOriginalOnly)
+        genres = genres.replace("Hurt/Comfort", "HurtComfort");
+        auto list = genres.split("/");
+        list.replaceInStrings("HurtComfort","Hurt/Comfort");
+        dataForFic.reserve(list.size());
+        for(const auto& genreBit: list)
         {
-            // genres not detected
+            genre_stats::GenreBit bit;
+            bit.genres.push_back(genreBit);
+            bit.isInTheOriginal = true;
+            bit.relevance = 1;
+            dataForFic.push_back(bit);
+        }
+    }
+    else{
 
-            genres = genres.replace("Hurt/Comfort", "HurtComfort");
-            auto list = genres.split("/");
-            list.replaceInStrings("HurtComfort","Hurt/Comfort");
-            dataForFic.reserve(list.size());
-            for(const auto& genreBit: list)
-            {
-                genre_stats::GenreBit bit;
-                bit.genres.push_back(genreBit);
-                bit.isInTheOriginal = true;
-                bit.relevance = 1;
-                dataForFic.push_back(bit);
+        // genres detected
+        for(int i = 1; i < 4; i++)
+        {
+            auto tgKey = "true_genre" + std::to_string(i);
+            auto tgKeyValue = "true_genre" + std::to_string(i) + "_percent";
+            auto genre = q.value(tgKey).toString();
+            if(genre.empty()){
+                break;
             }
+
+            genre_stats::GenreBit bit;
+            bit.genres = QString::fromStdString(genre).split(QRegExp("[\\s,]"), Qt::SkipEmptyParts);
+            bit.relevance = q.value(tgKeyValue).toFloat();
+            bit.isDetected = true;
+            for(const auto& genreBit : std::as_const(bit.genres))
+                if(genres.contains(genreBit))
+                    bit.isInTheOriginal = true;
+
+            dataForFic.push_back(bit);
         }
-        else{
+    }
+    return dataForFic;
+}
 
-            // genres detected
-            for(int i = 1; i < 4; i++)
-            {
-                auto tgKey = "true_genre" + std::to_string(i);
-                auto tgKeyValue = "true_genre" + std::to_string(i) + "_percent";
-                auto genre = q.value(tgKey).toString();
-                if(genre.empty()){
-                    break;
-                }
+static const std::string genreListQuery = "select id, genres, "
+                                          " true_genre1, "
+                                          " true_genre1_percent,"
+                                          " true_genre2, "
+                                          " true_genre2_percent,"
+                                          " true_genre3,"
+                                          " true_genre3_percent"
+                                          " from fanfics";
 
-                genre_stats::GenreBit bit;
-                bit.genres = QString::fromStdString(genre).split(QRegExp("[\\s,]"), Qt::SkipEmptyParts);
-                bit.relevance = q.value(tgKeyValue).toFloat();
-                bit.isDetected = true;
-                for(const auto& genreBit : std::as_const(bit.genres))
-                    if(genres.contains(genreBit))
-                        bit.isInTheOriginal = true;
+DiagnosticSQLResult<QHash<int, QList<genre_stats::GenreBit>>> GetFullGenreList(sql::Database db,bool useOriginalOnly)
+{
+    std::string qs = genreListQuery;
 
-                dataForFic.push_back(bit);
-            }
-        }
-        ctx.result.data[id] = dataForFic;
+    SqlContext<QHash<int, QList<genre_stats::GenreBit>>> ctx (db, std::move(qs));
+    ctx.ForEachInSelect([&](sql::Query& q){
+        ctx.result.data[q.value("id").toInt()] = GenreBitsFromQuery(q, useOriginalOnly);
+    });
+    return std::move(ctx.result);
+}
+
+DiagnosticSQLResult<QHash<int, QList<genre_stats::GenreBit>>> GetGenreListUpdatedSince(QDateTime date, sql::Database db, bool useOriginalOnly)
+{
+    std::string qs = genreListQuery + " where lastupdate >= date(:date)";
+
+    SqlContext<QHash<int, QList<genre_stats::GenreBit>>> ctx (db, std::move(qs));
+    ctx.bindValue("date", date);
+    ctx.ForEachInSelect([&](sql::Query& q){
+        ctx.result.data[q.value("id").toInt()] = GenreBitsFromQuery(q, useOriginalOnly);
     });
     return std::move(ctx.result);
 }
@@ -3744,6 +3777,19 @@ DiagnosticSQLResult<QVector<core::FicWeightPtr> > GetAllFicsWithEnoughFavesForWe
     return std::move(ctx.result);
 }
 
+DiagnosticSQLResult<QVector<core::FicWeightPtr> > GetFicsWithEnoughFavesForWeightsUpdatedSince(int faves, QDateTime date, sql::Database db)
+{
+    SqlContext<QVector<core::FicWeightPtr>> ctx(db);
+    ctx.bindValue("date", date);
+    std::string qs = fmt::format("select id,Rated, author_id, complete, updated, fandom1,fandom2,favourites, published, updated,  genres, reviews, filter_pass_1, wordcount"
+                         "  from fanfics where favourites > {0} and lastupdate >= date(:date) order by id", faves);
+    ctx.FetchSelectFunctor(std::move(qs), DATAQ{
+                               auto fw = getFicWeightPtrFromQuery(q);
+                               data.push_back(fw);
+                           });
+    return std::move(ctx.result);
+}
+
 
 DiagnosticSQLResult<QHash<int, core::AuthorFavFandomStatsPtr>> GetAuthorListFandomStatistics(QList<int> authors, sql::Database db)
 {
@@ -4115,19 +4161,17 @@ static QHash<int, int> RecastFicScoresIntoPedestalSet(QSharedPointer<core::Recom
 }
 
 static QHash<int, int> CreateFicPositions(QSharedPointer<core::RecommendationListFicData> ficData){
-
-    // first we need to fill the hash of scores per fic
-    QHash<int, int> scores;
     QHash<int, int> positions;
-    QVector ficsCopy = ficData->fics;
+    std::vector<core::ScoredId> ranking;
+    ranking.reserve(ficData->fics.size());
     for(int i = 0; i < ficData->fics.size(); i++)
-        scores[ficData->fics[i]] = ficData->metascores.at(i);
+        ranking.push_back({ficData->metascores.at(i), ficData->fics[i]});
 
-    std::sort(ficsCopy.begin(), ficsCopy.end(), [&](const int& fic1, const int& fic2){
-        return scores[fic1] > scores[fic2] ;
-    });
-    for(int i = 0; i < ficData->fics.size(); i++){
-        positions[ficsCopy[i]] = i+1;
+    // same order LimitResults uses so that equal scores always end up in the same positions
+    std::sort(ranking.begin(), ranking.end(), core::RanksHigher);
+    positions.reserve(static_cast<int>(ranking.size()));
+    for(size_t i = 0; i < ranking.size(); i++){
+        positions[ranking[i].id] = static_cast<int>(i)+1;
     }
     return positions;
 }
@@ -16,10 +16,12 @@ You should have received a copy of the GNU General Public License
 along with this program.  If not, see <http://www.gnu.org/licenses/>
 */
 #include "include/rec_calc/rec_calculator_base.h"
+#include "include/core/top_k.h"
 #include "timeutils.h"
 #include "third_party/nanobench/nanobench.h"
 #include <QFuture>
 #include <QtConcurrent>
+#include <cmath>
 #include <execution>
 
 namespace core{
@@ -29,73 +31,15 @@ void RecCalculatorImplBase::ResetAccumulatedData()
     filteredAuthors.clear();
 }
 
-auto threadedIntListProcessor = [](QString taskName, int threadsToUse, QList<int> list, auto worker, auto resultingDataProcessor){
-    QVector<std::pair<QList<int>::const_iterator,QList<int>::const_iterator>> iterators;
-    int chunkSize = list.size()/threadsToUse;
-    int listSize = list.size();
-    int  i = 0;
-    iterators.reserve(threadsToUse);
-    while(i*chunkSize < listSize)
-    {
-        QList<int>::const_iterator begin = list.cbegin();
-        QList<int>::const_iterator end = list.cbegin();
-        std::advance(begin, i*chunkSize);
-        int rightBorder = i*chunkSize + chunkSize;
-        if(rightBorder < list.size())
-            std::advance(end, rightBorder);
-        else
-            end = list.cend();
-        iterators.push_back({begin, end});
-        i++;
-    }
-    typedef std::pair<QList<int>::const_iterator,QList<int>::const_iterator> PairType;
-    TimedAction task(taskName,[&](){
-        QVector<QFuture<decltype(worker(std::declval<PairType>()))>> futures;
-        for(int i = 0; i < iterators.size(); i++)
-            futures.push_back(QtConcurrent::run(std::bind(worker,iterators.at(i))));
-        for(auto future: futures)
-            future.waitForFinished();
-        for(const auto& future: futures)
-            resultingDataProcessor(future.result());
-    });
-    task.run();
-};
-
-auto threadedIntListTupleProcessor = [](QString taskName, int threadsToUse, QList<int> list, auto worker, auto resultingDataProcessor){
-    QVector<std::tuple<QList<int>::const_iterator,QList<int>::const_iterator,QList<int>::const_iterator>> iterators;
-    int chunkSize = list.size()/threadsToUse;
-    int listSize = list.size();
-    int  i = 0;
-    iterators.reserve(threadsToUse);
-    while(i*chunkSize < listSize)
-    {
-        QList<int>::const_iterator begin = list.cbegin();
-        QList<int>::const_iterator end = list.cbegin();
-        std::advance(begin, i*chunkSize);
-        int rightBorder = i*chunkSize + chunkSize;
-        if(rightBorder < list.size())
-            std::advance(end, rightBorder);
-        else
-            end = list.cend();
-        iterators.push_back({list.begin(),begin, end});
-        i++;
-    }
-    typedef std::tuple<QList<int>::const_iterator,QList<int>::const_iterator,QList<int>::const_iterator> TupleType;
-    TimedAction task(taskName,[&](){
-        QVector<QFuture<decltype(worker(std::declval<TupleType>()))>> futures;
-        for(int i = 0; i < iterators.size(); i++)
-            futures.push_back(QtConcurrent::run(std::bind(worker,iterators.at(i))));
-        for(auto future: futures)
-            future.waitForFinished();
-        for(const auto& future: futures)
-            resultingDataProcessor(future.result());
-    });
-    task.run();
-};
+thread_boost::ParallelForOptions RecCalculatorImplBase::ParallelOptions(size_t grain) const
+{
+    thread_boost::ParallelForOptions options;
+    options.threads = threadBudget > 0 ? threadBudget : QThread::idealThreadCount() - 3;
+    options.grain = grain;
+    return options;
+}
 
 bool RecCalculatorImplBase::Calc(){
-    auto filters = GetFilterList();
-    auto actions = GetActionList();
     //TimedAction relations("Fetching relations",[&](){
         //ankerl::nanobench::Bench().minEpochIterations(2).run(
                     //[&](){
@@ -103,8 +47,12 @@ bool RecCalculatorImplBase::Calc(){
         //});
     //});
     //relations.run();
+    return CalcFromRelations();
+}
+
+bool RecCalculatorImplBase::CalcFromRelations(){
     params->ratioCutoff = ratioCutoff;
-    RunMatchingAndWeighting(params, filters, actions);
+    RunMatchingAndWeighting(params);
     QLOG_INFO() << "filtered authors after default pass:" << filteredAuthors.size();
 
     CalculateNegativeToPositiveRatio();
@@ -124,31 +72,28 @@ bool RecCalculatorImplBase::Calc(){
 
     report.run();
     //ReportNegativeResults();
-    if(needsDiagnosticData)
-        FillFilteredAuthorsForFics();
     return true;
 }
 
-void RecCalculatorImplBase::RunMatchingAndWeighting(QSharedPointer<RecommendationList> params, const FilterListType& filters, const ActionListType& actions)
+void RecCalculatorImplBase::RunMatchingAndWeighting(QSharedPointer<RecommendationList> params)
 {
-    int  i = 0;
-    AutoAdjustmentAndFilteringResult firstAdjustmentResult;
-    do
-    {
-        ResetAccumulatedData();
-        TimedAction filtering("Filtering data",[&](){
-            Filter(params, filters, actions);
-        });
-        filtering.run();
+    // filters run once, matching authors are then picked from the histogram
+    TimedAction histogram("Building match histogram",[&](){
+        BuildMatchHistogram(*params);
+    });
+    histogram.run();
 
-        TimedAction weighting("weighting",[&](){
-            CalcWeightingParams();
-        });
-        weighting.run();
-        if(!params->isAutomatic && !params->adjusting)
-            break;
-        i++;
-    }while(params->adjusting);
+    // a single pass, nothing here would ever clear params->adjusting to end a loop
+    ResetAccumulatedData();
+    TimedAction filtering("Filtering data",[&](){
+        SelectMatchingAuthors(*params);
+    });
+    filtering.run();
+
+    TimedAction weighting("weighting",[&](){
+        CalcWeightingParams();
+    });
+    weighting.run();
 }
 
 double GetCoeffForTouchyDiff(double diff, bool useScaleDown = true)
@@ -173,190 +118,201 @@ double GetCoeffForTouchyDiff(double diff, bool useScaleDown = true)
 
 
 QSet<int> LimitResults(QSharedPointer<RecommendationList> params,
-                       RecommendationListResult& result,
+                       const FicVoteData& votes,
                        QHash<uint32_t, core::FicWeightPtr>& fetchedFics){
     QSet<int> limiterResults;
-    std::list<int> scores;
-    std::list<int> ids;
-        scores.clear();
-        ids.clear();
-        if(params->resultLimit != 0){
-
-            auto itHash = result.recommendations.cbegin();
-            auto itHashEnd = result.recommendations.cend();
-            bool top = false;
-            bool bubble = false;
-
-            while(itHash != itHashEnd){
-                top = false;
-                bubble = false;
-                auto& key = itHash.key();
-                auto& value = itHash.value();
-                if(fetchedFics.contains(key))
-                {
-                    itHash++;
-                    continue;
-                }
-                if(scores.back() <= value)
-                    top = true;
-                else if(scores.front() < value || scores.size() < params->resultLimit)
-                    bubble = true;
-                else if(scores.front() == value)
-                {
-                    if(scores.size() < params->resultLimit)
-                        bubble = true;
-                }
-                if(top)
-                {
-                    scores.push_back(value);
-                    ids.push_back(key);
-                    if(scores.size() > params->resultLimit)
-                    {
-                        scores.pop_front();
-                        ids.pop_front();
-                    }
-                }
-                else if(bubble){
-                    auto itList = scores.cbegin();
-                    auto itListEnd = scores.cend();
-                    int counter = 0;
-                    while(itList!=itListEnd){
-                        if(*itList >= value){
-                            break;
-                        }
-                        counter++;
-                        itList++;
-                    }
-                    if(counter > 0 || scores.size() < params->resultLimit){
-                        auto itChange = scores.cbegin();
-                        auto itChangeIds = ids.cbegin();
-                        std::advance(itChange, counter);
-                        std::advance(itChangeIds, counter);
-                        scores.insert(itChange, value);
-                        ids.insert(itChangeIds, key);
-                    }
-                    if(scores.size() > params->resultLimit)
-                    {
-                        scores.pop_front();
-                        ids.pop_front();
-                    }
-                }
-                itHash++;
-            }
-        }
+    if(params->resultLimit <= 0)
+        return limiterResults;
 
-//    auto itScores = scores.cbegin();
-//    auto itIds = ids.cbegin();
-//    qDebug() << "LIMITS RESULTS";
-//    for(auto i = 0 ; i < params->resultLimit; i++)
-//    {
-//        qDebug() << *itScores << " " << *itIds;
-//        itScores++;itIds++;
-//    }
-    for(auto id: ids){
-        limiterResults.insert(id);
+    TopK best(static_cast<size_t>(params->resultLimit));
+    for(size_t i = 0; i < votes.Size(); i++){
+        if(fetchedFics.contains(votes.ficIds[i]))
+            continue;
+        best.Push(votes.recommendations[i], static_cast<int>(votes.ficIds[i]));
     }
+    limiterResults.reserve(static_cast<int>(best.Size()));
+    for(const auto& fic: best.Take())
+        limiterResults.insert(fic.id);
     return limiterResults;
 }
 
 
+template <typename Func>
+inline void ForEachFicInRange(const Roaring& favourites, uint32_t firstFic, uint32_t lastFic, Func&& func){
+    auto it = favourites.begin();
+    it.equalorlarger(firstFic);
+    const auto& itEnd = favourites.end();
+    for(; it != itEnd && *it <= lastFic; ++it)
+        func(*it);
+}
+
+void FicVoteData::Resize(size_t size)
+{
+    ficIds.resize(size);
+    recommendations.assign(size, 0);
+    pureMatches.assign(size, 0);
+    decentMatches.assign(size, 0);
+    sumNegativeMatches.assign(size, 0);
+    sumNegativeVotes.assign(size, 0);
+    breakdownCounts.assign(size, {});
+    breakdownVotes.assign(size, {});
+}
+
+void RecCalculatorImplBase::AssignAuthorVote(AuthorVote& authorVote, const AuthorResult& author,
+                                             const AuthorWeightingResult& weighting, std::optional<double> touchyMoodSimilarity) const
+{
+    const uint32_t negativeMatchCutoff = negativeAverage/3;
+    double matchCountSimilarityCoef = weighting.GetCoefficient();
+    authorVote.negativeMatches = author.negativeMatches;
+    authorVote.belowNegativeCutoff = author.negativeMatches <= negativeMatchCutoff;
+
+    double vote = votesBase;
+
+    double moodCoef  = 1;
+    if(touchyMoodSimilarity.has_value())
+    {
+
+        if(weighting.authorType == core::AuthorWeightingResult::EAuthorType::rare ||
+                weighting.authorType == core::AuthorWeightingResult::EAuthorType::unique)
+            moodCoef = GetCoeffForTouchyDiff(touchyMoodSimilarity.value(), false);
+        else
+            moodCoef = GetCoeffForTouchyDiff(touchyMoodSimilarity.value());
+
+        if(moodCoef > 0.99)
+            authorVote.decentMatch = true;
+    }
+    vote = (votesBase + matchCountSimilarityCoef)*moodCoef;
+    if(doTrashCounting &&  ownMajorNegatives.cardinality() > startOfTrashCounting){
+        if(author.negativeToPositiveMatches > 1.5){
+            vote = 0;
+        }
+        else if(author.negativeToPositiveMatches > (averageNegativeToPositiveMatches*2))
+        {
+            vote = vote / (1 + (author.negativeToPositiveMatches - averageNegativeToPositiveMatches));
+        }
+        else if(author.negativeToPositiveMatches < (averageNegativeToPositiveMatches - averageNegativeToPositiveMatches/2.)){
+            vote = vote * (1 + (averageNegativeToPositiveMatches - author.negativeToPositiveMatches)*3);
+        }
+        else if(author.negativeToPositiveMatches < (averageNegativeToPositiveMatches - averageNegativeToPositiveMatches/3.))
+            vote = vote * (1 + ((averageNegativeToPositiveMatches - averageNegativeToPositiveMatches/3.) - author.negativeToPositiveMatches));
+    }
+    // votes are summed as integers, each author only ever contributed the whole part of its vote
+    authorVote.vote = static_cast<int>(vote);
+    authorVote.authorType = static_cast<int>(weighting.authorType);
+    authorVote.breakdownVote = 1+weighting.GetCoefficient();
+}
+
 bool RecCalculatorImplBase::CollectVotes()
 {
-    auto weightingFunc = GetWeightingFunc();
     auto authorSize = filteredAuthors.size();
     if(filteredAuthors.size() == 0)
         return false;
     qDebug() << "Max Matches:" <<  prevMaximumMatches;
-    std::for_each(filteredAuthors.cbegin(), filteredAuthors.cend(), [this](int author){
-        for(auto fic: inputs.faves[author])
+
+    // authors are kept in filteredAuthors order so that every fic gets its votes summed in the same order
+    std::pmr::vector<AuthorVote> authorVotes(&workspace->arena);
+    std::pmr::vector<const Roaring*> favouriteLists(&workspace->arena);
+    authorVotes.reserve(filteredAuthors.size());
+    favouriteLists.reserve(filteredAuthors.size());
+    for(auto author: std::as_const(filteredAuthors))
+    {
+        auto it = inputs.faves.constFind(author);
+        if(it == inputs.faves.cend())
+            continue;
+        AuthorVote authorVote;
+        authorVote.id = author;
+        authorVote.favourites = &it.value();
+        authorVotes.push_back(authorVote);
+        favouriteLists.push_back(&it.value());
+    }
+
+    // votes are accumulated into flat arrays indexed by the position of the fic
+    // among all fics that filtered authors have in their favourites
+    auto& votes = result.votes;
+    const auto& ordinals = inputs.ficOrdinals;
+    auto& localOrdinals = workspace->localOrdinals;
+    TimedAction ordinalsAction("Mapping voted fics",[&](){
+        Roaring votedFics;
+        if(!favouriteLists.empty())
+            votedFics = Roaring::fastunion(favouriteLists.size(), favouriteLists.data());
+        votes.Resize(votedFics.cardinality());
+        votedFics.toUint32Array(votes.ficIds.data());
+        if(localOrdinals.size() < ordinals.Size())
+            localOrdinals.resize(ordinals.Size(), FicOrdinals::invalid);
+        for(uint32_t i = 0; i < votes.ficIds.size(); i++)
         {
-            result.recommendations[fic]+= 1;
+            auto ordinal = ordinals.OrdinalForFic(votes.ficIds[i]);
+            if(ordinal != FicOrdinals::invalid)
+                localOrdinals[ordinal] = i;
         }
     });
+    ordinalsAction.run();
+    if(votes.Size() == 0)
+        return false;
+
+    // every chunk is a contiguous range of fics so workers never write into the same slot
+    // chunks are coarse because every one of them has to seek through all author lists
+    auto options = ParallelOptions(1024);
+    options.grain = std::max<size_t>(options.grain, votes.Size()/(std::max(1, options.threads)*8));
+    auto forEachVotedFic = [&](const AuthorVote& authorVote, size_t begin, size_t end, auto&& func){
+        ForEachFicInRange(*authorVote.favourites, votes.ficIds[begin], votes.ficIds[end-1], [&](uint32_t fic){
+            func(localOrdinals[ordinals.ordinalForFic[fic]]);
+        });
+    };
+
+    TimedAction pureVotesAction("Collecting pure votes",[&](){
+        thread_boost::ParallelFor(votes.Size(), options, [&](size_t begin, size_t end){
+            for(const auto& authorVote : authorVotes)
+                forEachVotedFic(authorVote, begin, end, [&](uint32_t ordinal){
+                    votes.pureMatches[ordinal]++;
+                });
+        });
+    });
+    pureVotesAction.run();
+
     int maxValue = 0;
     int maxId = -1;
+    for(size_t i = 0; i < votes.Size(); i++)
+    {
+        if(votes.pureMatches[i] > maxValue)
+        {
+            maxValue = votes.pureMatches[i];
+            maxId = static_cast<int>(votes.ficIds[i]);
+        }
+    }
 
     uint32_t negativeSum = 0;
     for(auto author: std::as_const(filteredAuthors))
         negativeSum+=allAuthors[author].negativeMatches;
     negativeAverage = negativeSum/filteredAuthors.size();
 
-    auto it = result.recommendations.cbegin();
-    while(it != result.recommendations.cend())
-    {
-        if(it.value() > maxValue )
-        {
-            maxValue = it.value();
-            maxId = it.key();
-        }
-        result.pureMatches[it.key()] = it.value();
-        it++;
-    }
     qDebug() << "Max pure votes: " << maxValue;
     qDebug() << "Max id: " << maxId;
-    result.recommendations.clear();
-    uint32_t negativeMatchCutoff = negativeAverage/3;
-
-    std::for_each(filteredAuthors.cbegin(), filteredAuthors.cend(), [maxValue,weightingFunc, authorSize, this, negativeMatchCutoff](int author){
-        for(auto fic: inputs.faves[author])
-        {
-            result.sumNegativeMatchesForFic[fic] += allAuthors[author].negativeMatches;
-            auto weighting = weightingFunc(allAuthors[author],authorSize, maxValue );
-            double matchCountSimilarityCoef = weighting.GetCoefficient();
-            if(allAuthors[author].negativeMatches <= negativeMatchCutoff)
-                result.sumNegativeVotesForFic[fic]++;
-
-
-            double vote = votesBase;
-
-            //std::optional<double> neutralMoodSimilarity = GetNeutralDiffForLists(author);
-
-            std::optional<double> touchyMoodSimilarity = GetTouchyDiffForLists(author);
-            double moodCoef  = 1;
-            if(touchyMoodSimilarity.has_value())
-            {
-
-                if(weighting.authorType == core::AuthorWeightingResult::EAuthorType::rare ||
-                        weighting.authorType == core::AuthorWeightingResult::EAuthorType::unique)
-                    moodCoef = GetCoeffForTouchyDiff(touchyMoodSimilarity.value(), false);
-                else
-                    moodCoef = GetCoeffForTouchyDiff(touchyMoodSimilarity.value());
-
-                if(moodCoef > 0.99)
-                    result.decentMatches[fic] = 1;
-                //                if(author == 77257)
-                //                    qDebug() << "similarity coef for author: " << 77257 << "is: " << coef;
-            }
-            vote = (votesBase + matchCountSimilarityCoef)*moodCoef;
-            if(doTrashCounting &&  ownMajorNegatives.cardinality() > startOfTrashCounting){
-                if(allAuthors[author].negativeToPositiveMatches > 1.5){
-                    vote = 0;
-                }
-                else if(allAuthors[author].negativeToPositiveMatches > (averageNegativeToPositiveMatches*2))
-                {
-                    vote = vote / (1 + (allAuthors[author].negativeToPositiveMatches - averageNegativeToPositiveMatches));
-                    //if(allAuthors[author].negativeToPositiveMatches > averageNegativeToPositiveMatches*2)
-                        //QLOG_INFO() << "reducing vote for fic: " << fic << "from: " << originalVote << " to: " << vote;
-                }
-                else if(allAuthors[author].negativeToPositiveMatches < (averageNegativeToPositiveMatches - averageNegativeToPositiveMatches/2.)){
-                    vote = vote * (1 + (averageNegativeToPositiveMatches - allAuthors[author].negativeToPositiveMatches)*3);
-                    //QLOG_INFO() << "increasing vote for fic: " << fic << "from: " << originalVote << " to: " << vote;
-                }
-                else if(allAuthors[author].negativeToPositiveMatches < (averageNegativeToPositiveMatches - averageNegativeToPositiveMatches/3.))
-                    vote = vote * (1 + ((averageNegativeToPositiveMatches - averageNegativeToPositiveMatches/3.) - allAuthors[author].negativeToPositiveMatches));
-
-//                else if(allAuthors[author].negativeToPositiveMatches < (averageNegativeToPositiveMatches))
-//                    vote = vote * (1 + (averageNegativeToPositiveMatches - allAuthors[author].negativeToPositiveMatches));
-            }
-
-            result.recommendations[fic]+= vote;
-            result.AddToBreakdown(fic, weighting.authorType, 1+weighting.GetCoefficient());
-        }
+    WeighAuthors(authorVotes, static_cast<int>(authorSize), maxValue);
+
+    TimedAction weightedVotesAction("Collecting weighted votes",[&](){
+        thread_boost::ParallelFor(votes.Size(), options, [&](size_t begin, size_t end){
+            for(const auto& authorVote : authorVotes)
+                forEachVotedFic(authorVote, begin, end, [&](uint32_t ordinal){
+                    votes.sumNegativeMatches[ordinal] += authorVote.negativeMatches;
+                    if(authorVote.belowNegativeCutoff)
+                        votes.sumNegativeVotes[ordinal]++;
+                    if(authorVote.decentMatch)
+                        votes.decentMatches[ordinal] = 1;
+                    votes.recommendations[ordinal] += authorVote.vote;
+                    votes.breakdownCounts[ordinal][authorVote.authorType]++;
+                    votes.breakdownVotes[ordinal][authorVote.authorType] += authorVote.breakdownVote;
+                });
+        });
     });
+    weightedVotesAction.run();
 
+    // the workspace expects every slot to be invalid once the list is done
+    for(auto fic : votes.ficIds)
+        localOrdinals[ordinals.ordinalForFic[fic]] = FicOrdinals::invalid;
 
     if(params->resultLimit != 0){
-        result.limitedResults = LimitResults(params,result, fetchedFics);
+        result.limitedResults = LimitResults(params,result.votes, fetchedFics);
     }
 
     return true;
@@ -514,48 +470,34 @@ Roaring RecCalculatorImplBase::BuildIgnoreList()
     QLOG_INFO() << "Building ignore list";
     QLOG_INFO() << "Ignored fics size:" << params->ignoredDeadFics.size();
     Roaring fullIgnores;
-    auto ficKeys = inputs.fics.keys();
 
-    auto worker = [&](const std::pair<QList<int>::const_iterator,QList<int>::const_iterator>& beginEnd){
-            auto itCurrent = beginEnd.first;
-            auto itEnd= beginEnd.second;
-            Roaring ignores;
-            while(itCurrent < itEnd)
-            {
-                auto& fic = inputs.fics[*itCurrent];
-                itCurrent++;
-
-                if(!fic)
-                    continue;
-
-                bool inIgnored = false;
-                // we don't ignore fics that are soruces for the recommednation list
-                if(params->ficData->sourceFics.contains(fic->id))
-                    continue;
-
-                // we don't ignore fics that user pressed negative tag on for weighting
-                if(params->majorNegativeVotes.contains(fic->id))
-                    continue;
-
-                // the fics that were maked as "Limbo"
-                if(params->ignoredDeadFics.contains(fic->id))
-                    inIgnored = true;
-
-                for(auto fandom: std::as_const(fic->fandoms))
-                {
-                    if(params->ignoredFandoms.contains(fandom) && fandom >= 1)
-                        inIgnored = true;
-                }
-                if(inIgnored)
-                    ignores.add(fic->id);
-            }
-            QLOG_INFO() << "returning ignored fics of size: " << ignores.cardinality();
-            return ignores;
-        };
-
-    threadedIntListProcessor("Creation of ignore list", QThread::idealThreadCount() - 3,ficKeys,  worker, [&fullIgnores](const Roaring& data){
-        fullIgnores= fullIgnores | data;
+    TimedAction action("Creation of ignore list",[&](){
+        std::vector<const Roaring*> ignoredFandoms;
+        ignoredFandoms.reserve(static_cast<size_t>(params->ignoredFandoms.size()));
+        for(auto fandom : std::as_const(params->ignoredFandoms))
+        {
+            if(fandom < 1)
+                continue;
+            auto it = inputs.ficsByFandom.constFind(fandom);
+            if(it != inputs.ficsByFandom.cend())
+                ignoredFandoms.push_back(&it.value());
+        }
+        if(!ignoredFandoms.empty())
+            fullIgnores = Roaring::fastunion(ignoredFandoms.size(), ignoredFandoms.data());
+
+        // the fics that were maked as "Limbo"
+        for(auto fic : std::as_const(params->ignoredDeadFics))
+            if(inputs.fics.Contains(fic))
+                fullIgnores.add(static_cast<uint32_t>(fic));
+
+        // we don't ignore fics that are soruces for the recommednation list
+        // or that user pressed negative tag on for weighting
+        for(auto fic : std::as_const(params->ficData->sourceFics))
+            fullIgnores.remove(static_cast<uint32_t>(fic));
+        for(auto fic : std::as_const(params->majorNegativeVotes))
+            fullIgnores.remove(static_cast<uint32_t>(fic));
     });
+    action.run();
     QLOG_INFO() << "fanfic ignore list is of size: " << fullIgnores.cardinality();
     return fullIgnores;
 
@@ -581,6 +523,8 @@ struct AuthorRelationsResult{
     std::vector<int> matchCounts;
     QMap<uint32_t, RatioInfo> ratioInfo;
     QMap<uint32_t, RatioSumInfo> ratioSumInfo;
+    // the maximum that was current right before the last time maximumMatches grew
+    uint prevMaximumMatches = 0;
 };
 template <typename T>
 void Save( const QMap<uint32_t, T>& data )
@@ -601,12 +545,104 @@ void Save( const QMap<uint32_t, T>& data )
 }
 
 
-void RecCalculatorImplBase::FetchAuthorRelations()
+Roaring RecCalculatorImplBase::FetchCandidateAuthors() const
 {
-    qDebug() << "faves is of size: " << inputs.faves.size();
-    allAuthors.clear();
-    std::vector<AuthorResult> tempAuthors;
-    tempAuthors.resize(inputs.faves.size());
+    if(params && params->useApproximateCandidates && inputs.favouritesSketch.IsReady())
+        return inputs.favouritesSketch.Candidates(ownFavourites);
+
+    // only the authors that have at least one of user's fics in their favourites can get any matches
+    // so there's no point in looking at anyone else
+    std::vector<const Roaring*> favouritedBy;
+    favouritedBy.reserve(ownFavourites.cardinality());
+    for(auto fic : ownFavourites)
+    {
+        auto it = inputs.favouritesByFic.constFind(static_cast<int>(fic));
+        if(it != inputs.favouritesByFic.cend())
+            favouritedBy.push_back(&it.value());
+    }
+    if(favouritedBy.empty())
+        return {};
+    return Roaring::fastunion(favouritedBy.size(), favouritedBy.data());
+}
+
+// fills author's relation to user's list and accumulates it into tempResult
+static void EvaluateAuthorRelation(const RecCalculatorImplBase& calc,
+                                   const Roaring& ignores,
+                                   const Roaring& authorFavourites,
+                                   AuthorResult& author,
+                                   AuthorRelationsResult& tempResult)
+{
+    const auto& tempAuthorRoaring = authorFavourites;
+    author.fullListSize = tempAuthorRoaring.cardinality();
+    const uint ignoredFics = tempAuthorRoaring.and_cardinality(ignores);
+    const auto unignoredSize = tempAuthorRoaring.cardinality() - ignoredFics;
+
+    // first we need to remove ignored fics
+    //auto unignoredSize = inputs.faves[author.id].xor_cardinality(ignoredTemp);
+    //Roaring temp = tempAuthorRoaring.operator&(ownFavourites);
+    author.matches = tempAuthorRoaring.and_cardinality(calc.ownFavourites);
+    author.negativeMatches = tempAuthorRoaring.and_cardinality(calc.ownMajorNegatives);
+    if(author.matches > 10 && static_cast<double>(author.negativeMatches)/static_cast<double>(author.matches) > 1.5)
+        author.matches = 0;
+    if(author.fullListSize > 10 && author.matches < 2 && calc.ownFavourites.cardinality() > 5)
+        author.matches = 0;
+    author.sizeAfterIgnore = unignoredSize;
+
+    // not interested with lists that don't add anything new
+    // also not very interested with listsizes of less than 10 because their ratio will be too skewed
+    if(author.matches > 0){
+        const auto ratio = author.sizeAfterIgnore/author.matches;
+        if(ratio <= 1 || author.sizeAfterIgnore < 10)
+            return;
+        author.ratio = ratio;
+        //ratioHash.AddToken(ratio);
+        auto& ratioObject = tempResult.ratioInfo[ratio];
+        ratioObject.ratio = ratio;
+        ratioObject.authors++;
+        if(ratioObject.minMatches > author.matches)
+            ratioObject.minMatches = author.matches;
+        //ratioObject.fics|=tempAuthorRoaring;
+        ratioObject.ficsAfterIgnore|=tempAuthorRoaring.operator-(ignores);
+
+        if(ratioObject.minListSize > author.sizeAfterIgnore)
+            ratioObject.minListSize = author.sizeAfterIgnore;
+        if(ratioObject.maxListSize < author.sizeAfterIgnore)
+            ratioObject.maxListSize = author.sizeAfterIgnore;
+        if(tempResult.maximumMatches < author.matches)
+        {
+            tempResult.prevMaximumMatches = tempResult.maximumMatches;
+            tempResult.maximumMatches = author.matches;
+        }
+        tempResult.matchSum+=author.matches;
+        tempResult.matchCounts.push_back(author.matches);
+    }
+}
+
+static void MergeAuthorRelations(AuthorRelationsResult& funcResult, AuthorRelationsResult&& data)
+{
+    if(funcResult.maximumMatches < data.maximumMatches)
+    {
+        funcResult.prevMaximumMatches = std::max(funcResult.maximumMatches, data.prevMaximumMatches);
+        funcResult.maximumMatches = data.maximumMatches;
+    }
+    else
+        funcResult.prevMaximumMatches = std::max(funcResult.prevMaximumMatches, data.maximumMatches < funcResult.maximumMatches ? data.maximumMatches : data.prevMaximumMatches);
+    funcResult.matchSum+=data.matchSum;
+    if(funcResult.matchCounts.size()>data.matchCounts.size()) {
+        funcResult.matchCounts.insert(funcResult.matchCounts.end(),data.matchCounts.begin(),data.matchCounts.end());
+    } else {
+        data.matchCounts.insert(data.matchCounts.end(),funcResult.matchCounts.begin(),funcResult.matchCounts.end());
+        funcResult.matchCounts = std::move(data.matchCounts);
+    }
+
+    for(auto i = data.ratioInfo.cbegin(); i != data.ratioInfo.cend(); i++){
+        funcResult.ratioInfo[i.key()]+=i.value();
+    }
+}
+
+Roaring RecCalculatorImplBase::PrepareAuthorRelations()
+{
+    allAuthors.Clear();
     ownFavourites = {};
     maximumMatches = 0;
     matchSum = 0;
@@ -620,105 +656,143 @@ void RecCalculatorImplBase::FetchAuthorRelations()
 
     ownProfileId = params->userFFNId;
     maximumMatches = params->minimumMatch;
+    return ignores;
+}
+
+void RecCalculatorImplBase::FetchAuthorRelations()
+{
+    qDebug() << "faves is of size: " << inputs.faves.size();
+    Roaring ignores = PrepareAuthorRelations();
+
+    std::pmr::vector<uint32_t> candidateAuthors(&workspace->arena);
+    TimedAction candidatesAction("Fetching candidate authors",[&](){
+        auto candidates = FetchCandidateAuthors();
+        candidateAuthors.resize(candidates.cardinality());
+        candidates.toUint32Array(candidateAuthors.data());
+    });
+    candidatesAction.run();
+    QLOG_INFO() << "candidate authors: " << candidateAuthors.size() << " out of: " << inputs.faves.size();
+    // every candidate gets an entry, relations are written straight into the table
+    auto& tempAuthors = allAuthors.Entries();
+    tempAuthors.resize(candidateAuthors.size());
+
     AuthorRelationsResult funcResult;
+    funcResult.maximumMatches = params->minimumMatch;
     //RatioHash ratioHash;
     TimedAction action("Relations Creation",[&](){
-        auto worker = [&](const std::tuple<QList<int>::const_iterator,QList<int>::const_iterator,QList<int>::const_iterator>& iterators){
-            AuthorRelationsResult tempResult;
-            tempResult.maximumMatches = params->minimumMatch;
-            auto itCurrent = std::get<1>(iterators);
-            auto itEnd= std::get<2>(iterators);
-            auto rangeBegin = std::get<0>(iterators);
-            while(itCurrent < itEnd)
+        auto worker = [&](AuthorRelationsResult& tempResult, size_t begin, size_t end){
+            for(auto i = begin; i < end; i++)
             {
-                auto& author = tempAuthors[itCurrent-rangeBegin];
-                author.id = *itCurrent;
+                auto& author = tempAuthors[i];
+                author.id = static_cast<int>(candidateAuthors[i]);
                 if(ownProfileId == author.id)
-                {
-                    itCurrent++;
                     continue;
-                }
-
-                const auto& tempAuthorRoaring = std::as_const(inputs.faves)[author.id];
-                author.fullListSize = tempAuthorRoaring.cardinality();
-                const uint ignoredFics = tempAuthorRoaring.and_cardinality(ignores);
-                const auto unignoredSize = tempAuthorRoaring.cardinality() - ignoredFics;
-
-                // first we need to remove ignored fics
-                //auto unignoredSize = inputs.faves[author.id].xor_cardinality(ignoredTemp);
-                //Roaring temp = tempAuthorRoaring.operator&(ownFavourites);
-                author.matches = tempAuthorRoaring.and_cardinality(ownFavourites);
-                author.negativeMatches = tempAuthorRoaring.and_cardinality(ownMajorNegatives);
-                if(author.matches > 10 && static_cast<double>(author.negativeMatches)/static_cast<double>(author.matches) > 1.5)
-                    author.matches = 0;
-                if(author.fullListSize > 10 && author.matches < 2 && ownFavourites.cardinality() > 5)
-                    author.matches = 0;
-                author.sizeAfterIgnore = unignoredSize;
-
-                // not interested with lists that don't add anything new
-                // also not very interested with listsizes of less than 10 because their ratio will be too skewed
-                if(author.matches > 0){
-                    const auto ratio = author.sizeAfterIgnore/author.matches;
-                    if(ratio <= 1 || author.sizeAfterIgnore < 10){
-                        itCurrent++;
-                        continue;
-                    }
-                    author.ratio = ratio;
-                    //ratioHash.AddToken(ratio);
-                    auto& ratioObject = tempResult.ratioInfo[ratio];
-                    ratioObject.ratio = ratio;
-                    ratioObject.authors++;
-                    if(ratioObject.minMatches > author.matches)
-                        ratioObject.minMatches = author.matches;
-                    //ratioObject.fics|=tempAuthorRoaring;
-                    ratioObject.ficsAfterIgnore|=tempAuthorRoaring.operator-(ignores);
-
-                    if(ratioObject.minListSize > author.sizeAfterIgnore)
-                        ratioObject.minListSize = author.sizeAfterIgnore;
-                    if(ratioObject.maxListSize < author.sizeAfterIgnore)
-                        ratioObject.maxListSize = author.sizeAfterIgnore;
-                    if(tempResult.maximumMatches < author.matches)
-                    {
-                        prevMaximumMatches = tempResult.maximumMatches;
-                        tempResult.maximumMatches = author.matches;
-                    }
-                    tempResult.matchSum+=author.matches;
-                    tempResult.matchCounts.push_back(author.matches);
-                }
-                itCurrent++;
+
+                auto itAuthorRoaring = inputs.faves.constFind(author.id);
+                if(itAuthorRoaring == inputs.faves.cend())
+                    continue;
+                EvaluateAuthorRelation(*this, ignores, itAuthorRoaring.value(), author, tempResult);
             }
-            return tempResult;
         };
 
+        AuthorRelationsResult initialResult;
+        initialResult.maximumMatches = params->minimumMatch;
+        auto partialResults = thread_boost::ParallelReduce(candidateAuthors.size(), ParallelOptions(512), initialResult, worker);
+        for(auto& data : partialResults)
+            MergeAuthorRelations(funcResult, std::move(data));
+    });
+    action.run();
+
+    FinishAuthorRelations(funcResult);
+}
 
-        threadedIntListTupleProcessor("Creation of author relations", QThread::idealThreadCount() - 3,inputs.faves.keys(),  worker, [&funcResult](AuthorRelationsResult&& data){
-            if(funcResult.maximumMatches < data.maximumMatches)
-                funcResult.maximumMatches = data.maximumMatches;
-            funcResult.matchSum+=data.matchSum;
-            if(funcResult.matchCounts.size()>data.matchCounts.size()) {
-                funcResult.matchCounts.insert(funcResult.matchCounts.end(),data.matchCounts.begin(),data.matchCounts.end());
-            } else {
-                data.matchCounts.insert(data.matchCounts.end(),funcResult.matchCounts.begin(),funcResult.matchCounts.end());
-                funcResult.matchCounts = data.matchCounts;
+void RecCalculatorImplBase::FetchAuthorRelationsBatch(const std::vector<RecCalculatorImplBase*>& calculators)
+{
+    if(calculators.empty())
+        return;
+    const auto& faves = calculators.front()->inputs.faves;
+    const auto userCount = calculators.size();
+
+    std::vector<Roaring> ignores;
+    ignores.reserve(userCount);
+    std::vector<Roaring> candidates(userCount);
+    TimedAction prepareAction("Preparing batch relations",[&](){
+        for(size_t user = 0; user < userCount; user++)
+        {
+            ignores.push_back(calculators[user]->PrepareAuthorRelations());
+            candidates[user] = calculators[user]->FetchCandidateAuthors();
+        }
+    });
+    prepareAction.run();
+
+    // every author that can match anyone is visited once and intersected with all the users while its bitmap is hot
+    std::vector<const Roaring*> candidatePointers;
+    for(const auto& userCandidates : candidates)
+        candidatePointers.push_back(&userCandidates);
+    Roaring allCandidates = Roaring::fastunion(candidatePointers.size(), candidatePointers.data());
+    std::vector<uint32_t> candidateAuthors(allCandidates.cardinality());
+    allCandidates.toUint32Array(candidateAuthors.data());
+    QLOG_INFO() << "batch of: " << userCount << " lists shares candidate authors: " << candidateAuthors.size();
+
+    // only authors that actually matched are kept, a batch would otherwise hold every candidate for every user
+    struct UserRelations{
+        AuthorRelationsResult relations;
+        std::vector<AuthorResult> authors;
+    };
+    std::vector<UserRelations> initialResult(userCount);
+    for(size_t user = 0; user < userCount; user++)
+        initialResult[user].relations.maximumMatches = calculators[user]->params->minimumMatch;
+
+    const auto& firstCalculator = *calculators.front();
+    auto partialResults = thread_boost::ParallelReduce(candidateAuthors.size(), firstCalculator.ParallelOptions(256), initialResult,
+                                                       [&](std::vector<UserRelations>& results, size_t begin, size_t end){
+        for(auto i = begin; i < end; i++)
+        {
+            auto itAuthorRoaring = faves.constFind(static_cast<int>(candidateAuthors[i]));
+            if(itAuthorRoaring == faves.cend())
+                continue;
+            for(size_t user = 0; user < userCount; user++)
+            {
+                const auto& calc = *calculators[user];
+                if(calc.ownProfileId == static_cast<int>(candidateAuthors[i]) || !candidates[user].contains(candidateAuthors[i]))
+                    continue;
+                AuthorResult author;
+                author.id = candidateAuthors[i];
+                EvaluateAuthorRelation(calc, ignores[user], itAuthorRoaring.value(), author, results[user].relations);
+                if(author.matches > 0)
+                    results[user].authors.push_back(std::move(author));
             }
+        }
+    });
 
-            for(auto i = data.ratioInfo.cbegin(); i != data.ratioInfo.cend(); i++){
-                funcResult.ratioInfo[i.key()]+=i.value();
+    TimedAction finishAction("Finishing batch relations",[&](){
+        for(size_t user = 0; user < userCount; user++)
+        {
+            AuthorRelationsResult funcResult;
+            funcResult.maximumMatches = calculators[user]->params->minimumMatch;
+            auto& userAuthors = calculators[user]->allAuthors.Entries();
+            for(auto& partial : partialResults)
+            {
+                auto& userPartial = partial[user];
+                MergeAuthorRelations(funcResult, std::move(userPartial.relations));
+                userAuthors.insert(userAuthors.end(), std::make_move_iterator(userPartial.authors.begin()), std::make_move_iterator(userPartial.authors.end()));
             }
-        });
+            calculators[user]->FinishAuthorRelations(funcResult);
+        }
     });
-    action.run();
+    finishAction.run();
+}
 
-    for(auto&& author: tempAuthors){
-        auto id = author.id;
-        allAuthors.emplace(std::move(id),std::move(author));
-    }
+void RecCalculatorImplBase::FinishAuthorRelations(AuthorRelationsResult& funcResult)
+{
+    allAuthors.Index();
     matchSum = funcResult.matchSum;
     maximumMatches = funcResult.maximumMatches;
+    prevMaximumMatches = funcResult.prevMaximumMatches;
     RatioSumInfo tempSummary;
 
     auto result = std::accumulate(funcResult.matchCounts.begin(),funcResult.matchCounts.end(), 0);
-    int average = result/funcResult.matchCounts.size();
+    int average = funcResult.matchCounts.empty() ? 0 : result/static_cast<int>(funcResult.matchCounts.size());
     QLOG_INFO() << "average ratio is: " << average;
     if(average == 0)
         average = 1;
@@ -875,42 +949,43 @@ void RecCalculatorImplBase::CollectFicMatchQuality()
 
 }
 
-void RecCalculatorImplBase::Filter(QSharedPointer<RecommendationList> params,
-                                   const QList<std::function<bool (AuthorResult &, QSharedPointer<RecommendationList>)> >& filters,
-                                   const QList<std::function<void (RecCalculatorImplBase *, AuthorResult &)> >& actions)
+void RecCalculatorImplBase::InvalidateAuthor(AuthorResult& author)
 {
-    auto thisPtr = this;
-    using FilterType = std::decay<decltype(filters)>::type::value_type;
-    using ActionType = std::decay<decltype(actions)>::type::value_type;
-
-    for(auto & [ key, author]: allAuthors){
-        auto setInvalid = [](auto& author){
-            author.ratio = 99999;
-            author.similarityPercentage = 0;
-        };
-        if(author.matches == 0 || author.sizeAfterIgnore < 10 || author.matches < minimumRatio){
-            setInvalid(author);
-        }
-        else{
-            author.similarityPercentage = author.matches/(static_cast<double>(author.sizeAfterIgnore)/100.);
-            author.ratio = static_cast<double>(author.sizeAfterIgnore)/static_cast<double>(author.matches);
-            author.negativeRatio = author.negativeMatches != 0  ? static_cast<double>(author.negativeMatches)/static_cast<double>(author.fullListSize) : std::numeric_limits<double>::max();
-            author.listDiff.touchyDifference = GetTouchyDiffForLists(author.id);
-            author.listDiff.neutralDifference = GetNeutralDiffForLists(author.id);
-            bool fail = std::any_of(std::execution::par_unseq,filters.cbegin(), filters.cend(), [author = std::ref(author),&params](const FilterType& filter){
-                return filter(author, params) == 0;
-
-            });
-            if(fail || author.ratio == 1){
-                setInvalid(author);
-                continue;
-            }
-            std::for_each(actions.cbegin(), actions.cend(), [thisPtr, author = std::ref(author)](const ActionType& action){
-                action(thisPtr, author);
-            });
+    author.ratio = 99999;
+    author.similarityPercentage = 0;
+}
 
-        }
-    };
+bool RecCalculatorImplBase::PrepareAuthorForFiltering(AuthorResult& author)
+{
+    if(author.matches == 0 || author.sizeAfterIgnore < 10 || author.matches < minimumRatio){
+        InvalidateAuthor(author);
+        return false;
+    }
+    author.similarityPercentage = author.matches/(static_cast<double>(author.sizeAfterIgnore)/100.);
+    author.ratio = static_cast<double>(author.sizeAfterIgnore)/static_cast<double>(author.matches);
+    author.negativeRatio = author.negativeMatches != 0  ? static_cast<double>(author.negativeMatches)/static_cast<double>(author.fullListSize) : std::numeric_limits<double>::max();
+    author.listDiff.touchyDifference = GetTouchyDiffForLists(author.id);
+    author.listDiff.neutralDifference = GetNeutralDiffForLists(author.id);
+    return true;
+}
+
+uint32_t RecCalculatorImplBase::RatioBucketForAuthor(const AuthorResult& author) const
+{
+    // RatioFilter passes while ratio <= maxUnmatchedPerMatch
+    return static_cast<uint32_t>(std::ceil(author.ratio));
+}
+
+void AuthorMatchHistogram::Finalize()
+{
+    for(auto& [matches, row] : rows)
+        std::stable_sort(row.begin(), row.end(), [](const Entry& first, const Entry& second){
+            return first.ratioBucket < second.ratioBucket;
+        });
+}
+
+QSet<int> RecCalculatorImplBase::FilteredAuthorSet() const
+{
+    return QSet<int>(filteredAuthors.cbegin(), filteredAuthors.cend());
 }
 
 void RecCalculatorImplBase::CalculateNegativeToPositiveRatio()
@@ -994,61 +1069,6 @@ void RecCalculatorImplBase::CalculateNegativeToPositiveRatio()
 ////    }
 //}
 
-void RecCalculatorImplBase::FillFilteredAuthorsForFics()
-{
-    QLOG_INFO() << "Filling authors for fics: " << result.recommendations.size();
-    int counter = 0;
-    // probably need to prefill roaring per fic so that I don't search
-    QHash<uint32_t, Roaring> ficsRoarings;
-    QLOG_INFO() << "Filling fic roarings";
-    for(auto author : std::as_const(filteredAuthors))
-    {
-        if(counter%10000)
-            QLOG_INFO() << counter;
-        for(auto fic: inputs.faves[author])
-            ficsRoarings[fic].add(author);
-        if(counter%10000)
-            QLOG_INFO() << "roarings size is: " << ficsRoarings.size();
-        counter++;
-    }
-    counter = 0;
-
-    Roaring filterAuthorsRoar;
-    for(auto author : std::as_const(filteredAuthors))
-        filterAuthorsRoar.add(author);
-
-    QLOG_INFO()  << "Authors roar size is: " << filterAuthorsRoar.cardinality();
-
-    QLOG_INFO() << "Filling actual author data";
-
-    for(auto i = result.recommendations.cbegin(); i != result.recommendations.cend(); i++){
-        if(counter%10000 == 0)
-            QLOG_INFO() << "At counter:" << counter;
-
-        auto& ficRoaring = ficsRoarings[i.key()];
-        //QLOG_INFO() << "Fic roaring size is:" << ficRoaring.cardinality();
-
-        Roaring temp = filterAuthorsRoar;
-        //QLOG_INFO() << "Author roaring size is:" << ficRoaring.cardinality();
-
-        temp = temp & ficRoaring;
-        //QLOG_INFO() << "Result size is:" << temp.cardinality();
-        if(temp.cardinality() == 0)
-            continue;
-
-        if(!authorsForFics.contains(i.key()))
-            authorsForFics[i.key()].reserve(1000);
-        for(auto author : temp){
-            authorsForFics[i.key()].push_back(author);
-        }
-        counter++;
-//        if(counter > 10)
-//            break;
-    }
-    //QLOG_INFO() << "data at exit is: " << authorsForFics;
-    QLOG_INFO() << "Finished filling authors for fics";
-}
-
 bool RecCalculatorImplDefault::WeightingIsValid() const
 {
     return true;
@@ -16,42 +16,22 @@ You should have received a copy of the GNU General Public License
 along with this program.  If not, see <http://www.gnu.org/licenses/>
 */
 #include "include/rec_calc/rec_calculator_mood_adjusted.h"
-#include "include/Interfaces/genres.h"
-#include <QStringList>
+#include <cmath>
 
 namespace core {
 
 
-static auto ratioFilterMoodAdjusted = [](AuthorResult& author, QSharedPointer<RecommendationList> params)
+uint32_t RecCalculatorImplMoodAdjusted::RatioBucketForAuthor(const AuthorResult& author) const
 {
-    if(author.ratio > params->ratioCutoff)
-        return false;
-
-    bool firstPass =  author.ratio <= params->maxUnmatchedPerMatch && author.matches > 0;
-//    author.usedRatio = params->maxUnmatchedPerMatch;
-//    author.usedMinimumMatrch= params->minimumMatch;
-
-    if(!firstPass)
-        return false;
-
-    auto cleanRatio = author.matches != 0 ? static_cast<double>(author.fullListSize)/static_cast<double>(author.matches) : std::numeric_limits<double>::max();
-    if(author.listDiff.touchyDifference.has_value())
+    // MoodAdjustedRatioFilter also drops lists that are too far away mood-wise once their unignored ratio goes over the limit
+    auto bucket = RecCalculatorImplWeighted::RatioBucketForAuthor(author);
+    if(author.listDiff.touchyDifference.has_value() && author.listDiff.touchyDifference.value() >= 0.4)
     {
-        auto authorcoef = author.listDiff.touchyDifference.value();
-        if((cleanRatio > params->maxUnmatchedPerMatch) && authorcoef  >= 0.4)
-        {
-            //qDebug() << "skipping author: " << author.id << "with coef: "  << authorcoef  << " and ratio: " <<  cleanRatio;
-            //author.ratio = 999999;
-            return false;
-        }
+        auto cleanRatio = static_cast<double>(author.fullListSize)/static_cast<double>(author.matches);
+        cleanRatio = std::min(cleanRatio, static_cast<double>(std::numeric_limits<uint32_t>::max()));
+        bucket = std::max(bucket, static_cast<uint32_t>(std::ceil(cleanRatio)));
     }
-
-    bool secondPass = author.ratio <= params->maxUnmatchedPerMatch && author.matches > 0;;
-    return secondPass;
-};
-
-RecCalculatorImplWeighted::FilterListType RecCalculatorImplMoodAdjusted::GetFilterList(){
-    return {matchesFilter, ratioFilterMoodAdjusted, negativeFilter};
+    return bucket;
 }
 
 void RecCalculatorImplMoodAdjusted::ResetAccumulatedData()
@@ -63,59 +43,33 @@ bool RecCalculatorImplMoodAdjusted::WeightingIsValid() const
 {
     return RecCalculatorImplWeighted::WeightingIsValid();
 }
-std::once_flag moodsFlag;
 RecCalculatorImplMoodAdjusted::RecCalculatorImplMoodAdjusted(const RecInputVectors& input, const genre_stats::GenreMoodData& moodData):
     RecCalculatorImplWeighted(input), moodData(moodData)
 {
-    static QStringList moodList;
-    std::call_once(moodsFlag, [&](){
-        moodList << "Neutral" << "Funny"  << "Shocky" << "Flirty" << "Dramatic" << "Hurty" << "Bondy";
-    });
-
-    for(auto i = input.moods.cbegin(); i != input.moods.cend(); i++)
-    {
-        double neutralDifference = 0., touchyDifference = 0.;
-        auto authorData = i.value();
-        for(int i= 0; i < moodList.size(); i++)
-        {
-            auto userValue =  interfaces::Genres::ReadMoodValue(moodList[i], moodData.listMoodData);
-            auto authorValue =  interfaces::Genres::ReadMoodValue(moodList[i], authorData);
-            if(i > 1)
-                touchyDifference += std::max(userValue, authorValue) - std::min(userValue, authorValue);
-            neutralDifference += std::max(userValue, authorValue) - std::min(userValue, authorValue);
-        }
-//        if(i.key() == 77257)
-//        {
-//            qDebug() << "Logging user mood list";
-//            moodData.listMoodData.Log();
-//            qDebug() << "Logging author mood list";
-//            authorData.Log();
-//            qDebug() << "between author: " << i.key() << " and user, neutral: " << neutralDifference;
-//            qDebug() << "between author: " << i.key() << " and user, touchy: " << touchyDifference;
-//        }
-        auto& diff = moodDiffs[i.key()];
-        diff.neutralDifference =  neutralDifference;
-        diff.touchyDifference =  touchyDifference;
-    }
+    const auto& matrix = input.moodMatrix;
+    const size_t paddedSize = matrix.BlockCount()*AuthorMoodMatrix::blockSize;
+    neutralDiffs.resize(paddedSize);
+    touchyDiffs.resize(paddedSize);
+    matrix.Distances(AuthorMoodMatrix::ReadMoods(moodData.listMoodData), neutralDiffs.data(), touchyDiffs.data());
     votesBase = 20;
 }
 
 std::optional<double> RecCalculatorImplMoodAdjusted::GetNeutralDiffForLists(uint32_t author)
 {
-    auto it = std::as_const(moodDiffs).find(author);
-    if(it == moodDiffs.cend())
+    auto row = inputs.moodMatrix.RowForAuthor(author);
+    if(row == AuthorMoodMatrix::invalid)
         return {};
 
-    return it.value().neutralDifference;
+    return neutralDiffs[row];
 }
 
 std::optional<double> RecCalculatorImplMoodAdjusted::GetTouchyDiffForLists(uint32_t author)
 {
-    auto it = std::as_const(moodDiffs).find(author);
-    if(it == moodDiffs.cend())
+    auto row = inputs.moodMatrix.RowForAuthor(author);
+    if(row == AuthorMoodMatrix::invalid)
         return {};
 
-    return it.value().touchyDifference;
+    return touchyDiffs[row];
 }
 
 }
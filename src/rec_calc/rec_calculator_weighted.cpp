@@ -16,6 +16,7 @@ You should have received a copy of the GNU General Public License
 along with this program.  If not, see <http://www.gnu.org/licenses/>
 */
 #include "include/rec_calc/rec_calculator_weighted.h"
+#include <algorithm>
 #include <cmath>
 namespace core {
 
@@ -75,118 +76,71 @@ double sqrt_coef(double ratio, double median, double sigma, int base, int scaler
 }
 
 
-RecCalculatorImplWeighted::FilterListType RecCalculatorImplWeighted::GetFilterList(){
-    return {matchesFilter, ratioFilter, negativeFilter};
-}
-RecCalculatorImplBase::ActionListType RecCalculatorImplWeighted::GetActionList(){
-    auto ratioAccumulator = [ratioSum = std::reference_wrapper<double>(this->ratioSum)](RecCalculatorImplBase* calc,AuthorResult & author)
-    {
-        if(calc->ownProfileId != static_cast<int>(author.id))
-            ratioSum+=author.ratio;
-    };
-    return {authorAccumulator, ratioAccumulator};
-};
-std::function<AuthorWeightingResult(AuthorResult&, int, int)> RecCalculatorImplWeighted::GetWeightingFunc(){
-    return std::bind(&RecCalculatorImplWeighted::CalcWeightingForAuthor,
-                     this,
-                     std::placeholders::_1,
-                     std::placeholders::_2,
-                     std::placeholders::_3);
-}
-
 void RecCalculatorImplWeighted::CalcWeightingParams(){
-    auto authorList = filteredAuthors.values();
+    // everything here comes from sums and ratio ranks that were gathered while authors were being selected
+    auto& ranks = workspace->ratioRanks;
+    const size_t authorCount = filteredAuthors.size();
     QLOG_INFO() << "inputs to weighting:";
     QLOG_INFO() << "matchsum:" << matchSum;
     QLOG_INFO() << "inputs.faves.size():" << inputs.faves.size();
     QLOG_INFO() << "ratioSum:" << ratioSum;
-    QLOG_INFO() << "filteredAuthors.size():" << authorList.size();
+    QLOG_INFO() << "filteredAuthors.size():" << authorCount;
     needsRangeAdjustment = false;
     int matchMedian = matchSum/inputs.faves.size();
 
-    ratioMedian = static_cast<double>(ratioSum)/static_cast<double>(authorList.size());
+    ratioMedian = static_cast<double>(ratioSum)/static_cast<double>(authorCount);
 
-    double normalizer = 1./static_cast<double>(authorList.size()-1.);
-    double sum = 0;
-    for(auto author: authorList)
-    {
-        if(this->ownProfileId != static_cast<int>(allAuthors[author].id))
-            sum+=std::pow(allAuthors[author].ratio - ratioMedian, 2);
-    }
+    double normalizer = 1./static_cast<double>(authorCount-1.);
+    // sum of (ratio - ratioMedian)^2 over everyone but user's own profile
+    double sum = ratioSquareSum - 2*ratioMedian*ratioSum + ratioCount*ratioMedian*ratioMedian;
+    sum = std::max(sum, 0.);
 
     quadraticDeviation = std::sqrt(normalizer * sum);
 
     qDebug () << "median of match value is: " << matchMedian;
     qDebug () << "median of ratio is: " << ratioMedian;
 
-    //auto keysRatio = inputs.faves.keys();
-    auto keysMedian = inputs.faves.keys();
-    std::sort(keysMedian.begin(), keysMedian.end(),[&](const int& i1, const int& i2){
-        return allAuthors[i1].matches < allAuthors[i2].matches;
-    });
-
-    std::sort(authorList.begin(), authorList.end(),[&](const int& i1, const int& i2){
-        return allAuthors[i1].ratio < allAuthors[i2].ratio;
-    });
-
-    auto ratioMedianIt = std::lower_bound(authorList.cbegin(), authorList.cend(), ratioMedian, [&](const int& i1, const int& ){
-        return allAuthors[i1].ratio < ratioMedian;
-    });
-    auto beginningOfQuadraticToMedianRange = ratioMedianIt - authorList.cbegin();
+    auto beginningOfQuadraticToMedianRange = ranks.CountBelow(ratioMedian);
     qDebug() << "distance to median is: " << beginningOfQuadraticToMedianRange;
-    qDebug() << "vector size is: " << authorList.size();
+    qDebug() << "vector size is: " << authorCount;
 
     qDebug() << "sigma: " << quadraticDeviation;
     qDebug() << "2 sigma: " << quadraticDeviation * 2;
 
-    auto ratioSigma2 = std::lower_bound(authorList.cbegin(), authorList.cend(), ratioMedian, [&](const int& i1, const int& ){
-        return allAuthors[i1].ratio < (ratioMedian - quadraticDeviation*2);
-    });
-    endOfUniqueAuthorRange = ratioSigma2 - authorList.cbegin();
+    endOfUniqueAuthorRange = static_cast<int>(ranks.CountBelow(ratioMedian - quadraticDeviation*2));
     qDebug() << "distance to sigma15 is: " << endOfUniqueAuthorRange;
     if(endOfUniqueAuthorRange == 0)
         needsRangeAdjustment = true;
 
     // okay, I need to find the limits for deviation that pull a certain % of lists into rarity ranges
-    int uncommonAuthorCount = (authorList.size()/100.)*20.;
-    int rareAuthorCount = (authorList.size()/100.)*5;
-    int uniqueAuthorCount = (authorList.size()/100.)*2;
-    int seenAuthorCount = 0;
+    int uncommonAuthorCount = (authorCount/100.)*20.;
+    int rareAuthorCount = (authorCount/100.)*5;
+    int uniqueAuthorCount = (authorCount/100.)*2;
+    auto rangeAt = [&](int position){
+        return ratioMedian - ranks.RatioAtRank(static_cast<size_t>(position - 1));
+    };
 
     QLOG_INFO() << "Ratio median:" << ratioMedian;
 
-    for(auto authorId: authorList){
-        seenAuthorCount++;
-        if(seenAuthorCount == uncommonAuthorCount){
-            //QLOG_INFO() << "Author ratio: " << allAuthors[authorId].ratio << " assigning ratio: uncommon";
-            auto ratio = allAuthors[authorId].ratio;
-            auto currentRange = ratioMedian - ratio;
-            uncommonRange = currentRange;
-        }else if(seenAuthorCount == rareAuthorCount){
-            auto ratio = allAuthors[authorId].ratio;
-            auto currentRange = ratioMedian - ratio;
-            //QLOG_INFO() << "Author ratio: " << allAuthors[authorId].ratio << " assigning ratio: rare";
-            rareRange = currentRange;
-        }else if(seenAuthorCount == uniqueAuthorCount){
-            auto ratio = allAuthors[authorId].ratio;
-            auto currentRange = ratioMedian - ratio;
-            //QLOG_INFO() << "Author ratio: " << allAuthors[authorId].ratio << " assigning ratio: unique";
-            uniqueRange = currentRange;
-        }
-        else
-            //QLOG_INFO() << "Author ratio: " << allAuthors[authorId].ratio;
-        allAuthors[authorId].distance = ratioMedian - allAuthors[authorId].ratio;
-    }
+    // ranges are picked by the author at that position, a position shared by several ranges counts for the first one
+    if(uncommonAuthorCount > 0)
+        uncommonRange = rangeAt(uncommonAuthorCount);
+    if(rareAuthorCount > 0 && rareAuthorCount != uncommonAuthorCount)
+        rareRange = rangeAt(rareAuthorCount);
+    if(uniqueAuthorCount > 0 && uniqueAuthorCount != uncommonAuthorCount && uniqueAuthorCount != rareAuthorCount)
+        uniqueRange = rangeAt(uniqueAuthorCount);
 
-    for(auto authorId: authorList){
-        auto ratio = allAuthors[authorId].ratio;
-        if(ratioMedian - ratio > uniqueRange)
-            this->uniqueAuthors++;
-        else if(ratioMedian - ratio > rareRange)
-            this->rareAuthors++;
-        else if(ratioMedian - ratio > uncommonRange)
-            this->uncommonAuthors++;
-    }
+    ranks.ForEach([&](int authorId, double ratio){
+        allAuthors[authorId].distance = ratioMedian - ratio;
+    });
+
+    // ratioMedian - ratio > range
+    const auto uniqueBelow = ranks.CountBelow(ratioMedian - uniqueRange);
+    const auto rareBelow = std::max(uniqueBelow, ranks.CountBelow(ratioMedian - rareRange));
+    const auto uncommonBelow = std::max(rareBelow, ranks.CountBelow(ratioMedian - uncommonRange));
+    this->uniqueAuthors += static_cast<int>(uniqueBelow);
+    this->rareAuthors += static_cast<int>(rareBelow - uniqueBelow);
+    this->uncommonAuthors += static_cast<int>(uncommonBelow - rareBelow);
 
 
     QLOG_INFO() << "outputs from weighting:";
@@ -257,14 +211,24 @@ void RecCalculatorImplWeighted::AdjustRatioForAutomaticParams()
     if(!params->isAutomatic)
         return;
     ratioSum = 0;
+    ratioSquareSum = 0;
+    ratioCount = 0;
     for(auto author : std::as_const(filteredAuthors))
-        ratioSum+=allAuthors[author].ratio;
+    {
+        const auto ratio = allAuthors[author].ratio;
+        ratioSum+=ratio;
+        ratioSquareSum+=ratio*ratio;
+        ratioCount++;
+    }
 }
 
 void RecCalculatorImplWeighted::ResetAccumulatedData()
 {
     RecCalculatorImplBase::ResetAccumulatedData();
     ratioSum = 0;
+    ratioSquareSum = 0;
+    ratioCount = 0;
+    workspace->ratioRanks.Clear();
     ratioMedian = 0;
     quadraticDeviation = 0;
     endOfUniqueAuthorRange = 0;
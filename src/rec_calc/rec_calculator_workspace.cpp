@@ -0,0 +1,213 @@
+/*
+Flipper is a recommendation and search engine for fanfiction.net
+Copyright (C) 2017-2020  Marchenko Nikolai
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+#include "include/rec_calc/rec_calculator_workspace.h"
+
+#include <QMutex>
+#include <QMutexLocker>
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+
+namespace core{
+
+void AuthorTable::Bind(const AuthorOrdinals& ordinals)
+{
+    this->ordinals = &ordinals;
+    // ordinals of a newer snapshot might go further, the table is empty here so growing is enough
+    if(slotForOrdinal.size() < ordinals.Size())
+        slotForOrdinal.resize(ordinals.Size(), invalid);
+}
+
+void AuthorTable::Clear()
+{
+    for(auto ordinal : usedOrdinals)
+        slotForOrdinal[ordinal] = invalid;
+    usedOrdinals.clear();
+    entries.clear();
+}
+
+void AuthorTable::Index()
+{
+    for(auto ordinal : usedOrdinals)
+        slotForOrdinal[ordinal] = invalid;
+    usedOrdinals.clear();
+    for(uint32_t slot = 0; slot < entries.size(); slot++)
+    {
+        auto ordinal = ordinals->OrdinalForAuthor(entries[slot].id);
+        if(ordinal == invalid || slotForOrdinal[ordinal] != invalid)
+            continue;
+        slotForOrdinal[ordinal] = slot;
+        usedOrdinals.push_back(ordinal);
+    }
+}
+
+AuthorResult* AuthorTable::Find(uint32_t author)
+{
+    auto ordinal = ordinals ? ordinals->OrdinalForAuthor(author) : invalid;
+    if(ordinal == invalid || slotForOrdinal[ordinal] == invalid)
+        return nullptr;
+    return &entries[slotForOrdinal[ordinal]];
+}
+
+AuthorResult& AuthorTable::operator[](uint32_t author)
+{
+    if(auto result = Find(author))
+        return *result;
+    // authors without favourites have no ordinal and can't be found again
+    auto ordinal = ordinals ? ordinals->OrdinalForAuthor(author) : invalid;
+    entries.emplace_back();
+    entries.back().id = author;
+    if(ordinal != invalid)
+    {
+        slotForOrdinal[ordinal] = static_cast<uint32_t>(entries.size() - 1);
+        usedOrdinals.push_back(ordinal);
+    }
+    return entries.back();
+}
+
+void RatioRanks::Clear()
+{
+    for(auto bucket : usedBuckets)
+        buckets[bucket].clear();
+    usedBuckets.clear();
+    usedBucketsSorted = true;
+    count = 0;
+}
+
+void RatioRanks::Add(int author, double ratio)
+{
+    const double wholePart = std::floor(ratio);
+    uint32_t bucket = bucketLimit - 1;
+    if(!(wholePart >= 0))
+        bucket = 0;
+    else if(wholePart < bucketLimit - 1)
+        bucket = static_cast<uint32_t>(wholePart);
+    if(buckets.size() <= bucket)
+        buckets.resize(bucket + 1);
+    if(buckets[bucket].empty())
+    {
+        if(!usedBuckets.empty() && usedBuckets.back() > bucket)
+            usedBucketsSorted = false;
+        usedBuckets.push_back(bucket);
+    }
+    buckets[bucket].push_back({ratio, author});
+    count++;
+}
+
+void RatioRanks::SortUsedBuckets()
+{
+    if(usedBucketsSorted)
+        return;
+    std::sort(usedBuckets.begin(), usedBuckets.end());
+    usedBucketsSorted = true;
+}
+
+double RatioRanks::RatioAtRank(size_t rank)
+{
+    SortUsedBuckets();
+    for(auto bucket : usedBuckets)
+    {
+        auto& entries = buckets[bucket];
+        if(rank >= entries.size())
+        {
+            rank -= entries.size();
+            continue;
+        }
+        std::nth_element(entries.begin(), entries.begin() + static_cast<std::ptrdiff_t>(rank), entries.end(), [](const Entry& first, const Entry& second){
+            return first.ratio < second.ratio;
+        });
+        return entries[rank].ratio;
+    }
+    return 0;
+}
+
+size_t RatioRanks::CountBelow(double value)
+{
+    SortUsedBuckets();
+    size_t result = 0;
+    for(auto bucket : usedBuckets)
+    {
+        // every ratio in a bucket is at least as large as the bucket itself
+        if(static_cast<double>(bucket) >= value)
+            break;
+        const auto& entries = buckets[bucket];
+        if(bucket < bucketLimit - 1 && static_cast<double>(bucket + 1) <= value)
+        {
+            result += entries.size();
+            continue;
+        }
+        for(const auto& entry : entries)
+            if(entry.ratio < value)
+                result++;
+    }
+    return result;
+}
+
+// returned workspaces stay here until they are needed again
+// a burst of lists created at the same time can't keep more than idleLimit of them alive
+static QMutex workspacePoolLock;
+static std::vector<std::unique_ptr<RecCalculatorWorkspace>> idleWorkspaces;
+static int idleLimit = 8;
+
+void RecCalculatorWorkspace::SetIdleLimit(int limit)
+{
+    QMutexLocker locker(&workspacePoolLock);
+    idleLimit = std::max(0, limit);
+    if(idleWorkspaces.size() > static_cast<size_t>(idleLimit))
+        idleWorkspaces.resize(static_cast<size_t>(idleLimit));
+}
+
+QSharedPointer<RecCalculatorWorkspace> RecCalculatorWorkspace::Acquire(const AuthorOrdinals& ordinals)
+{
+    RecCalculatorWorkspace* workspace = nullptr;
+    {
+        QMutexLocker locker(&workspacePoolLock);
+        if(!idleWorkspaces.empty())
+        {
+            workspace = idleWorkspaces.back().release();
+            idleWorkspaces.pop_back();
+        }
+    }
+    if(!workspace)
+        workspace = new RecCalculatorWorkspace();
+    workspace->authors.Bind(ordinals);
+    return QSharedPointer<RecCalculatorWorkspace>(workspace, [](RecCalculatorWorkspace* released){
+        std::unique_ptr<RecCalculatorWorkspace> workspace(released);
+        workspace->Reset();
+        QMutexLocker locker(&workspacePoolLock);
+        if(idleWorkspaces.size() < static_cast<size_t>(idleLimit))
+            idleWorkspaces.push_back(std::move(workspace));
+        else
+        {
+            // the pool is full, the workspace is freed outside of the lock
+            locker.unlock();
+            workspace.reset();
+        }
+    });
+}
+
+void RecCalculatorWorkspace::Reset()
+{
+    authors.Clear();
+    filteredAuthors.clear();
+    ratioRanks.Clear();
+    arena.Reset();
+}
+
+}
@@ -0,0 +1,67 @@
+/*
+Flipper is a recommendation and search engine for fanfiction.net
+Copyright (C) 2017-2020  Marchenko Nikolai
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+#include "include/rec_calc/reclist_diagnostics.h"
+#include "include/core/top_k.h"
+
+#include <algorithm>
+
+namespace core {
+
+ReclistDiagnostics::ReclistDiagnostics(QSharedPointer<RecCalculatorImplBase> calculator, const DiagnosticScope& scope):
+    calculator(calculator)
+{
+    for(auto author : std::as_const(calculator->filteredAuthors))
+        filteredAuthors.add(static_cast<uint32_t>(author));
+    filteredAuthors.runOptimize();
+
+    const auto& votes = calculator->result.votes;
+    if(!scope.fics.isEmpty())
+    {
+        fics.assign(scope.fics.cbegin(), scope.fics.cend());
+        std::sort(fics.begin(), fics.end());
+    }
+    else
+    {
+        TopK top(static_cast<size_t>(std::max(0, scope.topFics)));
+        for(size_t i = 0; i < votes.Size(); i++)
+            top.Push(votes.recommendations[i], static_cast<int>(votes.ficIds[i]));
+        for(const auto& fic : top.Take())
+            fics.push_back(static_cast<uint32_t>(fic.id));
+    }
+
+    std::vector<uint32_t> authors;
+    for(auto fic : fics)
+    {
+        VotersForFic(fic, authors);
+        voters.addMany(authors.size(), authors.data());
+    }
+}
+
+void ReclistDiagnostics::VotersForFic(uint32_t fic, std::vector<uint32_t>& authors) const
+{
+    authors.clear();
+    const auto& favouritesByFic = calculator->inputs.favouritesByFic;
+    auto it = favouritesByFic.constFind(static_cast<int>(fic));
+    if(it == favouritesByFic.cend())
+        return;
+    Roaring intersection = it.value() & filteredAuthors;
+    authors.resize(intersection.cardinality());
+    intersection.toUint32Array(authors.data());
+}
+
+}
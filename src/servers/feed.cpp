@@ -18,7 +18,9 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #include "servers/feed.h"
 #include "servers/token_processing.h"
 #include "servers/database_context.h"
+#include "servers/reclist_cache.h"
 #include "favholder.h"
+#include "data_code/server_data_builder.h"
 
 #include "tokenkeeper.h"
 #include "timeutils.h"
@@ -48,6 +50,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 
 #include <QSettings>
 #include <QThread>
+#include <QtConcurrent>
 #include <QRegularExpression>
 
 
@@ -65,19 +68,14 @@ static QString GetDbNameFromCurrentThread(){
     return QString("Crawler_") + QString::fromStdString(id);
 }
 
-FeederService::FeederService(QObject* parent): QObject(parent){
-    startedAt = QDateTime::currentDateTimeUtc();
-    allSearches = 0;
-    genericSearches = 0;
-    recommendationsSearches = 0;
-    randomSearches = 0;
-    rngData.reset(new core::RNGData);
-
+// reads the snapshot the builder finished last, the data is only built in process
+// when allowed and there is nothing to read, reloads never do that
+static QSharedPointer<core::DataHolder> LoadDataSnapshot(QString storageFolder, bool allowBuilding, QString& buildId, int& deltaCount){
+    // the connection is opened for the thread that performs the load so that reloads can happen in the background
     QSharedPointer<database::IDBWrapper> dbInterface (new database::SqliteInterface());
     dbInterface->SetDatabase(database::sqlite::InitAndUpdateSqliteDatabaseForFile("database","CrawlerDB","dbcode/dbinit.sql", GetDbNameFromCurrentThread(), true));
     auto mainDb = dbInterface->GetDatabase();
 
-    An<core::RecCalculator> calculator;
     auto authors = QSharedPointer<interfaces::Authors> (new interfaces::FFNAuthors());
     authors->db = mainDb;
     auto fanfics = QSharedPointer<interfaces::Fanfics> (new interfaces::FFNFanfics());
@@ -85,50 +83,89 @@ FeederService::FeederService(QObject* parent): QObject(parent){
     auto genres = QSharedPointer<interfaces::Genres> (new interfaces::Genres());
     genres->db = mainDb;
     fanfics->authorInterface = authors;
-    calculator->holder.authorsInterface = authors;
-    calculator->holder.fanficsInterface = fanfics;
-    calculator->holder.genresInterface = genres;
-    calculator->holder.settingsFile = "settings/settings_server.ini";
-
-    qDebug() << "loading fics";
-    calculator->holder.LoadData<core::rdt_fics>("ServerData");
-    qDebug() << "loading favourites";
-    calculator->holder.LoadData<core::rdt_favourites>("ServerData");
-    qDebug() << "loading genres composite";
-    //genres->loadOriginalGenresOnly = true;
-    calculator->holder.LoadData<core::rdt_fic_genres_composite>("ServerData");
-    //genres->loadOriginalGenresOnly = false;
-    qDebug() << "loading moods";
-    calculator->holder.LoadData<core::rdt_author_mood_distribution>("ServerData");
-
-    if(calculator->holder.authorMoodDistributions.size() == 0)
+    QSharedPointer<core::DataHolder> data(new core::DataHolder("settings/settings_server.ini", authors, fanfics));
+    data->genresInterface = genres;
+
+    core::SnapshotManifest manifest;
+    if(manifest.Read(storageFolder) && manifest.Matches(storageFolder) && core::LoadServerData(*data, storageFolder, manifest))
     {
-        qDebug() << "calculating moods";
-        AuthorGenreIterationProcessor iteratorProcessor;
-        calculator->holder.LoadData<core::rdt_author_genre_distribution>("ServerData");
-        iteratorProcessor.ReprocessGenreStats(calculator->holder.genreComposites, calculator->holder.faves);
-        auto testedAuthor = iteratorProcessor.resultingMoodAuthorData[94186];
-        QStringList moodList;
-        moodList << "Neutral" << "Funny"  << "Shocky" << "Flirty" << "Dramatic" << "Hurty" << "Bondy";
-        for(int i= 0; i < moodList.size(); i++)
-        {
-            auto userValue =  interfaces::Genres::ReadMoodValue(moodList[i], testedAuthor);
-            qDebug() << moodList[i] << ": " << userValue;
-        }
-        qDebug() << "saving moods";
-        thread_boost::SaveData("ServerData","amd",iteratorProcessor.resultingMoodAuthorData);
-        calculator->holder.LoadData<core::rdt_author_mood_distribution>("ServerData");
-        qDebug() << "finished saving moods";
+        buildId = manifest.buildId;
+        deltaCount = manifest.deltas.size();
+        return data;
+    }
+    if(!allowBuilding)
+    {
+        QLOG_WARN() << "there is no finished snapshot in: " << storageFolder;
+        return {};
+    }
+    QLOG_WARN() << "there is no finished snapshot in: " << storageFolder << " building it in process";
+    QSettings settings(data->settingsFile, QSettings::IniFormat);
+    if(!core::BuildServerData(*data, storageFolder, settings.value("Settings/lastDBUpdate", "").toString()))
+    {
+        QLOG_ERROR() << "couldn't build server data in: " << storageFolder;
+        return {};
+    }
+    manifest.Read(storageFolder);
+    buildId = manifest.buildId;
+    deltaCount = manifest.deltas.size();
+    return data;
+}
+
+FeederService::FeederService(QObject* parent): QObject(parent){
+    startedAt = QDateTime::currentDateTimeUtc();
+    allSearches = 0;
+    genericSearches = 0;
+    recommendationsSearches = 0;
+    randomSearches = 0;
+    rngData.reset(new core::RNGData);
+
+    int reloadCheckMinutes = 0;
+    int metricsSeconds = 0;
+    {
+        QSettings settings("settings/settings_server.ini", QSettings::IniFormat);
+        An<core::RecCalculator> calculator;
+        calculator->threadBudget = settings.value("Settings/reclistThreadBudget", 0).toInt();
+        core::RecCalculatorWorkspace::SetIdleLimit(settings.value("Settings/reclistIdleWorkspaces", 8).toInt());
+        calculator->batchListsPerScan = settings.value("Settings/reclistBatchListsPerScan", 256).toInt();
+        reclistCache.SetByteLimit(settings.value("Settings/reclistCacheSizeMb", 256).toULongLong()*1024*1024);
+        approximateCandidatesForLimitedLists = settings.value("Settings/approximateCandidatesForLimitedLists", false).toBool();
+        approximateRecallSampling = settings.value("Settings/approximateRecallSampling", 0).toInt();
+        reloadCheckMinutes = settings.value("Settings/dataReloadCheckMinutes", 10).toInt();
+        stageMetricsFile = settings.value("Settings/stageMetricsFile", "stage_latencies.txt").toString();
+        metricsSeconds = settings.value("Settings/stageMetricsIntervalSeconds", 60).toInt();
+        if(settings.value("Settings/traceRequests", false).toBool())
+            traceFolder = settings.value("Settings/traceFolder", "traces").toString();
+        tracing::SetLogSpans(settings.value("Settings/logTimedActions", true).toBool());
+        diagnosticTopFics = settings.value("Settings/diagnosticTopFics", 500).toInt();
+        auto data = LoadDataSnapshot("ServerData", settings.value("Settings/buildDataOnStartup", true).toBool(), loadedSnapshotBuild, loadedSnapshotDeltas);
+        hasData = !data.isNull();
+        if(hasData)
+            calculator->SetSnapshot(data);
     }
 
     logTimer.reset(new QTimer());
     logTimer->start(3600000);
     connect(logTimer.data(), SIGNAL(timeout()), this, SLOT(OnPrintStatistics()), Qt::QueuedConnection);
+
+    if(reloadCheckMinutes > 0)
+    {
+        reloadTimer.reset(new QTimer());
+        reloadTimer->start(reloadCheckMinutes*60000);
+        connect(reloadTimer.data(), SIGNAL(timeout()), this, SLOT(OnCheckForDataUpdate()), Qt::QueuedConnection);
+    }
+
+    if(!stageMetricsFile.isEmpty() && metricsSeconds > 0)
+    {
+        metricsTimer.reset(new QTimer());
+        metricsTimer->start(metricsSeconds*1000);
+        connect(metricsTimer.data(), SIGNAL(timeout()), this, SLOT(OnWriteStageMetrics()), Qt::QueuedConnection);
+    }
 }
 
 FeederService::~FeederService()
 {
     qDebug() << "Destroying server";
+    dataReload.waitForFinished();
 }
 
 Status FeederService::GetStatus(ServerContext* context, const ProtoSpace::StatusRequest* task,
@@ -312,6 +349,7 @@ grpc::Status FeederService::GetUserMatches(grpc::ServerContext *context, const P
     Q_UNUSED(context);
     QLOG_INFO() << "Starting user matches";
     An<core::RecCalculator> holder;
+    auto data = holder->Snapshot();
     QHash<int, core::FavouritesMatchResult> fics;
     QLOG_INFO() << "received user task of size: " << task->test_users_size();
     Roaring r;
@@ -328,14 +366,14 @@ grpc::Status FeederService::GetUserMatches(grpc::ServerContext *context, const P
         }
     }
     else
-        r = holder->holder.faves[task->source_user()];
+        r = data->faves.value(task->source_user());
     core::UserMatchesInput input;
     input.userFavourites = r;
     input.userIgnoredFandoms = ignoredFandoms;
     for(int i = 0; i < task->test_users_size(); i++)
     {
         QLOG_INFO() << "Processing user: " << i;
-        fics[task->test_users(i)] = holder->GetMatchedFics(input, task->test_users(i));
+        fics[task->test_users(i)] = holder->GetMatchedFics(data, input, task->test_users(i));
         QLOG_INFO() << "Ratio for user: " << task->test_users(i) << " " << fics[task->test_users(i)].ratio;
         QLOG_INFO() << "Ratio without ignores for user: " << task->test_users(i) << " " << fics[task->test_users(i)].ratioWithoutIgnores;
         QLOG_INFO() << "Matches for user: " << task->test_users(i) << " " << fics[task->test_users(i)].matches;
@@ -530,28 +568,30 @@ grpc::Status FeederService::DiagnosticRecommendationListCreation(grpc::ServerCon
         return Status::OK;
 
     An<core::RecCalculator> recCalculator;
+    auto data = recCalculator->Snapshot();
 
     auto recommendationsCreationParams = basicRecommendationsParamReader(reqContext, task);
     auto ficResult = ficPackReader(reqContext, task);
-    auto moodData = CalcMoodDistributionForFicList(ficResult.fetchedFics.keys(), recCalculator->holder.genreComposites);
+    auto moodData = CalcMoodDistributionForFicList(ficResult.fetchedFics.keys(), data->genreComposites);
 
-    auto list = recCalculator->GetDiagnosticRecommendationList(ficResult.fetchedFics, recommendationsCreationParams, moodData);
+    // diagnostics are only needed for what the client is going to show
+    core::DiagnosticScope scope;
+    scope.topFics = recommendationsCreationParams->resultLimit > 0 ? recommendationsCreationParams->resultLimit : diagnosticTopFics;
+    auto list = recCalculator->GetDiagnosticRecommendationList(data, ficResult.fetchedFics, recommendationsCreationParams, moodData, scope);
     TimedAction dataPassAction("Passing data: ",[&](){
         auto* targetList = response->mutable_list();
 
         targetList->set_quadratic_deviation(list.quad);
         targetList->set_ratio_median(list.ratioMedian);
         targetList->set_distance_to_double_sigma(list.sigma2Dist);
-        QLOG_INFO() << "passing authors for fics into data structures: " << list.authorsForFics.size();
-        auto keys = list.authorsForFics.keys();
-        for(auto fic : keys){
+        QLOG_INFO() << "passing authors for fics into data structures: " << list.diagnostics->Fics().size();
+        list.diagnostics->ForEachFic([&](uint32_t fic, const std::vector<uint32_t>& authors){
             auto* newMatch = targetList->add_matches();
             newMatch->set_fic_id(fic);
-            for(auto author : list.authorsForFics.value(fic))
+            for(auto author : authors)
                 newMatch->add_author_id(author);
-        }
-        QLOG_INFO() << "passing author stats into data: " << list.authorData.size();
-        for(const auto& author : std::as_const(list.authorData))
+        });
+        list.diagnostics->ForEachAuthor([&](const core::AuthorResult& author)
         {
             auto* authorData  = targetList->add_author_params();
             authorData->set_author_id(author.id);
@@ -562,7 +602,7 @@ grpc::Status FeederService::DiagnosticRecommendationListCreation(grpc::ServerCon
             authorData->set_list_size_without_ignores(author.sizeAfterIgnore);
             authorData->set_ratio_difference_on_neutral_mood(author.listDiff.neutralDifference.value_or(0));
             authorData->set_ratio_difference_on_touchy_mood(author.listDiff.touchyDifference.value_or(0));
-        }
+        });
     });
     dataPassAction.run();
 
@@ -602,6 +642,9 @@ Status FeederService::RecommendationListCreation(ServerContext* context, const P
         return Status::OK;
     }
 
+    if(approximateCandidatesForLimitedLists && recommendationsCreationParams->resultLimit != 0)
+        recommendationsCreationParams->useApproximateCandidates = true;
+
     auto ficResult = ficPackReader(reqContext, task);
     auto& fetchedFics = ficResult.fetchedFics;
     if(recommendationsCreationParams->ficFavouritesCutoff != 0){
@@ -623,132 +666,165 @@ Status FeederService::RecommendationListCreation(ServerContext* context, const P
     //recommendationsCreationParams->Log();
 
     An<core::RecCalculator> recCalculator;
-    QLOG_INFO() << "Mood data for source ficlist:";
-    auto moodData = CalcMoodDistributionForFicList(ficResult.fetchedFics.keys(), recCalculator->holder.genreComposites);
+    // the whole request works with this snapshot even if a fresh one gets published in the meantime
+    auto data = recCalculator->Snapshot();
+    const bool ignoreBreakdowns = task->data().response_data_controls().ignore_breakdowns();
+    auto cacheKey = ReclistCacheKey(*recommendationsCreationParams, fetchedFics.keys(), ignoreBreakdowns, data->generation);
+    bool createdHere = false;
+    auto serializedList = reclistCache.GetOrCreate(cacheKey, [&]() -> QByteArray {
+        createdHere = true;
+        QLOG_INFO() << "Mood data for source ficlist:";
+        auto moodData = CalcMoodDistributionForFicList(ficResult.fetchedFics.keys(), data->genreComposites);
+        if(recommendationsCreationParams->useApproximateCandidates && approximateRecallSampling > 0
+                && ++approximateListsCreated % approximateRecallSampling == 0)
+        {
+            // the exact list is only needed for the log so the user doesn't wait for it
+            core::RecommendationList paramsCopy(*recommendationsCreationParams);
+            auto fics = ficResult.fetchedFics;
+            QtConcurrent::run([data, paramsCopy, fics, moodData](){
+                An<core::RecCalculator> calculator;
+                calculator->CompareApproximateCandidates(data, fics, paramsCopy, moodData);
+            });
+        }
 
 
-    auto list = recCalculator->GetMatchedFicsForFavList(ficResult.fetchedFics, recommendationsCreationParams, moodData);
-    int baseVotes = recommendationsCreationParams->useMoodAdjustment ? 20 : 1;
+        // similar fic lists have a single source and can be answered from the neighbour index
+        std::optional<core::RecommendationListResult> indexedList;
+        if(fetchedFics.size() == 1)
+            indexedList = recCalculator->GetSimilarFicsFromIndex(data, fetchedFics.cbegin().key(), recommendationsCreationParams);
+        auto list = indexedList ? std::move(*indexedList)
+                                : recCalculator->GetMatchedFicsForFavList(data, ficResult.fetchedFics, recommendationsCreationParams, moodData);
+        int baseVotes = recommendationsCreationParams->useMoodAdjustment ? 20 : 1;
 
-    //TimedAction dataPassAction("Passing data: ",[&](){
+        //TimedAction dataPassAction("Passing data: ",[&](){
 
 
-        response->Clear();
-        auto* targetList = response->mutable_list();
-        targetList->set_success(list.success);
-        QLOG_INFO() << "Notrash is of size: " <<  list.noTrashScore.size();
-        targetList->set_list_name(proto_converters::TS(recommendationsCreationParams->name));
-        targetList->set_list_ready(true);
-        QLOG_INFO() << "setting list ready to true";
-        using core::AuthorWeightingResult;
-        typedef core::AuthorWeightingResult::EAuthorType EAuthorType;
-
-        auto dataSize = list.recommendations.size();
-        targetList->mutable_fic_matches()->Reserve(dataSize);
-        targetList->mutable_breakdowns()->Reserve(dataSize);
-        if(!task->data().response_data_controls().ignore_breakdowns())
-            targetList->mutable_no_trash_score()->Reserve(dataSize);
-
-        for(auto i = list.recommendations.cbegin(); i != list.recommendations.cend(); i++)
-        {
-            const auto& key = i.key();
-            if(recommendationsCreationParams->resultLimit != 0 && !list.limitedResults.contains(key))
-                continue;
-            const auto& value = i.value();
-            //QLOG_INFO() << " n_fic_id: " << key << " n_matches: " << list[key];
-            if(!recCalculator->holder.fics.contains(key))
-            {
-                qDebug() << "probably an older database, skipping key: " << key;
-                continue;
-            }
+            response->Clear();
+            auto* targetList = response->mutable_list();
+            targetList->set_success(list.success);
+            targetList->set_list_name(proto_converters::TS(recommendationsCreationParams->name));
+            targetList->set_list_ready(true);
+            QLOG_INFO() << "setting list ready to true";
+            using core::AuthorWeightingResult;
+            typedef core::AuthorWeightingResult::EAuthorType EAuthorType;
 
-            int adjustedVotes = value/(baseVotes);
-            if(adjustedVotes < 1)
-                adjustedVotes = 1;
-            // purging based on mood
-//            if(key == 5113112)
-//            {
-//                QLOG_INFO() << "testing purge value:" << value << " divisor:" << baseVotes*list.pureMatches.value(key) << "has decent: " << list.decentMatches.value(key);
-//            }
-            if(recommendationsCreationParams->useMoodAdjustment
-                    //&& (static_cast<float>(list.decentMatches.value(key)) / static_cast<float>(list.pureMatches.value(key))) < 0.1f
-                    && list.decentMatches.value(key) < 1 && adjustedVotes < 10
-                    && !recommendationsCreationParams->likedAuthors.contains(recCalculator->holder.fics.value(key)->authorId))
+            const auto& votes = list.votes;
+            auto dataSize = static_cast<int>(votes.Size());
+            targetList->mutable_fic_matches()->Reserve(dataSize);
+            targetList->mutable_breakdowns()->Reserve(dataSize);
+            if(!task->data().response_data_controls().ignore_breakdowns())
+                targetList->mutable_no_trash_score()->Reserve(dataSize);
+
+            for(size_t i = 0; i < votes.Size(); i++)
             {
-                bool axisGenre = false;;
-                //qDebug() << "attempting to purge fic: " << key;
-                const QHash<int, QList<genre_stats::GenreBit>>& ref = recCalculator->holder.genreComposites;
-                const QList<genre_stats::GenreBit>& refList = ref[key];
-                double maxValue = 0.;
-                // shit code, but I really don't want to refactor rn
-                for(const auto& genreBit: refList)
+                const auto key = static_cast<int>(votes.ficIds[i]);
+                if(recommendationsCreationParams->resultLimit != 0 && !list.limitedResults.contains(key))
+                    continue;
+                const auto& value = votes.recommendations[i];
+                //QLOG_INFO() << " n_fic_id: " << key << " n_matches: " << list[key];
+                if(!data->ficTable.Contains(key))
                 {
-                    if(genreBit.relevance > maxValue)
-                        maxValue = genreBit.relevance;
+                    qDebug() << "probably an older database, skipping key: " << key;
+                    continue;
                 }
 
-                for(const auto& genreBit: refList)
+                int adjustedVotes = value/(baseVotes);
+                if(adjustedVotes < 1)
+                    adjustedVotes = 1;
+                // purging based on mood
+    //            if(key == 5113112)
+    //            {
+    //                QLOG_INFO() << "testing purge value:" << value << " divisor:" << baseVotes*list.pureMatches.value(key) << "has decent: " << list.decentMatches.value(key);
+    //            }
+                if(recommendationsCreationParams->useMoodAdjustment
+                        //&& (static_cast<float>(list.decentMatches.value(key)) / static_cast<float>(list.pureMatches.value(key))) < 0.1f
+                        && votes.decentMatches[i] < 1 && adjustedVotes < 10
+                        && !recommendationsCreationParams->likedAuthors.contains(data->ficTable.AuthorId(data->ficTable.OrdinalForFic(key))))
                 {
-                    //qDebug() << "genres: " << genreBit.genres << " relevance: " << genreBit.relevance;
-                    if(genreBit.relevance/maxValue > 0.45)
+                    bool axisGenre = false;;
+                    //qDebug() << "attempting to purge fic: " << key;
+                    const QHash<int, QList<genre_stats::GenreBit>>& ref = data->genreComposites;
+                    const QList<genre_stats::GenreBit>& refList = ref[key];
+                    double maxValue = 0.;
+                    // shit code, but I really don't want to refactor rn
+                    for(const auto& genreBit: refList)
                     {
-                        for(const auto& actualGenre : std::as_const(genreBit.genres))
+                        if(genreBit.relevance > maxValue)
+                            maxValue = genreBit.relevance;
+                    }
+
+                    for(const auto& genreBit: refList)
+                    {
+                        //qDebug() << "genres: " << genreBit.genres << " relevance: " << genreBit.relevance;
+                        if(genreBit.relevance/maxValue > 0.45)
                         {
-                            auto mood = interfaces::Genres::MoodForGenre(actualGenre);
-                            if(moodData.moodAxis.contains(mood))
-                                axisGenre = true;
+                            for(const auto& actualGenre : std::as_const(genreBit.genres))
+                            {
+                                auto mood = interfaces::Genres::MoodForGenre(actualGenre);
+                                if(moodData.moodAxis.contains(mood))
+                                    axisGenre = true;
+                            }
                         }
                     }
-                }
 
-                if(!axisGenre)
-                    targetList->add_purged(1);
-                else
+                    if(!axisGenre)
+                        targetList->add_purged(1);
+                    else
+                        targetList->add_purged(0);
+                }
+                else {
                     targetList->add_purged(0);
+                }
+                targetList->add_fic_matches(adjustedVotes);
+                targetList->add_fic_votes(votes.pureMatches[i]);
+                if(!task->data().response_data_controls().ignore_breakdowns())
+                    targetList->add_no_trash_score(votes.sumNegativeVotes[i]);
+
+                targetList->add_fic_ids(key);
+                //targetList->add_fic_matches(list.recommendations[key]/100);
+                //targetList->add_fic_matches(list.recommendations[key]);
+                auto* target = targetList->add_breakdowns();
+                target->set_id(key);
+                if(!task->data().response_data_controls().ignore_breakdowns()){
+                    const auto& typeVotes = votes.breakdownVotes[i];
+                    const auto& typeCounts = votes.breakdownCounts[i];
+                    target->set_votes_common(typeVotes[static_cast<int>(EAuthorType::common)]);
+                    target->set_votes_uncommon(typeVotes[static_cast<int>(EAuthorType::uncommon)]);
+                    target->set_votes_rare(typeVotes[static_cast<int>(EAuthorType::rare)]);
+                    target->set_votes_unique(typeVotes[static_cast<int>(EAuthorType::unique)]);
+
+                    target->set_counts_common(typeCounts[static_cast<int>(EAuthorType::common)]);
+                    target->set_counts_uncommon(typeCounts[static_cast<int>(EAuthorType::uncommon)]);
+                    target->set_counts_rare(typeCounts[static_cast<int>(EAuthorType::rare)]);
+                    target->set_counts_unique(typeCounts[static_cast<int>(EAuthorType::unique)]);
+                }
             }
-            else {
-                targetList->add_purged(0);
-            }
-            targetList->add_fic_matches(adjustedVotes);
-            targetList->add_fic_votes(list.pureMatches.value(key));
-            if(!task->data().response_data_controls().ignore_breakdowns())
-                targetList->add_no_trash_score(list.sumNegativeVotesForFic[key]);
-
-            targetList->add_fic_ids(key);
-            //targetList->add_fic_matches(list.recommendations[key]/100);
-            //targetList->add_fic_matches(list.recommendations[key]);
-            auto* target = targetList->add_breakdowns();
-            target->set_id(key);
-            if(!task->data().response_data_controls().ignore_breakdowns()){
-                target->set_votes_common(list.breakdowns[key].authorTypeVotes[EAuthorType::common]);
-                target->set_votes_uncommon(list.breakdowns[key].authorTypeVotes[EAuthorType::uncommon]);
-                target->set_votes_rare(list.breakdowns[key].authorTypeVotes[EAuthorType::rare]);
-                target->set_votes_unique(list.breakdowns[key].authorTypeVotes[EAuthorType::unique]);
-
-                target->set_counts_common(list.breakdowns[key].authorTypes[EAuthorType::common]);
-                target->set_counts_uncommon(list.breakdowns[key].authorTypes[EAuthorType::uncommon]);
-                target->set_counts_rare(list.breakdowns[key].authorTypes[EAuthorType::rare]);
-                target->set_counts_unique(list.breakdowns[key].authorTypes[EAuthorType::unique]);
-            }
-        }
-        qDebug() << "Match report will contain: " << list.matchReport.size() << " fics";
-        for(const auto& author: std::as_const(list.authors))
-            response->mutable_list()->add_author_ids(author);
-
-        if(!task->data().response_data_controls().ignore_breakdowns())
-            for(auto i = list.matchReport.cbegin(); i != list.matchReport.cend(); i++)
-                (*targetList->mutable_match_report())[i.key()] = i.value();
-
-        response->mutable_list()->mutable_used_params()->set_is_automatic(recommendationsCreationParams->isAutomatic);
-        response->mutable_list()->mutable_used_params()->set_min_fics_to_match(recommendationsCreationParams->minimumMatch);
-        response->mutable_list()->mutable_used_params()->set_max_unmatched_to_one_matched(recommendationsCreationParams->maxUnmatchedPerMatch);
-        response->mutable_list()->mutable_used_params()->set_always_pick_at(recommendationsCreationParams->alwaysPickAt);
-        response->mutable_list()->mutable_used_params()->set_use_weighting(recommendationsCreationParams->useWeighting);
-        response->mutable_list()->mutable_used_params()->set_use_mood_filtering(recommendationsCreationParams->useMoodAdjustment);
-        response->mutable_list()->mutable_used_params()->set_use_dislikes(recommendationsCreationParams->useDislikes);
-        response->mutable_list()->mutable_used_params()->set_use_dead_fic_ignore(recommendationsCreationParams->useDeadFicIgnore);
-        //});
+            qDebug() << "Match report will contain: " << list.matchReport.size() << " fics";
+            for(const auto& author: std::as_const(list.authors))
+                response->mutable_list()->add_author_ids(author);
 
+            if(!task->data().response_data_controls().ignore_breakdowns())
+                for(auto i = list.matchReport.cbegin(); i != list.matchReport.cend(); i++)
+                    (*targetList->mutable_match_report())[i.key()] = i.value();
+
+            response->mutable_list()->mutable_used_params()->set_is_automatic(recommendationsCreationParams->isAutomatic);
+            response->mutable_list()->mutable_used_params()->set_min_fics_to_match(recommendationsCreationParams->minimumMatch);
+            response->mutable_list()->mutable_used_params()->set_max_unmatched_to_one_matched(recommendationsCreationParams->maxUnmatchedPerMatch);
+            response->mutable_list()->mutable_used_params()->set_always_pick_at(recommendationsCreationParams->alwaysPickAt);
+            response->mutable_list()->mutable_used_params()->set_use_weighting(recommendationsCreationParams->useWeighting);
+            response->mutable_list()->mutable_used_params()->set_use_mood_filtering(recommendationsCreationParams->useMoodAdjustment);
+            response->mutable_list()->mutable_used_params()->set_use_dislikes(recommendationsCreationParams->useDislikes);
+            response->mutable_list()->mutable_used_params()->set_use_dead_fic_ignore(recommendationsCreationParams->useDeadFicIgnore);
+            //});
+        if(!response->list().success())
+            return {};
+        return QByteArray::fromStdString(response->SerializeAsString());
+    });
+    if(!createdHere)
+    {
+        QLOG_INFO() << "Reusing reclist created for an identical request";
+        response->ParseFromArray(serializedList.constData(), serializedList.size());
+    }
 //    });
 //    dataPassAction.run();
     QLOG_INFO() << "Byte size will be: " << response->ByteSizeLong();
@@ -1075,6 +1151,10 @@ void FeederService::PrintStatistics(){
     STAT_INFO() << "Generic: " << genericSearches;
     STAT_INFO() << "Recommendations: " << recommendationsSearches;
     STAT_INFO() << "Random: " << randomSearches;
+    STAT_INFO() << "Reclist cache hits: " << reclistCache.hits << " joined: " << reclistCache.joined << " misses: " << reclistCache.misses;
+    STAT_INFO() << "Span latencies in microseconds:";
+    for(const auto& line : tracing::DescribeStatistics(tracing::CollectStatistics()))
+        STAT_INFO() << line;
 }
 
 bool FeederService::VerifySearchInput(QString userToken,
@@ -1181,6 +1261,62 @@ void FeederService::OnPrintStatistics()
     PrintStatistics();
 }
 
+void FeederService::OnWriteStageMetrics()
+{
+    if(!tracing::WriteMetricsFile(stageMetricsFile))
+        QLOG_WARN() << "couldn't write stage metrics into: " << stageMetricsFile;
+}
+
+void FeederService::OnCheckForDataUpdate()
+{
+    // snapshot_builder writes a new manifest once the snapshot it built from a fresh database is complete
+    // or once it has added a delta to the snapshot that is already served
+    core::SnapshotManifest manifest;
+    if(!manifest.Read("ServerData"))
+        return;
+    // loaded build and deltas are only written by the reload, so they are read once it's known not to be running
+    if(dataReloadInProgress.exchange(true))
+        return;
+    const bool newSnapshot = manifest.buildId != loadedSnapshotBuild;
+    const int firstDelta = loadedSnapshotDeltas;
+    if(!newSnapshot && manifest.deltas.size() <= firstDelta)
+    {
+        dataReloadInProgress = false;
+        return;
+    }
+    if(newSnapshot)
+        QLOG_INFO() << "snapshot " << manifest.buildId << " was built for database update: " << manifest.databaseUpdate << " loading it";
+    else
+        QLOG_INFO() << "snapshot " << manifest.buildId << " has new deltas for database update: " << manifest.databaseUpdate << " applying them";
+    dataReload = QtConcurrent::run([this, manifest, newSnapshot, firstDelta](){
+        An<core::RecCalculator> calculator;
+        QSharedPointer<core::DataHolder> data;
+        QString buildId = manifest.buildId;
+        int deltaCount = manifest.deltas.size();
+        if(newSnapshot)
+            data = LoadDataSnapshot("ServerData", false, buildId, deltaCount);
+        else
+        {
+            // requests keep using the published snapshot while its copy is being updated
+            // applying detaches the copied favourites, every bitmap exists twice until the old snapshot is freed
+            data.reset(new core::DataHolder(*calculator->Snapshot()));
+            if(!core::ApplyServerDeltas(*data, "ServerData", manifest, firstDelta))
+                data.reset();
+        }
+        if(data)
+        {
+            calculator->SetSnapshot(data);
+            // lists created from the old snapshot can't be hit anymore since generation is a part of the key
+            reclistCache.Clear();
+            loadedSnapshotBuild = buildId;
+            loadedSnapshotDeltas = deltaCount;
+        }
+        else
+            QLOG_WARN() << "snapshot " << manifest.buildId << " wasn't loaded, the served one stays and the load is retried on the next check";
+        dataReloadInProgress = false;
+    });
+}
+
 
 RequestContext::RequestContext(QString requestName, const ProtoSpace::ControlInfo & control, FeederService *server)
 {
@@ -1195,6 +1331,7 @@ RequestContext::RequestContext(QString requestName, const ProtoSpace::ControlInf
 
     this->server = server;
     recsData = ThreadData::GetRecommendationData();
+    trace.reset(new tracing::RequestTrace("Request " + requestName, server->traceFolder));
 }
 
 bool RequestContext::Process(ProtoSpace::ResponseInfo * info)
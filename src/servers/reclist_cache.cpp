@@ -0,0 +1,149 @@
+/*
+Flipper is a recommendation and search engine for fanfiction.net
+Copyright (C) 2017-2020  Marchenko Nikolai
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+#include "servers/reclist_cache.h"
+#include "core/recommendation_list.h"
+
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <algorithm>
+
+template <typename T>
+static void WriteSorted(QDataStream& out, const QSet<T>& set){
+    auto values = set.values();
+    std::sort(values.begin(), values.end());
+    out << values;
+}
+
+QByteArray ReclistCacheKey(const core::RecommendationList& params, QList<uint32_t> sourceFics, bool ignoreBreakdowns, uint32_t dataGeneration)
+{
+    QByteArray data;
+    QDataStream out(&data, QIODevice::WriteOnly);
+    std::sort(sourceFics.begin(), sourceFics.end());
+    out << sourceFics;
+    out << params.name;
+    out << params.isAutomatic << params.adjusting << params.useWeighting << params.useMoodAdjustment;
+    out << params.useDislikes << params.useDeadFicIgnore << params.assignLikedToSources << params.ignoreBreakdowns << params.useApproximateCandidates;
+    out << params.minimumMatch << params.alwaysPickAt << params.maxUnmatchedPerMatch << params.userFFNId;
+    out << params.listSizeMultiplier << params.ficFavouritesCutoff << params.resultLimit << params.ratioCutoff;
+    WriteSorted(out, params.ignoredFandoms);
+    WriteSorted(out, params.ignoredDeadFics);
+    WriteSorted(out, params.likedAuthors);
+    WriteSorted(out, params.minorNegativeVotes);
+    WriteSorted(out, params.majorNegativeVotes);
+    WriteSorted(out, params.ficData->sourceFics);
+    WriteSorted(out, params.ficData->taggedFics);
+    out << ignoreBreakdowns << dataGeneration;
+    return QCryptographicHash::hash(data, QCryptographicHash::Sha1);
+}
+
+QByteArray ReclistCache::GetOrCreate(const QByteArray& key, const std::function<QByteArray ()>& creator)
+{
+    QMutexLocker locker(&lock);
+    while(true)
+    {
+        auto it = entries.find(key);
+        if(it != entries.end())
+        {
+            usage.splice(usage.begin(), usage, it->position);
+            hits++;
+            return it->data;
+        }
+        auto flight = flights.value(key);
+        if(!flight)
+            break;
+
+        joined++;
+        while(!flight->finished)
+            flightFinished.wait(&lock);
+        if(flight->error)
+            std::rethrow_exception(flight->error);
+        if(!flight->data.isEmpty())
+            return flight->data;
+        // the creation we waited for has failed, trying on our own
+    }
+
+    misses++;
+    QSharedPointer<Flight> flight(new Flight);
+    flights.insert(key, flight);
+    locker.unlock();
+
+    try{
+        flight->data = creator();
+    }
+    catch(...){
+        flight->error = std::current_exception();
+    }
+
+    locker.relock();
+    Finish(key, flight);
+    if(flight->error)
+        std::rethrow_exception(flight->error);
+    return flight->data;
+}
+
+void ReclistCache::Finish(const QByteArray& key, QSharedPointer<Flight> flight)
+{
+    flight->finished = true;
+    flights.remove(key);
+    if(!flight->error && !flight->data.isEmpty())
+        Insert(key, flight->data);
+    flightFinished.wakeAll();
+}
+
+void ReclistCache::SetByteLimit(size_t limit)
+{
+    QMutexLocker locker(&lock);
+    byteLimit = limit;
+    Evict();
+}
+
+void ReclistCache::Clear()
+{
+    QMutexLocker locker(&lock);
+    entries.clear();
+    usage.clear();
+    usedBytes = 0;
+}
+
+void ReclistCache::Insert(const QByteArray& key, const QByteArray& data)
+{
+    if(static_cast<size_t>(key.size() + data.size()) > byteLimit)
+        return;
+    auto it = entries.find(key);
+    if(it != entries.end())
+    {
+        usedBytes -= static_cast<size_t>(key.size() + it->data.size());
+        usage.erase(it->position);
+        entries.erase(it);
+    }
+    usage.push_front(key);
+    entries.insert(key, {data, usage.begin()});
+    usedBytes += static_cast<size_t>(key.size() + data.size());
+    Evict();
+}
+
+void ReclistCache::Evict()
+{
+    while(usedBytes > byteLimit && !usage.empty())
+    {
+        auto it = entries.find(usage.back());
+        usedBytes -= static_cast<size_t>(it.key().size() + it->data.size());
+        entries.erase(it);
+        usage.pop_back();
+    }
+}
@@ -16,150 +16,235 @@ You should have received a copy of the GNU General Public License
 along with this program.  If not, see <http://www.gnu.org/licenses/>
 */
 #include "tasks/author_genre_iteration_processor.h"
-#include "include/url_utils.h"
-#include "include/page_utils.h"
 #include "include/Interfaces/genres.h"
-#include "include/timeutils.h"
-#include "include/statistics_utils.h"
+#include "threaded_data/parallel_for.h"
+#include "logger/QsLog.h"
 
-#include <QThread>
-#include <QtConcurrent>
+#include <algorithm>
+#include <array>
+#include <bitset>
+#include <limits>
+#include <vector>
 
 AuthorGenreIterationProcessor::AuthorGenreIterationProcessor()
 {
 }
 
-struct AuthorGenreData{
-    void Clear(){
-        genreFactors = std::array<double, 22>{};
+// size of the genre arrays, genres are stored at GenreIndex::indexInDatabase
+static constexpr size_t genreCount = 22;
+static constexpr int moodCount = 7;
+
+// moods in the order of their bits in a fic's mood mask
+static const std::array<QString, moodCount> moodNames = {
+    QStringLiteral("Neutral"), QStringLiteral("Funny"), QStringLiteral("Hurty"), QStringLiteral("Bondy"),
+    QStringLiteral("Dramatic"), QStringLiteral("Shocky"), QStringLiteral("Flirty")};
+static constexpr std::array<float genre_stats::ListMoodData::*, moodCount> moodFields = {
+    &genre_stats::ListMoodData::strengthNeutral, &genre_stats::ListMoodData::strengthFunny, &genre_stats::ListMoodData::strengthHurty,
+    &genre_stats::ListMoodData::strengthBondy, &genre_stats::ListMoodData::strengthDramatic, &genre_stats::ListMoodData::strengthShocky,
+    &genre_stats::ListMoodData::strengthFlirty};
+
+// every genre name is resolved once instead of for every fic of every author
+struct GenreVocabulary{
+    struct Slot{
+        uint8_t genre = 0;
+        // 0 when the genre doesn't count towards any mood
+        uint8_t moodBit = 0;
+    };
+    GenreVocabulary(){
+        An<interfaces::GenreIndex> genreIndex;
+        for(auto i = genreIndex->genresByName.cbegin(); i != genreIndex->genresByName.cend(); i++)
+        {
+            if(i.value().indexInDatabase >= genreCount)
+                continue;
+            Slot slot;
+            slot.genre = static_cast<uint8_t>(i.value().indexInDatabase);
+            const auto mood = std::find(moodNames.begin(), moodNames.end(), interfaces::Genres::MoodForGenre(i.key()));
+            if(mood != moodNames.end())
+                slot.moodBit = static_cast<uint8_t>(1u << std::distance(moodNames.begin(), mood));
+            slots.insert(i.key(), slot);
+        }
     }
-    int authorId = -1;
-    std::array<double, 22> genreFactors;
+    const Slot* Find(const QString& name) const{
+        auto it = slots.find(name);
+        if(it == slots.cend())
+            it = slots.find(name.trimmed());
+        return it == slots.cend() ? nullptr : &it.value();
+    }
+    QHash<QString, Slot> slots;
 };
 
-struct IteratorTask{
-    QHash<int, Roaring>::iterator start;
-    QHash<int, Roaring>::iterator end;
-};
+// genres and moods of every fic that is in someone's favourites, computed once per fic instead of once per author that has it
+// genres of row i are entries[offsets[i]] to entries[offsets[i + 1]]
+struct FicGenreRows{
+    static constexpr uint32_t invalid = std::numeric_limits<uint32_t>::max();
+    struct Entry{
+        uint8_t genre = 0;
+        float relevance = 0.f;
+    };
 
+    uint32_t RowFor(uint32_t fic) const{
+        if(!rowForFic.empty())
+            return fic < rowForFic.size() ? rowForFic[fic] : invalid;
+        auto it = std::lower_bound(fics.begin(), fics.end(), fic);
+        return it != fics.end() && *it == fic ? static_cast<uint32_t>(std::distance(fics.begin(), it)) : invalid;
+    }
 
-struct GenreResult{
-    AuthorGenreData genreData;
-    genre_stats::ListMoodData moodData;
+    // sorted, row i belongs to fics[i]
+    std::vector<uint32_t> fics;
+    // only filled when the fics are dense enough for a direct lookup to be affordable
+    std::vector<uint32_t> rowForFic;
+    std::vector<uint32_t> offsets;
+    std::vector<Entry> entries;
+    std::vector<uint8_t> moods;
 };
-void AuthorGenreIterationProcessor::ReprocessGenreStats(QHash<int, QList<genre_stats::GenreBit> > inputFicData,
-                                                        QHash<int, Roaring> inputAuthorData)
+
+// only the genres that are in the original genres of the fic count, every mood counts once per fic
+static void ReadFicGenres(const QList<genre_stats::GenreBit>& bits, const GenreVocabulary& vocabulary,
+                          std::array<float, genreCount>& relevance, uint32_t& genreMask, uint8_t& moodMask)
 {
-    statistics_utils::UserPageSource source;
-    statistics_utils::UserPageSink<AuthorGenreData> sink;
-
-    QList<IteratorTask> iteratorTasks;
-    int processingThreads = QThread::idealThreadCount()-1;
-    int chunkSize = inputAuthorData.size()/processingThreads;
-    int i = 0;
-    for(; i < processingThreads; i++)
-        iteratorTasks.push_back({std::next(inputAuthorData.begin(), i*chunkSize), (i + 1) == processingThreads ? inputAuthorData.end() : std::next(inputAuthorData.begin(), (i+1)*chunkSize)});
-
-    sink.tokens.reserve(inputAuthorData.size());
-    auto processor = [](IteratorTask task, const QHash<int, QList<genre_stats::GenreBit>> inputFicData) -> QList<GenreResult> {
-        auto it = task.start;
-        QList<GenreResult> result;
-        result.reserve(std::distance(task.start, task.end));
-        An<interfaces::GenreIndex> genreIndex;
-        thread_local AuthorGenreData data;
-        thread_local genre_stats::ListMoodData moodData;
-        thread_local QHash<QString, float> genreKeeper;
-        while(it != task.end)
+    relevance = {};
+    genreMask = 0;
+    moodMask = 0;
+    for(const auto& bit : bits)
+    {
+        if(!bit.isInTheOriginal)
+            continue;
+        for(const auto& genre : bit.genres)
         {
-            data.Clear();
-            moodData.Clear();
-            genreKeeper.clear();
-            //interfaces::Genres::LogGenreDistribution(data.genreFactors, "this is supposed to be clean");
-            data.authorId = it.key();
-            int ficTotal = it.value().cardinality();
-            //QLOG_INFO() << "Total fics for author id: " << it.key() << " : " << ficTotal;
-            for(auto ficId : it.value())
-            {
-                QHash<int, QList<genre_stats::GenreBit>>::const_iterator ficIt = inputFicData.find(ficId);
-                if(ficIt == inputFicData.end())
-                {
-                    QLOG_INFO() << "No data for fic: " << ficId;
-                    continue;
-                }
-                QString log = "genres for fic: " +  QString::number(ficId) + " ";
-                QHash<QString, float> moodHashForFic;
-                moodHashForFic.clear();
-                for(const auto& genreBit: ficIt.value())
-                {
-                    for(auto actualBit: std::as_const(genreBit.genres))
-                    {
-
-                        actualBit = actualBit.trimmed();
-                        //if(genreBit.isInTheOriginal)
-                        log +=  "{"  + actualBit + " " + QString::number(genreBit.relevance) + "} ";
-
-                        QString moodForGenre = interfaces::Genres::MoodForGenre(actualBit);
-
-//                        if( ((genreBit.relevance > 0.5 && moodForGenre != "Hurty" && moodForGenre != "Bondy") || genreBit.isInTheOriginal)
-//                                || genreBit.relevance > 1 )
-                        if(genreBit.isInTheOriginal)
-                        {
-                            genreKeeper[actualBit] += genreBit.relevance;
+            const auto* slot = vocabulary.Find(genre);
+            if(!slot)
+                continue;
+            relevance[slot->genre] += bit.relevance;
+            genreMask |= 1u << slot->genre;
+            moodMask |= slot->moodBit;
+        }
+    }
+}
 
-                            if(!moodHashForFic.contains(moodForGenre) || moodHashForFic[moodForGenre] < genreBit.relevance)
-                                moodHashForFic[moodForGenre] = 1;
-                                //moodHashForFic[moodForGenre] = genreBit.relevance;
+static FicGenreRows BuildFicGenreRows(const QHash<int, QList<genre_stats::GenreBit>>& inputFicData,
+                                      const std::vector<const Roaring*>& favourites)
+{
+    FicGenreRows rows;
+    const auto allFics = Roaring::fastunion(favourites.size(), const_cast<const Roaring**>(favourites.data()));
+    rows.fics.resize(allFics.cardinality());
+    allFics.toUint32Array(rows.fics.data());
+    const size_t size = rows.fics.size();
+    if(size > 0 && static_cast<uint64_t>(allFics.maximum()) < 16ull*size)
+    {
+        rows.rowForFic.assign(static_cast<size_t>(allFics.maximum()) + 1, FicGenreRows::invalid);
+        for(size_t i = 0; i < size; i++)
+            rows.rowForFic[rows.fics[i]] = static_cast<uint32_t>(i);
+    }
 
-                        }
-                    }
-                }
+    const GenreVocabulary vocabulary;
+    std::vector<const QList<genre_stats::GenreBit>*> ficBits(size, nullptr);
+    std::vector<uint32_t> entryCounts(size, 0);
+    rows.moods.resize(size, 0);
+    thread_boost::ParallelFor(size, {0, 4096}, [&](size_t begin, size_t end){
+        std::array<float, genreCount> relevance;
+        uint32_t genreMask = 0;
+        for(auto i = begin; i < end; i++)
+        {
+            auto it = inputFicData.find(static_cast<int>(rows.fics[i]));
+            if(it == inputFicData.cend())
+                continue;
+            ficBits[i] = &it.value();
+            ReadFicGenres(it.value(), vocabulary, relevance, genreMask, rows.moods[i]);
+            entryCounts[i] = static_cast<uint32_t>(std::bitset<genreCount>(genreMask).count());
+        }
+    });
 
-                for(auto i = moodHashForFic.begin(); i != moodHashForFic.end(); i++)
-                    interfaces::Genres::WriteMoodValue(i.key(), i.value(), moodData);
+    rows.offsets.resize(size + 1);
+    rows.offsets[0] = 0;
+    size_t missing = 0;
+    for(size_t i = 0; i < size; i++)
+    {
+        rows.offsets[i + 1] = rows.offsets[i] + entryCounts[i];
+        if(!ficBits[i])
+            missing++;
+    }
+    rows.entries.resize(rows.offsets[size]);
+    thread_boost::ParallelFor(size, {0, 4096}, [&](size_t begin, size_t end){
+        std::array<float, genreCount> relevance;
+        uint32_t genreMask = 0;
+        uint8_t moodMask = 0;
+        for(auto i = begin; i < end; i++)
+        {
+            if(!ficBits[i])
+                continue;
+            ReadFicGenres(*ficBits[i], vocabulary, relevance, genreMask, moodMask);
+            auto entry = rows.offsets[i];
+            for(uint8_t genre = 0; genre < genreCount; genre++)
+                if(genreMask & (1u << genre))
+                    rows.entries[entry++] = {genre, relevance[genre]};
+        }
+    });
+    if(missing > 0)
+        QLOG_INFO() << "No genre data for fics: " << missing << " out of: " << size;
+    return rows;
+}
 
-                //QLOG_INFO() << log;
+void AuthorGenreIterationProcessor::ReprocessGenreStats(const QHash<int, QList<genre_stats::GenreBit> >& inputFicData,
+                                                        const QHash<int, Roaring>& inputAuthorData)
+{
+    if(inputAuthorData.isEmpty())
+        return;
+    std::vector<int> authors;
+    std::vector<const Roaring*> favourites;
+    authors.reserve(static_cast<size_t>(inputAuthorData.size()));
+    favourites.reserve(static_cast<size_t>(inputAuthorData.size()));
+    for(auto i = inputAuthorData.cbegin(); i != inputAuthorData.cend(); i++)
+    {
+        authors.push_back(i.key());
+        favourites.push_back(&i.value());
+    }
 
-            }
+    // also called for single lists while serving requests, timing is left to the callers
+    const auto rows = BuildFicGenreRows(inputFicData, favourites);
 
-            for(auto i = genreKeeper.begin(); i != genreKeeper.end(); i++)
+    std::vector<std::array<double, genreCount>> genreResults(authors.size());
+    std::vector<genre_stats::ListMoodData> moodResults(authors.size());
+    thread_boost::ParallelFor(authors.size(), {0, 64}, [&](size_t begin, size_t end){
+        std::vector<uint32_t> fics;
+        for(auto i = begin; i < end; i++)
+        {
+            const auto& authorFavourites = *favourites[i];
+            fics.resize(authorFavourites.cardinality());
+            authorFavourites.toUint32Array(fics.data());
+            std::array<float, genreCount> genreSums{};
+            std::array<int, moodCount> moodCounts{};
+            for(auto fic : fics)
             {
-                double factor = static_cast<double>(i.value())/static_cast<double>(ficTotal);
-                //QLOG_INFO() << "Appending value of: " << genre << " " << factor;
-                data.genreFactors[genreIndex->IndexByFFNName(i.key())] += factor;
-                //interfaces::Genres::LogGenreDistribution(data.genreFactors);
+                const auto row = rows.RowFor(fic);
+                if(row == FicGenreRows::invalid)
+                    continue;
+                for(auto entry = rows.offsets[row]; entry < rows.offsets[row + 1]; entry++)
+                    genreSums[rows.entries[entry].genre] += rows.entries[entry].relevance;
+                const auto moodMask = rows.moods[row];
+                for(int mood = 0; mood < moodCount; mood++)
+                    moodCounts[mood] += (moodMask >> mood) & 1;
             }
-            //QLOG_INFO() << "Genre distribution for author: " << data.authorId;
-            //interfaces::Genres::LogGenreDistribution(data.genreFactors);
-            //moodData.Log();
+
+            const int ficTotal = static_cast<int>(fics.size());
+            auto& genreFactors = genreResults[i];
+            genreFactors = {};
+            for(size_t genre = 0; genre < genreCount; genre++)
+                if(genreSums[genre] != 0.f)
+                    genreFactors[genre] = static_cast<double>(genreSums[genre])/static_cast<double>(ficTotal);
+            auto& moodData = moodResults[i];
+            for(int mood = 0; mood < moodCount; mood++)
+                moodData.*moodFields[mood] = static_cast<float>(moodCounts[mood]);
             moodData.DivideByCount(ficTotal);
-            result.push_back({data, moodData});
-            it++;
         }
-        return result;
-    };
+    });
 
-    QVector<QFuture<QList<GenreResult>>> futures;
-    futures.reserve(processingThreads);
-    for(int i = 0; i < processingThreads; i++)
+    resultingGenreAuthorData.reserve(resultingGenreAuthorData.size() + static_cast<int>(authors.size()));
+    resultingMoodAuthorData.reserve(resultingMoodAuthorData.size() + static_cast<int>(authors.size()));
+    for(size_t i = 0; i < authors.size(); i++)
     {
-        futures.push_back(QtConcurrent::run(processor, iteratorTasks[i], inputFicData));
+        resultingGenreAuthorData[authors[i]] = genreResults[i];
+        resultingMoodAuthorData[static_cast<uint32_t>(authors[i])] = moodResults[i];
     }
-    for(auto future: futures)
-    {
-        future.waitForFinished();
-    }
-    for(const auto& future: futures)
-    {
-        const auto& result = future.result();
-        for(auto data : std::as_const(result))
-        {
-            resultingGenreAuthorData[data.genreData.authorId] = data.genreData.genreFactors;
-            resultingMoodAuthorData [data.genreData.authorId] = data.moodData;
-        }
-    }
-
-    //resultingMoodAuthorData = CreateMoodDataFromGenres(resultingGenreAuthorData);
-
 }
 
 
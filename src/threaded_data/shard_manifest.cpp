@@ -0,0 +1,118 @@
+/*
+Flipper is a recommendation and search engine for fanfiction.net
+Copyright (C) 2017-2020  Marchenko Nikolai
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+#include "threaded_data/shard_manifest.h"
+
+#include <QDebug>
+#include <QFile>
+#include <QSettings>
+#include <QStringList>
+
+#include <algorithm>
+
+namespace thread_boost{
+
+int ShardManifest::ShardCountFor(int size)
+{
+    return std::clamp((size + entriesPerShard - 1)/entriesPerShard, 1, maxShards);
+}
+
+QString ShardManifest::FileName(QString nameBase)
+{
+    return nameBase + "_shards.ini";
+}
+
+QString ShardManifest::ShardFileName(QString nameBase, int shard)
+{
+    return QString("%1_%2.txt").arg(nameBase, QString::number(shard));
+}
+
+QString ShardManifest::PartialShardFileName(QString nameBase, int shard)
+{
+    return ShardFileName(nameBase, shard) + ".part";
+}
+
+bool ShardManifest::Read(QString nameBase)
+{
+    sizes.clear();
+    if(!QFile::exists(FileName(nameBase)))
+        return false;
+    QSettings settings(FileName(nameBase), QSettings::IniFormat);
+    if(settings.value("Shards/version", 0).toInt() != version)
+        return false;
+    const auto storedSizes = settings.value("Shards/sizes").toStringList();
+    if(storedSizes.size() != settings.value("Shards/count", -1).toInt())
+        return false;
+    for(const auto& size : storedSizes)
+        sizes.push_back(size.toInt());
+    return true;
+}
+
+void ShardManifest::Discover(QString nameBase)
+{
+    sizes.clear();
+    for(int shard = 0; QFile::exists(ShardFileName(nameBase, shard)) || QFile::exists(PartialShardFileName(nameBase, shard)); shard++)
+    {
+        // publishing was interrupted, the shards are a mix of two writes
+        if(QFile::exists(PartialShardFileName(nameBase, shard)))
+        {
+            qDebug() << "shards of " << nameBase << " were not completely written";
+            sizes.clear();
+            return;
+        }
+        sizes.push_back(0);
+    }
+}
+
+bool ShardManifest::Publish(QString nameBase) const
+{
+    // without the manifest readers fall back to Discover, which refuses the set until every partial shard is moved
+    QFile::remove(FileName(nameBase));
+    for(int shard = Count(); QFile::exists(ShardFileName(nameBase, shard)); shard++)
+        QFile::remove(ShardFileName(nameBase, shard));
+    for(int shard = 0; shard < Count(); shard++)
+    {
+        QFile::remove(ShardFileName(nameBase, shard));
+        if(!QFile::rename(PartialShardFileName(nameBase, shard), ShardFileName(nameBase, shard)))
+            return false;
+    }
+    QSettings settings(FileName(nameBase), QSettings::IniFormat);
+    QStringList storedSizes;
+    for(auto size : sizes)
+        storedSizes.push_back(QString::number(size));
+    settings.setValue("Shards/version", version);
+    settings.setValue("Shards/count", Count());
+    settings.setValue("Shards/sizes", storedSizes);
+    settings.sync();
+    return settings.status() == QSettings::NoError;
+}
+
+void ShardManifest::RemovePartialShards(QString nameBase) const
+{
+    for(int shard = 0; shard < Count(); shard++)
+        QFile::remove(PartialShardFileName(nameBase, shard));
+}
+
+qint64 ShardManifest::Total() const
+{
+    qint64 result = 0;
+    for(auto size : sizes)
+        result += size;
+    return result;
+}
+
+}
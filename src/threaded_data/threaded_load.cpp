@@ -17,6 +17,8 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 */
 #include "threaded_data/threaded_load.h"
 #include "threaded_data/common_traits.h"
+#include "threaded_data/shard_manifest.h"
+#include "threaded_data/parallel_for.h"
 
 #include <QThread>
 #include <QDebug>
@@ -26,6 +28,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #include <QFutureWatcher>
 #include <QtConcurrent>
 #include <iostream>
+#include <vector>
 namespace thread_boost{
 namespace  Impl{
 template<class T, class Enable = void>
@@ -41,7 +44,7 @@ struct ContainerValueTypeGetter<T, typename std::enable_if<is_hash<T>::value>::t
 template <typename ContainerType, typename ValueType>
 inline void PutIntoContainer(ContainerType& container, ValueType& value, int& key){
     if constexpr(is_hash<ContainerType>::value)
-            container[key] = value;
+            container[key] = std::move(value);
     else
     container.push_back(value);
 }
@@ -97,7 +100,7 @@ auto resultCreator,
 int file,
 auto valueFetcher){
     auto resultHolder = resultCreator();
-    QString fileName = QString("%1_%2.txt").arg(nameBase,QString::number(file));
+    QString fileName = ShardManifest::ShardFileName(nameBase, file);
     QFile data(fileName);
     if (data.open(QFile::ReadOnly))
     {
@@ -107,11 +110,7 @@ auto valueFetcher){
         qDebug() << "Starting file: " << fileName << " of size: " << size;
         resultHolder.reserve(size);
         for(int i = 0; i < size; i++)
-        {
-            if(i%10000 == 0)
-                qDebug() << "processing entity: " << fileName << " " << i;
             valueFetcher(resultHolder, in);
-        }
     }
     else
         qDebug() << "Could not open file: " << fileName;
@@ -120,33 +119,44 @@ auto valueFetcher){
 };
 
 
+// shards are scheduled over however many threads this machine has
+// the destination is sized for every shard up front and each shard is moved into it as a whole
 auto loadMultiThreaded = [](auto loaderFunc, auto resultUnifier, QString nameBase,auto& destination){
-    QVector<QFuture<typename std::remove_reference<decltype(destination)>::type>> futures;
-    for(int i = 0; i < QThread::idealThreadCount()-1; i++)
+    using ContainerType = typename std::remove_reference<decltype(destination)>::type;
+    ShardManifest manifest;
+    if(!manifest.Read(nameBase))
+        manifest.Discover(nameBase);
+    std::vector<ContainerType> shards(static_cast<size_t>(manifest.Count()));
+    ParallelFor(shards.size(), {0, 1}, [&](size_t begin, size_t end){
+        for(auto shard = begin; shard < end; shard++)
+            shards[shard] = loaderFunc(nameBase, [](){return ContainerType();}, static_cast<int>(shard));
+    });
+    qint64 total = destination.size();
+    for(size_t shard = 0; shard < shards.size(); shard++)
     {
-        futures.push_back(QtConcurrent::run([nameBase,i, loaderFunc](){
-            qDebug() << "loading file: " << i;
-            return loaderFunc(nameBase, [](){return typename std::remove_reference<decltype(destination)>::type();},i);
-        }));
+        const auto expected = manifest.sizes[static_cast<int>(shard)];
+        if(expected != 0 && expected != shards[shard].size())
+            qDebug() << "shard " << shard << " of " << nameBase << " has " << shards[shard].size() << " entries instead of " << expected;
+        total += shards[shard].size();
     }
-    for(auto future: futures)
+    qDebug() << "starting unification of shards: " << shards.size();
+    destination.reserve(static_cast<int>(total));
+    for(auto& shard : shards)
     {
-        future.waitForFinished();
-    }
-    qDebug() << "starting unification";
-    for(auto future: futures)
-    {
-        resultUnifier(destination, future.result());
+        resultUnifier(destination, shard);
+        // memory of every shard is returned as soon as it's merged
+        shard = ContainerType();
     }
     qDebug() << "finished unification, size:" << destination.size() ;
 
 };
 
-auto vectorUnifier = [](auto& dest, auto source){
+auto vectorUnifier = [](auto& dest, auto& source){
     dest+=source;
 };
-auto hashUnifier = [](auto& dest, auto source){
-    dest.unite(source);
+auto hashUnifier = [](auto& dest, auto& source){
+    for(auto it = source.begin(); it != source.end(); it++)
+        dest[it.key()] = std::move(it.value());
 };
 auto genresFetchFunc = [](auto& container, QDataStream& in){
     int key;
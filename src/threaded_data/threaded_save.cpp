@@ -16,115 +16,92 @@ You should have received a copy of the GNU General Public License
 along with this program.  If not, see <http://www.gnu.org/licenses/>
 */
 #include "threaded_data/threaded_save.h"
+#include "threaded_data/shard_manifest.h"
+#include "threaded_data/parallel_for.h"
 
 #include <QThread>
 #include <QDebug>
 #include <QFuture>
 #include <QFutureWatcher>
 #include <QtConcurrent>
+#include <atomic>
 #include <iostream>
+#include <vector>
 
-struct DataKeeper{
-    QFile data;
-    QDataStream out;
-    int fileCounter = 0;
-};
 namespace  thread_boost{
 namespace  Impl{
 
-auto fileWrapperVector = [](DataKeeper* obj, int threadCount, int taskSize, int chunkSize, QString nameBase, auto actualWork){
-    obj->fileCounter = -1;
-    for(int i = 0; i < taskSize; i ++)
-    {
-        if( i%chunkSize == 0)
+// every shard is written by its own thread under a partial name
+// earlier shards and their manifest are only replaced once all of them are written
+auto saveSharded = [](QString nameBase, int taskSize, auto actualWork){
+    ShardManifest manifest;
+    const int shardCount = ShardManifest::ShardCountFor(taskSize);
+    std::vector<int> firstEntry(static_cast<size_t>(shardCount) + 1);
+    for(int shard = 0; shard <= shardCount; shard++)
+        firstEntry[static_cast<size_t>(shard)] = static_cast<int>(static_cast<qint64>(taskSize)*shard/shardCount);
+    for(int shard = 0; shard < shardCount; shard++)
+        manifest.sizes.push_back(firstEntry[static_cast<size_t>(shard) + 1] - firstEntry[static_cast<size_t>(shard)]);
+
+    std::atomic<bool> written{true};
+    ParallelFor(static_cast<size_t>(shardCount), {0, 1}, [&](size_t begin, size_t end){
+        for(auto shard = begin; shard < end; shard++)
         {
-            obj->fileCounter++;
-            obj->data.close();
-            obj->data.setFileName(QString("%1_%2.txt").arg(nameBase,QString::number(obj->fileCounter)));
-            if(obj->data.open(QFile::WriteOnly | QFile::Truncate))
-            {
-                obj->out.setDevice(&obj->data);
-                if(obj->fileCounter != threadCount)
-                {
-                    qDebug() << "writing task size of: " << chunkSize;
-                    obj->out << chunkSize;
-                }
-                else
-                {
-                    qDebug() << "writing task size of: " << taskSize%threadCount;
-                    obj->out << taskSize%threadCount;
-                }
-            }
-            else
+            QFile data(ShardManifest::PartialShardFileName(nameBase, static_cast<int>(shard)));
+            if(!data.open(QFile::WriteOnly | QFile::Truncate))
             {
-                qDebug() << "breaking on error";
-                break;
+                qDebug() << "could not open file: " << data.fileName();
+                written = false;
+                continue;
             }
+            QDataStream out(&data);
+            out << static_cast<qint32>(manifest.sizes[static_cast<int>(shard)]);
+            for(int i = firstEntry[shard]; i < firstEntry[shard + 1]; i++)
+                actualWork(out, i);
+            if(out.status() != QDataStream::Ok)
+                written = false;
         }
-        actualWork(obj->out, i);
-    }
-};
-auto fileWrapperHash = [](DataKeeper* obj,int threadCount, QString nameBase, auto container, auto actualWork){
-    int counter = -1;
-    int chunkSize = container.size()/threadCount;
-    int taskSize = container.size();
-    auto it = container.cbegin();
-    obj->fileCounter = -1;
-    while(it != container.cend())
+    });
+    if(!written)
     {
-        counter++;
-        if( counter%chunkSize == 0)
-        {
-            obj->fileCounter++;
-            obj->data.close();
-            obj->data.setFileName(QString("%1_%2.txt").arg(nameBase,QString::number(obj->fileCounter)));
-            if(obj->data.open(QFile::WriteOnly | QFile::Truncate))
-            {
-                obj->out.setDevice(&obj->data);
-                if(obj->fileCounter != threadCount)
-                {
-                    qDebug() << "writing task size of: " << chunkSize;
-                    obj->out << (quint32)chunkSize;
-                }
-                else
-                {
-                    qDebug() << "writing task size of: " << taskSize%threadCount;
-                    obj->out << (quint32)taskSize%threadCount;
-                }
-            }
-        }
-        actualWork(obj->out, it);
-        it++;
+        manifest.RemovePartialShards(nameBase);
+        qDebug() << "failed to write: " << nameBase;
     }
+    else if(!manifest.Publish(nameBase))
+        qDebug() << "failed to publish: " << nameBase;
+};
+
+auto fileWrapperVector = [](int taskSize, QString nameBase, auto actualWork){
+    saveSharded(nameBase, taskSize, actualWork);
+};
+auto fileWrapperHash = [](QString nameBase, const auto& container, auto actualWork){
+    std::vector<decltype(container.cbegin())> iterators;
+    iterators.reserve(static_cast<size_t>(container.size()));
+    for(auto it = container.cbegin(); it != container.cend(); it++)
+        iterators.push_back(it);
+    saveSharded(nameBase, container.size(), [&](QDataStream& out, int i){
+        actualWork(out, iterators[static_cast<size_t>(i)]);
+    });
 };
 
 
 }
 void SaveFicWeightCalcData(QString storageFolder,QVector<core::FicWeightPtr>& fics){
-    DataKeeper keeper;
-    int threadCount = QThread::idealThreadCount()-1;
-    Impl::fileWrapperVector(&keeper, threadCount, fics.size(),fics.size()/threadCount,storageFolder + "/fics",[&](auto& out,int i){
-        fics[i]->Serialize(out);
+    Impl::fileWrapperVector(fics.size(), storageFolder + "/fics",[&](auto& out,int i){
+        fics.at(i)->Serialize(out);
     });
 }
 void SaveAuthorsData(QString storageFolder,QList<core::AuthorPtr>& authors){
-    DataKeeper keeper;
-    int threadCount = QThread::idealThreadCount()-1;
-    Impl::fileWrapperVector(&keeper, threadCount, authors.size(),authors.size()/threadCount, storageFolder +"/authors",[&](auto& out,int i){
-        authors[i]->Serialize(out);});
+    Impl::fileWrapperVector(authors.size(), storageFolder +"/authors",[&](auto& out,int i){
+        authors.at(i)->Serialize(out);});
 }
 void SaveFavouritesData(QString storageFolder, QHash<int, QSet<int>>& favourites){
-    DataKeeper keeper;
-    int threadCount = QThread::idealThreadCount()-1;
-    Impl::fileWrapperHash(&keeper, threadCount, storageFolder + "/fav", favourites, [&](auto& out, auto it){
+    Impl::fileWrapperHash(storageFolder + "/fav", favourites, [&](auto& out, auto it){
         out << it.key();
         out << it.value();
     });
 }
 void SaveFavouritesData(QString storageFolder, QHash<int, Roaring>& favourites){
-    DataKeeper keeper;
-    int threadCount = QThread::idealThreadCount()-1;
-    Impl::fileWrapperHash(&keeper, threadCount, storageFolder + "/roafav", favourites, [&](auto& out, auto it){
+    Impl::fileWrapperHash(storageFolder + "/roafav", favourites, [&](auto& out, auto it){
         out << it.key();
 
         const Roaring& r = it.value();
@@ -138,18 +115,14 @@ void SaveFavouritesData(QString storageFolder, QHash<int, Roaring>& favourites){
     });
 }
 void SaveGenreDataForFavLists(QString storageFolder, QHash<int, std::array<double, 22> >& genreData){
-    DataKeeper keeper;
-    int threadCount = QThread::idealThreadCount()-1;
-    Impl::fileWrapperHash(&keeper, threadCount, storageFolder+ "/genre", genreData, [&](auto& out, auto it){
+    Impl::fileWrapperHash(storageFolder+ "/genre", genreData, [&](auto& out, auto it){
         out << it.key();
         for(auto value : it.value())
             out << value;
     });
 }
 void SaveFandomDataForFavLists(QString storageFolder, QHash<int, core::AuthorFavFandomStatsPtr>& fandomLists){
-    DataKeeper keeper;
-    int threadCount = QThread::idealThreadCount()-1;
-    Impl::fileWrapperHash(&keeper, threadCount,storageFolder+ "/fandomstats", fandomLists, [&](auto& out, auto it){
+    Impl::fileWrapperHash(storageFolder+ "/fandomstats", fandomLists, [&](auto& out, auto it){
         out << it.key();
         it.value()->Serialize(out);
     });
@@ -157,9 +130,7 @@ void SaveFandomDataForFavLists(QString storageFolder, QHash<int, core::AuthorFav
 
 
 void SaveData(QString storageFolder, QString fileName, QHash<int, Roaring>& favourites){
-    DataKeeper keeper;
-    int threadCount = QThread::idealThreadCount()-1;
-    Impl::fileWrapperHash(&keeper, threadCount, storageFolder + "/" + fileName, favourites, [&](auto& out, auto it){
+    Impl::fileWrapperHash(storageFolder + "/" + fileName, favourites, [&](auto& out, auto it){
         out << it.key();
 
         const Roaring& r = it.value();
@@ -173,41 +144,31 @@ void SaveData(QString storageFolder, QString fileName, QHash<int, Roaring>& favo
     });
 }
 void SaveData(QString storageFolder, QString fileName, QHash<int, QSet<int>>& favourites){
-    DataKeeper keeper;
-    int threadCount = QThread::idealThreadCount()-1;
-    Impl::fileWrapperHash(&keeper, threadCount, storageFolder + "/" + fileName, favourites, [&](auto& out, auto it){
+    Impl::fileWrapperHash(storageFolder + "/" + fileName, favourites, [&](auto& out, auto it){
         out << it.key();
         out << it.value();
     });
 }
 void SaveData(QString storageFolder, QString fileName, QHash<int, std::array<double, 22> > &genreData){
-    DataKeeper keeper;
-    int threadCount = QThread::idealThreadCount()-1;
-    Impl::fileWrapperHash(&keeper, threadCount, storageFolder+ "/" + fileName, genreData, [&](auto& out, auto it){
+    Impl::fileWrapperHash(storageFolder+ "/" + fileName, genreData, [&](auto& out, auto it){
         out << it.key();
         for(auto value : it.value())
             out << value;
     });
 }
 void SaveData(QString storageFolder, QString fileName, QHash<int, core::AuthorFavFandomStatsPtr>& fandomLists){
-    DataKeeper keeper;
-    int threadCount = QThread::idealThreadCount()-1;
-    Impl::fileWrapperHash(&keeper, threadCount,storageFolder+ "/" + fileName, fandomLists, [&](auto& out, auto it){
+    Impl::fileWrapperHash(storageFolder+ "/" + fileName, fandomLists, [&](auto& out, auto it){
         out << it.key();
         it.value()->Serialize(out);
     });
 }
 void SaveData(QString storageFolder, QString fileName, QVector<core::FicWeightPtr>& fics){
-    DataKeeper keeper;
-    int threadCount = QThread::idealThreadCount()-1;
-    Impl::fileWrapperVector(&keeper, threadCount, fics.size(),fics.size()/threadCount,storageFolder + "/" + fileName,[&](auto& out,int i){
-        fics[i]->Serialize(out);
+    Impl::fileWrapperVector(fics.size(), storageFolder + "/" + fileName,[&](auto& out,int i){
+        fics.at(i)->Serialize(out);
     });
 }
 void SaveData(QString storageFolder, QString fileName, QHash<int, core::FicWeightPtr> &fics){
-    DataKeeper keeper;
-    int threadCount = QThread::idealThreadCount()-1;
-    Impl::fileWrapperHash(&keeper, threadCount,storageFolder+ "/" + fileName, fics, [&](auto& out, auto it){
+    Impl::fileWrapperHash(storageFolder+ "/" + fileName, fics, [&](auto& out, auto it){
         out << it.key();
         it.value()->Serialize(out);
     });
@@ -215,9 +176,7 @@ void SaveData(QString storageFolder, QString fileName, QHash<int, core::FicWeigh
 
 void SaveData(QString storageFolder, QString fileName, QHash<int, QList<genre_stats::GenreBit>>& fics)
 {
-    DataKeeper keeper;
-    int threadCount = QThread::idealThreadCount()-1;
-    Impl::fileWrapperHash(&keeper, threadCount,storageFolder+ "/" + fileName, fics, [&](auto& out, auto it){
+    Impl::fileWrapperHash(storageFolder+ "/" + fileName, fics, [&](auto& out, auto it){
         out << it.key();
         out << it.value();
     });
@@ -225,9 +184,7 @@ void SaveData(QString storageFolder, QString fileName, QHash<int, QList<genre_st
 
 void SaveData(QString storageFolder, QString fileName, QHash<int, QString> &fics)
 {
-    DataKeeper keeper;
-    int threadCount = QThread::idealThreadCount()-1;
-    Impl::fileWrapperHash(&keeper, threadCount,storageFolder+ "/" + fileName, fics, [&](auto& out, auto it){
+    Impl::fileWrapperHash(storageFolder+ "/" + fileName, fics, [&](auto& out, auto it){
         out << it.key();
         out << it.value();
     });
@@ -235,18 +192,14 @@ void SaveData(QString storageFolder, QString fileName, QHash<int, QString> &fics
 
 void SaveData(QString storageFolder, QString fileName, QHash<uint32_t, genre_stats::ListMoodData>& moods)
 {
-    DataKeeper keeper;
-    int threadCount = QThread::idealThreadCount()-1;
-    Impl::fileWrapperHash(&keeper, threadCount,storageFolder+ "/" + fileName, moods, [&](auto& out, auto it){
+    Impl::fileWrapperHash(storageFolder+ "/" + fileName, moods, [&](auto& out, auto it){
         out << it.key();
         out << it.value();
     });
 }
 //void SaveData(QString storageFolder, QString fileName, QHash<int, double> &fics)
 //{
-//    DataKeeper keeper;
-//    int threadCount = QThread::idealThreadCount()-1;
-//    Impl::fileWrapperHash(&keeper, threadCount,storageFolder+ "/" + fileName, fics, [&](auto& out, auto it){
+//    Impl::fileWrapperHash(storageFolder+ "/" + fileName, fics, [&](auto& out, auto it){
 //        out << it.key();
 //        out << it.value();
 //    });